@@ -19,43 +19,13 @@
 
 #include "presetsmanager.h"
 #include "ui_presetsmanager.h"
+#include "src/presetsettings.h"
 #include <QDebug>
 #include <QDir>
 #include <QFileDialog>
 #include <QMessageBox>
 #include <QStandardPaths>
 
-static QString presetCodes[30] = {"EnhanceHeight ",
-                                  "EnhanceSoft ",
-                                  "BumpHeight ",
-                                  "BumpDistance",
-                                  "BumpSoft ",
-                                  "BumpCut ",
-                                  "Tile ",
-                                  "InvertX ",
-                                  "InvertY ",
-                                  "ParallaxType",
-                                  "BinaryThreshold ",
-                                  "BinaryFocus ",
-                                  "ParallaxSoft ",
-                                  "BinaryMinHeight ",
-                                  "BinaryErodeDilate ",
-                                  "HeightMapBrightness ",
-                                  "HeightMapContrast ",
-                                  "InvertParallax ",
-                                  "SpecularBlur ",
-                                  "SpecularBright ",
-                                  "SpecularContrast ",
-                                  "SpecularThresh ",
-                                  "SpecularInvert ",
-                                  "OcclusionBlur ",
-                                  "OcclusionBright ",
-                                  "OcclusionInvert ",
-                                  "OcclusionThresh ",
-                                  "OcclusionContrast ",
-                                  "OcclusionDistance ",
-                                  "OcclusionDistanceMode "};
-
 PresetsManager::PresetsManager(ProcessorSettings settings,
                                QList<ImageProcessor *> *processorList,
                                QWidget *parent)
@@ -79,36 +49,7 @@ PresetsManager::PresetsManager(ProcessorSettings settings,
         QIcon(QPixmap::fromImage(p->get_neighbour(1, 1))), p->get_name()));
   }
 
-  currentValues[0] = QString::number(*mSettings.normal_depth);
-  currentValues[1] = QString::number(*mSettings.normal_blur_radius);
-  currentValues[2] = QString::number(*mSettings.normal_bisel_depth);
-  currentValues[3] = QString::number(*mSettings.normal_bisel_distance);
-  currentValues[4] = QString::number(*mSettings.normal_bisel_blur_radius);
-  currentValues[5] = *mSettings.normal_bisel_soft ? "1" : "0";
-  currentValues[6] = *mSettings.tileable ? "1" : "0";
-  currentValues[7] = *mSettings.normalInvertX == -1 ? "1" : "0";
-  currentValues[8] = *mSettings.normalInvertY == -1 ? "1" : "0";
-  currentValues[9] = QString::number((int)*mSettings.parallax_type);
-  currentValues[10] = QString::number(*mSettings.parallax_max);
-  currentValues[11] = QString::number(*mSettings.parallax_focus);
-  currentValues[12] = QString::number(*mSettings.parallax_soft);
-  currentValues[13] = QString::number(*mSettings.parallax_min);
-  currentValues[14] = QString::number(*mSettings.parallax_erode_dilate);
-  currentValues[15] = QString::number(*mSettings.parallax_brightness);
-  currentValues[16] = QString::number(*mSettings.parallax_contrast * 1000);
-  currentValues[17] = QString::number(*mSettings.parallax_invert);
-  currentValues[18] = QString::number(*mSettings.specular_blur);
-  currentValues[19] = QString::number(*mSettings.specular_bright);
-  currentValues[20] = QString::number(*mSettings.specular_contrast * 1000);
-  currentValues[21] = QString::number(*mSettings.specular_thresh);
-  currentValues[22] = *mSettings.specular_invert ? "1" : "0";
-  currentValues[23] = QString::number(*mSettings.occlusion_blur);
-  currentValues[24] = QString::number(*mSettings.occlusion_bright);
-  currentValues[25] = *mSettings.occlusion_invert ? "1" : "0";
-  currentValues[26] = QString::number(*mSettings.occlusion_thresh);
-  currentValues[27] = QString::number(*mSettings.occlusion_contrast * 1000);
-  currentValues[28] = QString::number(*mSettings.occlusion_distance);
-  currentValues[29] = *mSettings.occlusion_distance_mode ? "1" : "0";
+  currentValues = PresetSettings::values(mSettings);
 
   lightList.clear();
   foreach (LightSource *light, *(mSettings.lightList)) {
@@ -165,29 +106,15 @@ void PresetsManager::on_pushButtonSavePreset_clicked() {
           saveLights = true;
         } else if (code != "") {
           int i = (*it)->text(1).toInt();
-          in << "\n" << presetCodes[i] << "\t" << currentValues[i];
+          in << "\n"
+             << PresetSettings::key_name(i) << "\t" << currentValues[i];
         }
       }
       ++it;
     }
 
-    if (saveLights) {
-      foreach (LightSource *light, lightList) {
-        QColor diffuseColor = light->get_diffuse_color();
-        QColor specularColor = light->get_specular_color();
-        QVector3D position = light->get_light_position();
-        in << "\nLightSource\n";
-        in << "DiffuseColor \t" << diffuseColor.red() << "\t"
-           << diffuseColor.green() << "\t" << diffuseColor.blue() << "\n";
-        in << "DiffuseIntensity \t" << light->get_diffuse_intensity() << "\n";
-        in << "SpecularColor \t" << specularColor.red() << "\t"
-           << specularColor.green() << "\t" << specularColor.blue() << "\n";
-        in << "SpecularScatter \t" << light->get_specular_scatter() << "\n";
-        in << "SpecularIntensity \t" << light->get_specular_intesity() << "\n";
-        in << "Position \t" << position.x() << "\t" << position.y() << "\t"
-           << position.z() << "\t";
-      }
-    }
+    if (saveLights)
+      in << PresetSettings::lights_text(lightList);
 
     preset.close();
     update_presets();
@@ -211,18 +138,22 @@ void PresetsManager::on_pushButtonAplyPreset_clicked() {
     return;
   }
   QByteArray settings = selected_preset.readAll();
-  QList<QByteArray> settings_list = settings.split('\n');
-  if (settings_list[0] != "[Laigter Preset]") {
+  if (!settings.startsWith("[Laigter Preset]")) {
     msg.setText(tr("Incorrect format."));
     msg.exec();
     return;
   }
+  QStringList errors;
+  PresetSettings presetSettings = PresetSettings::parse(settings, &errors);
+  if (!errors.isEmpty()) {
+    msg.setText(tr("Incorrect format.") + "\n" + errors.join("\n"));
+    msg.exec();
+    return;
+  }
 
   ui->groupBox->setEnabled(false);
   ui->groupBox_2->setEnabled(false);
 
-  settings_list.removeAt(0);
-
   QStringList processorList;
   foreach (QListWidgetItem *item, ui->listWidgetTextures->selectedItems()) {
     processorList.append(item->text());
@@ -231,17 +162,10 @@ void PresetsManager::on_pushButtonAplyPreset_clicked() {
     if (!processorList.contains(p->get_name()))
       continue;
 
-    if (settings.contains("LightSource")) {
-      p->get_light_list_ptr()->clear();
-    }
-
     ui->labelMessage->setText(tr("Applying ") + preset + tr(" to ") +
                               p->get_name() + "...");
     QApplication::processEvents();
-    for (int i = 0; i < settings_list.count(); i++) {
-      QByteArray setting = settings_list.at(i);
-      applyPresetSettings(setting, *p);
-    }
+    presetSettings.apply(*p);
   }
 
   ui->groupBox->setEnabled(true);
@@ -287,117 +211,3 @@ void PresetsManager::on_pushButtonImportPreset_clicked() {
   }
   update_presets();
 }
-
-Ui::preset_codes_array &PresetsManager::get_preset_codes() {
-  return presetCodes;
-}
-
-void PresetsManager::applyPresetSettings(QByteArray &setting,
-                                         ImageProcessor &p) {
-  Ui::preset_codes_array &presetCodes = PresetsManager::get_preset_codes();
-  QList<QByteArray> aux = setting.split('\t');
-  if (aux[0] == presetCodes[0]) {
-    p.set_normal_depth(aux[1].toInt());
-  } else if (aux[0] == presetCodes[1]) {
-    p.set_normal_blur_radius(aux[1].toInt());
-  } else if (aux[0] == presetCodes[2]) {
-    p.set_normal_bisel_depth(aux[1].toInt());
-  } else if (aux[0] == presetCodes[3]) {
-    p.set_normal_bisel_distance(aux[1].toInt());
-  } else if (aux[0] == presetCodes[4]) {
-    p.set_normal_bisel_blur_radius(aux[1].toInt());
-  } else if (aux[0] == presetCodes[5]) {
-    p.set_normal_bisel_soft((bool)aux[1].toInt());
-  } else if (aux[0] == presetCodes[6]) {
-    p.set_tileable((bool)aux[1].toInt());
-  } else if (aux[0] == presetCodes[7]) {
-    p.set_normal_invert_x((bool)aux[1].toInt());
-  } else if (aux[0] == presetCodes[8]) {
-    p.set_normal_invert_y((bool)aux[1].toInt());
-  } else if (aux[0] == presetCodes[9]) {
-    p.set_parallax_type((ParallaxType)aux[1].toInt());
-  } else if (aux[0] == presetCodes[10]) {
-    p.set_parallax_thresh(aux[1].toInt());
-  } else if (aux[0] == presetCodes[11]) {
-    p.set_parallax_focus(aux[1].toInt());
-  } else if (aux[0] == presetCodes[12]) {
-    p.set_parallax_soft(aux[1].toInt());
-  } else if (aux[0] == presetCodes[13]) {
-    p.set_parallax_min(aux[1].toInt());
-  } else if (aux[0] == presetCodes[14]) {
-    p.set_parallax_erode_dilate(aux[1].toInt());
-  } else if (aux[0] == presetCodes[15]) {
-    p.set_parallax_brightness(aux[1].toInt());
-  } else if (aux[0] == presetCodes[16]) {
-    p.set_parallax_contrast(aux[1].toInt());
-  } else if (aux[0] == presetCodes[17]) {
-    p.set_parallax_invert((bool)aux[1].toInt());
-  } else if (aux[0] == presetCodes[18]) {
-    p.set_specular_blur(aux[1].toInt());
-  } else if (aux[0] == presetCodes[19]) {
-    p.set_specular_bright(aux[1].toInt());
-  } else if (aux[0] == presetCodes[20]) {
-    p.set_specular_contrast(aux[1].toInt());
-  } else if (aux[0] == presetCodes[21]) {
-    p.set_specular_thresh(aux[1].toInt());
-  } else if (aux[0] == presetCodes[22]) {
-    p.set_specular_invert((bool)aux[1].toInt());
-  } else if (aux[0] == presetCodes[23]) {
-    p.set_occlusion_blur(aux[1].toInt());
-  } else if (aux[0] == presetCodes[24]) {
-    p.set_occlusion_bright(aux[1].toInt());
-  } else if (aux[0] == presetCodes[25]) {
-    p.set_occlusion_invert((bool)aux[1].toInt());
-  } else if (aux[0] == presetCodes[26]) {
-    p.set_occlusion_thresh(aux[1].toInt());
-  } else if (aux[0] == presetCodes[27]) {
-    p.set_occlusion_contrast(aux[1].toInt());
-  } else if (aux[0] == presetCodes[28]) {
-    p.set_occlusion_distance(aux[1].toInt());
-  } else if (aux[0] == presetCodes[29]) {
-    p.set_occlusion_distance_mode((bool)aux[1].toInt());
-  } else if (aux[0] == "LightSource") {
-    QList<LightSource *> *pLightList = p.get_light_list_ptr();
-    LightSource *light = new LightSource;
-    pLightList->append(light);
-  } else if (aux[0] == "DiffuseColor ") {
-    QList<LightSource *> *pLightList = p.get_light_list_ptr();
-    pLightList->last()->set_diffuse_color(
-        QColor(aux[1].toInt(), aux[2].toInt(), aux[3].toInt()));
-  } else if (aux[0] == "DiffuseIntensity ") {
-    QList<LightSource *> *pLightList = p.get_light_list_ptr();
-    pLightList->last()->set_diffuse_intensity(aux[1].toFloat());
-  } else if (aux[0] == "SpecularColor ") {
-    QList<LightSource *> *pLightList = p.get_light_list_ptr();
-    pLightList->last()->set_specular_color(
-        QColor(aux[1].toInt(), aux[2].toInt(), aux[3].toInt()));
-  } else if (aux[0] == "SpecularScatter ") {
-    QList<LightSource *> *pLightList = p.get_light_list_ptr();
-    pLightList->last()->set_specular_scatter(aux[1].toInt());
-  } else if (aux[0] == "SpecularIntensity ") {
-    QList<LightSource *> *pLightList = p.get_light_list_ptr();
-    pLightList->last()->set_specular_intensity(aux[1].toFloat());
-  } else if (aux[0] == "Position ") {
-    QList<LightSource *> *pLightList = p.get_light_list_ptr();
-    pLightList->last()->set_light_position(
-        QVector3D(aux[1].toFloat(), aux[2].toFloat(), aux[3].toFloat()));
-  }
-}
-
-void PresetsManager::applyPresets(QString &preset, ImageProcessor &p) {
-  QFile selected_preset(preset);
-  if (!selected_preset.open(QIODevice::ReadOnly)) {
-    return;
-  }
-  QByteArray settings = selected_preset.readAll();
-  if (settings.contains("LightSource")) {
-    p.get_light_list_ptr()->clear();
-  }
-
-  QList<QByteArray> settings_list = settings.split('\n');
-
-  for (int i = 0; i < settings_list.count(); i++) {
-    QByteArray setting = settings_list.at(i);
-    applyPresetSettings(setting, p);
-  }
-}
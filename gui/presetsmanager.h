@@ -29,9 +29,6 @@
 #include "src/lightsource.h"
 
 namespace Ui {
-
-typedef QString preset_codes_array[30];
-
 class PresetsManager;
 } // namespace Ui
 
@@ -43,9 +40,6 @@ public:
                           QList<ImageProcessor *> *processorList,
                           QWidget *parent = nullptr);
   ~PresetsManager();
-  static Ui::preset_codes_array &get_preset_codes();
-  static void applyPresetSettings(QByteArray &setting, ImageProcessor &p);
-  static void applyPresets(QString &preset, ImageProcessor &p);
 
 signals:
   void settingAplied();
@@ -69,7 +63,7 @@ private:
   QList<ImageProcessor *> *mProcessorList;
   QString presetsPath;
   QDir presetsDir;
-  QString currentValues[30];
+  QStringList currentValues;
   QList<LightSource *> lightList;
 };
 
@@ -21,7 +21,7 @@
 #
 #-------------------------------------------------
 
-QT       += core gui widgets
+QT       += core gui widgets concurrent network
 
 greaterThan(QT_MAJOR_VERSION, 4): QT += widgets
 
@@ -46,20 +46,52 @@ SOURCES += \
     gui/presetsmanager.cpp \
         main.cpp \
         mainwindow.cpp \
+    src/batchprocessor.cpp \
+    src/cpurenderer.cpp \
+    src/blockcompressor.cpp \
+    src/exportqueue.cpp \
     src/imageloader.cpp \
     src/imageprocessor.cpp \
+    src/lightbuffer.cpp \
     src/lightsource.cpp \
+    src/mapframe.cpp \
+    src/mapserver.cpp \
     src/openglwidget.cpp \
+    src/pngwriter.cpp \
+    src/presetsettings.cpp \
+    src/projectfile.cpp \
+    src/previewrenderer.cpp \
+    src/runstats.cpp \
+    src/shaderloader.cpp \
+    src/shadervariants.cpp \
+    src/spritebatch.cpp \
+    src/spritesheet.cpp \
     gui/nbselector.cpp
 
 HEADERS += \
     gui/aboutdialog.h \
     gui/presetsmanager.h \
         mainwindow.h \
+    src/batchprocessor.h \
+    src/cpurenderer.h \
+    src/blockcompressor.h \
+    src/exportqueue.h \
     src/imageloader.h \
     src/imageprocessor.h \
+    src/lightbuffer.h \
     src/lightsource.h \
+    src/mapframe.h \
+    src/mapserver.h \
     src/openglwidget.h \
+    src/pngwriter.h \
+    src/presetsettings.h \
+    src/projectfile.h \
+    src/previewrenderer.h \
+    src/runstats.h \
+    src/shaderloader.h \
+    src/shadervariants.h \
+    src/spritebatch.h \
+    src/spritesheet.h \
     gui/nbselector.h
 
 FORMS += \
@@ -75,6 +107,7 @@ else: unix:!android: target.path = /opt/$${TARGET}/bin
 
 unix{
     CONFIG += link_pkgconfig
+    PKGCONFIG += zlib
     packagesExist(opencv4){
         PKGCONFIG += opencv4
         DEFINES += CV_RGBA2GRAY=COLOR_RGBA2GRAY
@@ -131,6 +164,8 @@ RESOURCES += \
 win32: LIBS += C:\opencv-build\install\x64\mingw\bin\libopencv_core320.dll
 win32: LIBS += C:\opencv-build\install\x64\mingw\bin\libopencv_imgproc320.dll
 win32: LIBS += C:\opencv-build\install\x64\mingw\bin\libopencv_imgcodecs320.dll
+win32: LIBS += -lz
+win32: LIBS += -lpsapi
 
 win32: INCLUDEPATH += C:\opencv\build\include
 
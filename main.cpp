@@ -19,20 +19,56 @@
 
 #include "gui/presetsmanager.h"
 #include "mainwindow.h"
+#include "src/batchprocessor.h"
 #include "src/imageprocessor.h"
+#include "src/mapserver.h"
+#include "src/previewrenderer.h"
+#include "src/runstats.h"
 #include <QApplication>
 #include <QCommandLineParser>
 #include <QDebug>
 #include <QDir>
+#include <QElapsedTimer>
 #include <QFile>
+#include <QJsonDocument>
 #include <QOpenGLContext>
 #include <QStandardPaths>
+#include <QTextStream>
+#include <QThread>
 #include <QTranslator>
+#ifdef Q_OS_WIN
+#include <fcntl.h>
+#include <io.h>
+#endif
 
 QCoreApplication *createApplication(int &argc, char *argv[]) {
-  for (int i = 1; i < argc; ++i)
-    if (!qstrcmp(argv[i], "--no-gui"))
-      return new QCoreApplication(argc, argv);
+  bool noGui = false, preview = false, software = false, cpu = false;
+  for (int i = 1; i < argc; ++i) {
+    if (!qstrcmp(argv[i], "--no-gui") || !qstrcmp(argv[i], "-g"))
+      noGui = true;
+    else if (!qstrcmp(argv[i], "--preview"))
+      preview = true;
+    else if (!qstrcmp(argv[i], "--cpu-preview"))
+      cpu = true;
+    else if (!qstrcmp(argv[i], "--software-opengl") ||
+             !qstrcmp(argv[i], "-s"))
+      software = true;
+  }
+  if (noGui && preview && !cpu) {
+    /* Previews need a GUI application for the offscreen surface, but no
+     * display */
+    if (qEnvironmentVariableIsEmpty("QT_QPA_PLATFORM") &&
+        qEnvironmentVariableIsEmpty("DISPLAY") &&
+        qEnvironmentVariableIsEmpty("WAYLAND_DISPLAY"))
+      qputenv("QT_QPA_PLATFORM", "offscreen");
+    if (software) {
+      QCoreApplication::setAttribute(Qt::AA_UseSoftwareOpenGL);
+      qputenv("LIBGL_ALWAYS_SOFTWARE", "1");
+    }
+    return new QGuiApplication(argc, argv);
+  }
+  if (noGui)
+    return new QCoreApplication(argc, argv);
   return new QApplication(argc, argv);
 }
 
@@ -106,62 +142,252 @@ int main(int argc, char *argv[]) {
                                                  "generate parallax");
   argsParser.addOption(outputParallaxTextureOption);
 
+  QCommandLineOption outputConeTextureOption(
+      QStringList() << "cone",
+      "generate the cone step map of parallax (search radius from the "
+      "preset's ConeRadius, default 32)");
+  argsParser.addOption(outputConeTextureOption);
+
+  QCommandLineOption outputPackedTextureOption(
+      QStringList() << "k"
+                    << "packed",
+      "generate occlusion, specular, parallax, cone step and alpha packed in "
+      "one image",
+      "channel layout of o, s, p, c, a, 0 and 1, e.g. osp or ospa");
+  argsParser.addOption(outputPackedTextureOption);
+
+  QCommandLineOption ddsOption(
+      QStringList() << "dds",
+      "write block compressed dds maps (BC5 normal, BC4 single channel, "
+      "BC1/BC3 packed)",
+      "fast or quality");
+  argsParser.addOption(ddsOption);
+
   QCommandLineOption pressetOption(QStringList() << "r"
                                                  << "preset",
                                    "presset to load", "preset file path");
   argsParser.addOption(pressetOption);
 
+  QCommandLineOption sheetGridOption(QStringList() << "sheet-grid",
+                                     "process a sprite sheet per cell",
+                                     "columns x rows, e.g. 8x4");
+  argsParser.addOption(sheetGridOption);
+
+  QCommandLineOption sheetRectsOption(QStringList() << "sheet-rects",
+                                      "process a sprite sheet per cell",
+                                      "json file with the cell rects");
+  argsParser.addOption(sheetRectsOption);
+
+  QCommandLineOption heightMapOption(
+      QStringList() << "heightmap",
+      "custom heightmap; {name} stands for the input path without extension",
+      "heightmap path");
+  argsParser.addOption(heightMapOption);
+
+  QCommandLineOption specularMapOption(
+      QStringList() << "specular-map",
+      "custom specular map; {name} stands for the input path without "
+      "extension",
+      "specular map path");
+  argsParser.addOption(specularMapOption);
+
+  QCommandLineOption neighbourOption(
+      QStringList() << "neighbour",
+      "tile neighbour for tileable maps, may be repeated; position is one of "
+      "nw, n, ne, w, c, e, sw, s, se",
+      "position=path");
+  argsParser.addOption(neighbourOption);
+
+  QCommandLineOption manifestOption(
+      QStringList() << "manifest",
+      "process the inputs listed in a file, one per line",
+      "manifest file path");
+  argsParser.addOption(manifestOption);
+
+  QCommandLineOption jobsOption(QStringList() << "j"
+                                              << "jobs",
+                                "number of worker threads for --no-gui",
+                                "threads");
+  argsParser.addOption(jobsOption);
+
+  QCommandLineOption incrementalOption(
+      QStringList() << "incremental",
+      "skip inputs whose hash and settings match the cache, only writing "
+      "requested maps that are missing",
+      "cache file path");
+  argsParser.addOption(incrementalOption);
+
+  QCommandLineOption previewOption(
+      QStringList() << "preview",
+      "render the lit preview (_v) with the preset lights; works with "
+      "--no-gui through an offscreen surface");
+  argsParser.addOption(previewOption);
+
+  QCommandLineOption cpuPreviewOption(
+      QStringList() << "cpu-preview",
+      "render --preview on the CPU instead of OpenGL; also used when no "
+      "OpenGL context is available");
+  argsParser.addOption(cpuPreviewOption);
+
+  QCommandLineOption frameTimesOption(
+      QStringList() << "frame-times",
+      "show render time, input to frame latency and frame interval over the "
+      "preview");
+  argsParser.addOption(frameTimesOption);
+
+  QCommandLineOption coreProfileOption(
+      QStringList() << "core-profile",
+      "use an OpenGL 3.3 core profile context instead of a compatibility "
+      "one, as needed on macOS and by Mesa llvmpipe to get OpenGL 3.3");
+  argsParser.addOption(coreProfileOption);
+
+  QCommandLineOption ambientColorOption(QStringList() << "ambient-color",
+                                        "ambient color for --preview",
+                                        "color, e.g. #ffffff");
+  argsParser.addOption(ambientColorOption);
+
+  QCommandLineOption ambientIntensityOption(
+      QStringList() << "ambient-intensity", "ambient intensity for --preview",
+      "0 to 1");
+  argsParser.addOption(ambientIntensityOption);
+
+  QCommandLineOption parallaxLayersOption(
+      QStringList() << "parallax-layers",
+      "most depth layers parallax mapping steps through in --preview "
+      "(default 32)",
+      "layers");
+  argsParser.addOption(parallaxLayersOption);
+
+  QCommandLineOption coneStepOption(
+      QStringList() << "cone-step",
+      "step parallax through the cone step map in --preview instead of "
+      "depth layers");
+  argsParser.addOption(coneStepOption);
+
+  QCommandLineOption statsOption(
+      QStringList() << "stats",
+      "write per file and per stage timings and peak memory as JSON; - for "
+      "standard output",
+      "json file path");
+  argsParser.addOption(statsOption);
+
+  QCommandLineOption daemonOption(
+      QStringList() << "daemon",
+      "with --no-gui, keep running and serve map requests on a local socket",
+      "socket name");
+  argsParser.addOption(daemonOption);
+
+  QCommandLineOption daemonRootOption(
+      QStringList() << "daemon-root",
+      "with --daemon, only read inputs and write maps inside this directory "
+      "(default: the working directory)",
+      "directory");
+  argsParser.addOption(daemonRootOption);
+
+  QCommandLineOption stdinOption(
+      QStringList() << "stdin",
+      "with --no-gui, read the diffuse texture from standard input and write "
+      "the maps to standard output as a framed container");
+  argsParser.addOption(stdinOption);
+
+  QCommandLineOption rawSizeOption(
+      QStringList() << "raw-size",
+      "standard input holds raw RGBA8888 pixels of this size",
+      "width x height");
+  argsParser.addOption(rawSizeOption);
+
+  QCommandLineOption rawOutputOption(
+      QStringList() << "raw-output",
+      "write raw map planes to standard output instead of a framed container");
+  argsParser.addOption(rawOutputOption);
+
+  argsParser.addPositionalArgument(
+      "inputs", "diffuse textures, directories or wildcards to process",
+      "[inputs...]");
+
   QSurfaceFormat fmt;
   fmt.setDepthBufferSize(24);
   fmt.setSamples(16);
   fmt.setProfile(QSurfaceFormat::CompatibilityProfile);
+  /* Read before the application exists, contexts created by it already
+   * take the default format */
+  for (int i = 1; i < argc; ++i) {
+    if (!qstrcmp(argv[i], "--core-profile")) {
+      fmt.setVersion(3, 3);
+      fmt.setProfile(QSurfaceFormat::CoreProfile);
+    }
+  }
   QSurfaceFormat::setDefaultFormat(fmt);
 
   QScopedPointer<QCoreApplication> app(createApplication(argc, argv));
   argsParser.process(*app.data());
-  QImage auximage;
-
-  ImageProcessor *processor = new ImageProcessor();
-
-  bool succes = false;
-  QString inputDiffuseTextureOptionValue =
-      argsParser.value(inputDiffuseTextureOption);
-  if (!inputDiffuseTextureOptionValue.trimmed().isEmpty()) {
-    QFileInfo info(inputDiffuseTextureOptionValue);
-    QString suffix =
-        info.suffix(); // just the last suffix, not the complete one
-
-    QString pressetOptionValue = argsParser.value(pressetOption);
-    ImageLoader il;
-    auximage = il.loadImage(inputDiffuseTextureOptionValue, &succes);
-    auximage = auximage.convertToFormat(QImage::Format_RGBA8888_Premultiplied);
-    processor->loadImage(inputDiffuseTextureOptionValue, auximage);
-    if (!pressetOptionValue.trimmed().isEmpty()) {
-      PresetsManager::applyPresets(pressetOptionValue, *processor);
-    }
-    QString pathWithoutExtension = info.absoluteFilePath().remove("." + suffix);
-    if (argsParser.isSet(outputNormalTextureOption)) {
-      QImage normal = *processor->get_normal();
-      QString name = pathWithoutExtension + "_n." + suffix;
-      normal.save(name);
-    }
-    if (argsParser.isSet(outputSpecularTextureOption)) {
-      QImage specular = *processor->get_specular();
-      QString name = pathWithoutExtension + "_s." + suffix;
-      specular.save(name);
-    }
-    if (argsParser.isSet(outputOcclusionTextureOption)) {
-      QImage occlusion = *processor->get_occlusion();
-      QString name = pathWithoutExtension + "_o." + suffix;
-      occlusion.save(name);
+
+  BatchOptions batchOptions;
+  QString pressetOptionValue = argsParser.value(pressetOption);
+  if (!pressetOptionValue.trimmed().isEmpty()) {
+    QStringList errors;
+    batchOptions.preset = PresetSettings::load(pressetOptionValue, &errors);
+    if (!errors.isEmpty()) {
+      foreach (QString e, errors)
+        qCritical().noquote() << pressetOptionValue + ": " + e;
+      return 1;
     }
-    if (argsParser.isSet(outputParallaxTextureOption)) {
-      QImage parallax = *processor->get_parallax();
-      QString name = pathWithoutExtension + "_p." + suffix;
-      parallax.save(name);
+  }
+  batchOptions.sheetGrid = argsParser.value(sheetGridOption);
+  batchOptions.sheetRects = argsParser.value(sheetRectsOption);
+  batchOptions.heightMap = argsParser.value(heightMapOption);
+  batchOptions.specularMap = argsParser.value(specularMapOption);
+  QStringList positions = {"nw", "n", "ne", "w", "c", "e", "sw", "s", "se"};
+  foreach (QString n, argsParser.values(neighbourOption)) {
+    int i = positions.indexOf(n.section('=', 0, 0).toLower());
+    if (i >= 0 && n.contains('='))
+      batchOptions.neighbours[i] = n.section('=', 1);
+    else
+      qWarning() << "Invalid neighbour" << n;
+  }
+  batchOptions.normal = argsParser.isSet(outputNormalTextureOption);
+  batchOptions.specular = argsParser.isSet(outputSpecularTextureOption);
+  batchOptions.occlusion = argsParser.isSet(outputOcclusionTextureOption);
+  batchOptions.parallax = argsParser.isSet(outputParallaxTextureOption);
+  batchOptions.cone = argsParser.isSet(outputConeTextureOption);
+  batchOptions.packedLayout = argsParser.value(outputPackedTextureOption);
+  batchOptions.dds = argsParser.isSet(ddsOption);
+  batchOptions.blockQuality =
+      argsParser.value(ddsOption).toLower() == "quality"
+          ? BlockQuality::Quality
+          : BlockQuality::Fast;
+  batchOptions.preview = argsParser.isSet(previewOption);
+  BatchProcessor batch(batchOptions);
+
+  PreviewRenderer previewRenderer;
+  if (batchOptions.preview) {
+    PreviewSettings previewSettings;
+    if (argsParser.isSet(ambientColorOption))
+      previewSettings.ambientColor =
+          QColor(argsParser.value(ambientColorOption));
+    if (argsParser.isSet(ambientIntensityOption))
+      previewSettings.ambientIntensity =
+          argsParser.value(ambientIntensityOption).toFloat();
+    if (argsParser.isSet(parallaxLayersOption))
+      previewSettings.parallaxLayers =
+          qBound(1, argsParser.value(parallaxLayersOption).toInt(), 256);
+    previewSettings.coneStep = argsParser.isSet(coneStepOption);
+    previewRenderer.set_settings(previewSettings);
+    QString error = "no GUI application";
+    if (argsParser.isSet(cpuPreviewOption)) {
+      previewRenderer.use_cpu(true);
+    } else if (!qobject_cast<QGuiApplication *>(app.data()) ||
+               !previewRenderer.init(&error)) {
+      qWarning() << "Cannot render previews with OpenGL" << error
+                 << "- using the CPU renderer";
+      previewRenderer.use_cpu(true);
     }
+    batch.set_preview_renderer(&previewRenderer);
   }
 
+  QStringList inputs = argsParser.values(inputDiffuseTextureOption);
+  inputs << argsParser.positionalArguments();
+
   QApplication *a = qobject_cast<QApplication *>(app.data());
   int returnCode;
   if (a) {
@@ -173,20 +399,110 @@ int main(int argc, char *argv[]) {
     }
     MainWindow w;
     QGuiApplication::setWindowIcon(QIcon(":/images/laigter-icon.png"));
+    if (argsParser.isSet(frameTimesOption))
+      w.show_frame_times(true);
 
     w.show();
     qRegisterMetaType<ProcessedImage>("ProcessedImage");
 
-    if (succes) {
-      w.add_processor(processor);
-    } else {
-      delete processor;
+    if (!inputs.isEmpty()) {
+      ImageProcessor *processor = new ImageProcessor();
+      QString error;
+      if (batch.load(inputs.first(), processor, &error)) {
+        if (!batch.export_maps(processor, &error))
+          qWarning() << inputs.first() << error;
+        w.add_processor(processor);
+      } else {
+        qWarning() << inputs.first() << error;
+        delete processor;
+      }
     }
 
     returnCode = app->exec();
+  } else if (argsParser.isSet(stdinOption)) {
+#ifdef Q_OS_WIN
+    _setmode(_fileno(stdin), _O_BINARY);
+    _setmode(_fileno(stdout), _O_BINARY);
+#endif
+    QSize rawSize;
+    if (argsParser.isSet(rawSizeOption)) {
+      QStringList aux = argsParser.value(rawSizeOption).toLower().split('x');
+      if (aux.count() == 2)
+        rawSize = QSize(aux[0].toInt(), aux[1].toInt());
+    }
+    QFile in, out;
+    in.open(stdin, QIODevice::ReadOnly);
+    out.open(stdout, QIODevice::WriteOnly);
+    QString error;
+    if (batch.process_stream(&in, &out, rawSize,
+                             argsParser.isSet(rawOutputOption), &error)) {
+      returnCode = 0;
+    } else {
+      qWarning() << error;
+      returnCode = 1;
+    }
+  } else if (argsParser.isSet(daemonOption)) {
+    MapServer server;
+    server.set_max_threads(argsParser.value(jobsOption).toInt());
+    if (argsParser.isSet(daemonRootOption) &&
+        !server.set_root(argsParser.value(daemonRootOption))) {
+      qWarning() << "Cannot use root" << argsParser.value(daemonRootOption);
+      returnCode = 1;
+    } else if (server.listen(argsParser.value(daemonOption))) {
+      returnCode = app->exec();
+    } else {
+      qWarning() << "Cannot listen on" << argsParser.value(daemonOption)
+                 << server.error_string();
+      returnCode = 1;
+    }
   } else {
     // do CLI only things here
-    returnCode = 0;
+    QStringList files =
+        batch.collect_inputs(inputs, argsParser.value(manifestOption));
+    if (argsParser.isSet(incrementalOption) &&
+        !batch.load_cache(argsParser.value(incrementalOption)))
+      qWarning() << "Cannot read cache" << argsParser.value(incrementalOption);
+    int threads = argsParser.value(jobsOption).toInt();
+    QElapsedTimer timer;
+    timer.start();
+    QList<BatchResult> results = batch.run(files, threads);
+    qint64 wall = timer.nsecsElapsed();
+    if (!batch.save_cache())
+      qWarning() << "Cannot write cache" << argsParser.value(incrementalOption);
+    QString statsFile = argsParser.value(statsOption);
+    if (!statsFile.isEmpty()) {
+      QJsonDocument stats(RunStats::report(
+          results, wall, threads > 0 ? threads : QThread::idealThreadCount()));
+      QFile file;
+      if (statsFile == "-")
+        file.open(stdout, QIODevice::WriteOnly);
+      else
+        file.setFileName(statsFile);
+      if (!file.isOpen() && !file.open(QIODevice::WriteOnly))
+        qWarning() << "Cannot write stats" << statsFile << file.errorString();
+      else
+        file.write(stats.toJson());
+    }
+    int failed = 0, skipped = 0;
+    QString summary;
+    QTextStream out(&summary);
+    foreach (BatchResult r, results) {
+      if (r.skipped) {
+        out << "skipped " << r.fileName << "\n";
+        skipped++;
+      } else if (r.ok) {
+        out << "ok      " << r.fileName << "\n";
+      } else {
+        out << "failed  " << r.fileName << ": " << r.message << "\n";
+        failed++;
+      }
+    }
+    out << results.count() - failed - skipped << " processed, " << skipped
+        << " up to date, " << failed << " failed"
+        << "\n";
+    if (statsFile != "-")
+      QTextStream(stdout) << summary;
+    returnCode = failed > 0 ? 1 : 0;
   }
   return returnCode;
 }
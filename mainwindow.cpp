@@ -22,6 +22,8 @@
 #include "gui/nbselector.h"
 #include "gui/presetsmanager.h"
 #include "src/openglwidget.h"
+#include "src/projectfile.h"
+#include "src/spritesheet.h"
 #include "ui_mainwindow.h"
 
 #include <QColorDialog>
@@ -29,6 +31,7 @@
 #include <QDesktopServices>
 #include <QDragEnterEvent>
 #include <QFileDialog>
+#include <QInputDialog>
 #include <QListWidgetItem>
 #include <QMenu>
 #include <QMessageBox>
@@ -68,8 +71,14 @@ MainWindow::MainWindow(QWidget *parent)
           SLOT(showContextMenuForListWidget(const QPoint &)));
   connect(ui->sliderParallax, SIGNAL(valueChanged(int)),
           ui->openGLPreviewWidget, SLOT(setParallaxHeight(int)));
+  connect(ui->spinBoxParallaxLayers, SIGNAL(valueChanged(int)),
+          ui->openGLPreviewWidget, SLOT(setParallaxLayers(int)));
+  connect(ui->checkBoxConeStep, SIGNAL(toggled(bool)), ui->openGLPreviewWidget,
+          SLOT(setConeStep(bool)));
   connect(ui->checkBoxPixelated, SIGNAL(toggled(bool)), ui->openGLPreviewWidget,
           SLOT(setPixelated(bool)));
+  connect(ui->checkBoxDeferred, SIGNAL(toggled(bool)), ui->openGLPreviewWidget,
+          SLOT(setDeferred(bool)));
 
   connect(ui->openGLPreviewWidget, SIGNAL(selectedLightChanged(LightSource *)),
           this, SLOT(selectedLightChanged(LightSource *)));
@@ -111,6 +120,14 @@ MainWindow::MainWindow(QWidget *parent)
   connect(&fs_watcher, SIGNAL(fileChanged(QString)), this,
           SLOT(onFileChanged(QString)));
 
+  ui->progressBarExport->setVisible(false);
+  connect(&exportQueue, SIGNAL(progress(int, int)), this,
+          SLOT(export_progress(int, int)));
+  connect(&exportQueue, SIGNAL(finished(int, QStringList)), this,
+          SLOT(export_finished(int, QStringList)));
+  connect(ui->openGLPreviewWidget,
+          SIGNAL(preview_rendered(ImageProcessor *, QImage, QString)), this,
+          SLOT(export_preview(ImageProcessor *, QImage, QString)));
 }
 
 void MainWindow::showContextMenuForListWidget(const QPoint &pos) {
@@ -124,6 +141,10 @@ void MainWindow::showContextMenuForListWidget(const QPoint &pos) {
   contextMenu.addSeparator();
   contextMenu.addAction(new QAction(tr("Load specular map")));
   contextMenu.addAction(new QAction(tr("Reset specular map")));
+  contextMenu.addSeparator();
+  contextMenu.addAction(new QAction(tr("Sprite sheet grid")));
+  contextMenu.addAction(new QAction(tr("Load sprite sheet rects")));
+  contextMenu.addAction(new QAction(tr("Reset sprite sheet")));
 
   connect(&contextMenu, SIGNAL(triggered(QAction *)), this,
           SLOT(list_menu_action_triggered(QAction *)));
@@ -137,6 +158,9 @@ void MainWindow::list_menu_action_triggered(QAction *action) {
   if (action->text() == tr("Remove")) {
     QListWidgetItem *item = ui->listWidget->selectedItems().at(0);
     fs_watcher.removePath(item->text());
+    /* Big maps are written straight from their processor */
+    if (exportQueue.is_busy())
+      exportQueue.wait_for_done();
     for (int i = 0; i < processorList.count(); i++) {
       if (processorList.at(i)->get_name() == item->text()) {
         processorList.at(i)->deleteLater();
@@ -191,13 +215,52 @@ void MainWindow::list_menu_action_triggered(QAction *action) {
     QImage specular = il.loadImage(processor->get_name(), &succes);
     specular = specular.convertToFormat(QImage::Format_RGBA8888_Premultiplied);
     processor->loadSpecularMap(processor->get_name(), specular);
+  } else if (action->text() == tr("Sprite sheet grid")) {
+    bool ok;
+    QString spec = QInputDialog::getText(this, tr("Sprite sheet grid"),
+                                         tr("Columns x rows:"),
+                                         QLineEdit::Normal, "4x4", &ok);
+    if (!ok)
+      return;
+    QList<QRect> cells =
+        SpriteSheet::grid(processor->get_texture()->size(), spec, &ok);
+    if (!ok) {
+      ui->statusBar->showMessage(tr("Invalid grid ") + spec);
+      return;
+    }
+    processor->set_cells(cells);
+  } else if (action->text() == tr("Load sprite sheet rects")) {
+    QString fileName = QFileDialog::getOpenFileName(
+        this, tr("Open sprite sheet"), "", tr("JSON File (*.json)"));
+    if (fileName != nullptr) {
+      bool success;
+      QList<QRect> cells = SpriteSheet::from_json(fileName, &success);
+      if (!success) {
+        ui->statusBar->showMessage(tr("Cannot read cells from ") + fileName);
+        return;
+      }
+      processor->set_cells(cells);
+    }
+  } else if (action->text() == tr("Reset sprite sheet")) {
+    processor->set_cells(QList<QRect>());
   }
 }
 
 MainWindow::~MainWindow() { delete ui; }
 
+/* Queued maps are written before the window goes away */
+void MainWindow::closeEvent(QCloseEvent *event) {
+  if (exportQueue.is_busy())
+    exportQueue.wait_for_done();
+  QMainWindow::closeEvent(event);
+}
+
 void MainWindow::update_scene() {
-  ui->openGLPreviewWidget->need_to_update = true;
+  ui->openGLPreviewWidget->request_update();
+}
+
+void MainWindow::show_frame_times(bool show) {
+  ui->openGLPreviewWidget->set_frame_times_visible(show);
 }
 
 void MainWindow::on_actionOpen_triggered() {
@@ -206,6 +269,46 @@ void MainWindow::on_actionOpen_triggered() {
   open_files(fileNames);
 }
 
+void MainWindow::on_actionOpenProject_triggered() {
+  QString fileName = QFileDialog::getOpenFileName(
+      this, tr("Open Project"), "", tr("Laigter Project (*.laigter)"));
+  if (fileName == "")
+    return;
+  QStringList errors;
+  foreach (ImageProcessor *p, ProjectFile::load(fileName, &errors)) {
+    bool opened = false;
+    foreach (ImageProcessor *o, processorList)
+      opened |= o->get_name() == p->get_name();
+    if (opened) {
+      delete p;
+      continue;
+    }
+    fs_watcher.addPath(p->get_name());
+    add_processor(p);
+  }
+  if (!errors.isEmpty()) {
+    QMessageBox msgBox;
+    msgBox.setText(tr("Some images could not be restored.") + "\n" +
+                   errors.join("\n"));
+    msgBox.exec();
+  }
+}
+
+void MainWindow::on_actionSaveProject_triggered() {
+  QString fileName = QFileDialog::getSaveFileName(
+      this, tr("Save Project"), "", tr("Laigter Project (*.laigter)"));
+  if (fileName == "")
+    return;
+  if (QFileInfo(fileName).suffix() == "")
+    fileName += ".laigter";
+  QString error;
+  if (!ProjectFile::save(fileName, processorList, true, &error)) {
+    QMessageBox msgBox;
+    msgBox.setText(tr("Cannot save ") + fileName + ".\n" + error);
+    msgBox.exec();
+  }
+}
+
 void MainWindow::add_processor(ImageProcessor *p) {
 
   processorList.append(p);
@@ -282,7 +385,6 @@ void MainWindow::on_actionExport_triggered() {
   QImage n;
   QString suffix;
   QFileInfo info;
-  QString message = "";
 
   info = QFileInfo(fileName);
   suffix = info.completeSuffix();
@@ -291,40 +393,43 @@ void MainWindow::on_actionExport_triggered() {
   if (suffix == "")
     suffix = "png";
 
+  apply_export_settings();
+  QString mapSuffix = export_suffix(suffix);
   if (ui->checkBoxExportNormal->isChecked()) {
-    aux = info.absoluteFilePath().remove("." + suffix) + "_n." + suffix;
-    n = *processor->get_normal();
-    n.save(aux);
-    message += tr("Normal map was exported.\n");
+    aux = info.absoluteFilePath().remove("." + suffix) + "_n." + mapSuffix;
+    exportQueue.enqueue(*processor->get_normal(), aux, true, processor);
   }
   if (ui->checkBoxExportParallax->isChecked()) {
-    aux = info.absoluteFilePath().remove("." + suffix) + "_p." + suffix;
-    n = *processor->get_parallax();
-    n.save(aux);
-    message += tr("Parallax map was exported.\n");
+    aux = info.absoluteFilePath().remove("." + suffix) + "_p." + mapSuffix;
+    exportQueue.enqueue(*processor->get_parallax(), aux, false, processor);
+  }
+  if (ui->checkBoxExportCone->isChecked()) {
+    aux = info.absoluteFilePath().remove("." + suffix) + "_c." + mapSuffix;
+    exportQueue.enqueue(*processor->get_cone(), aux, false, processor);
   }
   if (ui->checkBoxExportSpecular->isChecked()) {
-    aux = info.absoluteFilePath().remove("." + suffix) + "_s." + suffix;
-    n = *processor->get_specular();
-    n.save(aux);
-    message += tr("Specular map was exported.\n");
+    aux = info.absoluteFilePath().remove("." + suffix) + "_s." + mapSuffix;
+    exportQueue.enqueue(*processor->get_specular(), aux, false, processor);
   }
   if (ui->checkBoxExportOcclusion->isChecked()) {
-    fileName = info.absoluteFilePath().remove("." + suffix) + "_o." + suffix;
-    n = *processor->get_occlusion();
-    n.save(fileName);
-    message += tr("Occlussion map was exported.\n");
+    aux = info.absoluteFilePath().remove("." + suffix) + "_o." + mapSuffix;
+    exportQueue.enqueue(*processor->get_occlusion(), aux, false, processor);
+  }
+  if (ui->checkBoxExportPacked->isChecked()) {
+    QString layout = ui->lineEditExportPackedLayout->text();
+    if (!ImageProcessor::is_valid_pack_layout(layout)) {
+      ui->statusBar->showMessage(tr("Invalid packed layout ") + layout);
+    } else {
+      aux = info.absoluteFilePath().remove("." + suffix) + "_" + layout + "." +
+            mapSuffix;
+      exportQueue.enqueue(processor->get_packed(layout), aux, false,
+                          processor);
+    }
   }
   if (ui->checkBoxExportPreview->isChecked()) {
     n = ui->openGLPreviewWidget->get_preview(false);
-    fileName = info.absoluteFilePath().remove("." + suffix) + "_v." + suffix;
-    n.save(fileName);
-    message += tr("Preview was exported.\n");
-  }
-  if (message != "") {
-    QMessageBox msgBox;
-    msgBox.setText(message);
-    msgBox.exec();
+    aux = info.absoluteFilePath().remove("." + suffix) + "_v." + suffix;
+    exportQueue.enqueue(n, aux);
   }
 }
 
@@ -371,6 +476,10 @@ void MainWindow::on_horizontalSliderDiffHeight_valueChanged(int value) {
   ui->openGLPreviewWidget->setLightHeight(value / 100.0);
 }
 
+void MainWindow::on_horizontalSliderRadius_valueChanged(int value) {
+  ui->openGLPreviewWidget->setLightRadius(value);
+}
+
 void MainWindow::on_horizontalSliderDiffLight_valueChanged(int value) {
   ui->openGLPreviewWidget->setLightIntensity(value / 100.0);
 }
@@ -437,6 +546,8 @@ void MainWindow::connect_processor(ImageProcessor *p) {
           SLOT(set_parallax_brightness(int)));
   connect(ui->sliderParallaxContrast, SIGNAL(valueChanged(int)), p,
           SLOT(set_parallax_contrast(int)));
+  connect(ui->spinBoxConeRadius, SIGNAL(valueChanged(int)), p,
+          SLOT(set_cone_radius(int)));
 
   connect(ui->sliderSpecSoft, SIGNAL(valueChanged(int)), p,
           SLOT(set_specular_blur(int)));
@@ -514,6 +625,8 @@ void MainWindow::disconnect_processor(ImageProcessor *p) {
              SLOT(set_parallax_brightness(int)));
   disconnect(ui->sliderParallaxContrast, SIGNAL(valueChanged(int)), p,
              SLOT(set_parallax_contrast(int)));
+  disconnect(ui->spinBoxConeRadius, SIGNAL(valueChanged(int)), p,
+             SLOT(set_cone_radius(int)));
 
   disconnect(ui->sliderSpecSoft, SIGNAL(valueChanged(int)), p,
              SLOT(set_specular_blur(int)));
@@ -570,66 +683,95 @@ void MainWindow::on_listWidget_itemSelectionChanged() {
     ui->listWidget->setCurrentRow(0);
   }
 
-  ui->openGLPreviewWidget->need_to_update = true;
+  ui->openGLPreviewWidget->request_update();
 }
 
-void MainWindow::on_pushButton_clicked() {
-  QImage n;
-  QString suffix;
+void MainWindow::on_pushButton_clicked() { export_all(""); }
+
+void MainWindow::apply_export_settings() {
+  exportQueue.set_compression(static_cast<PngCompression>(
+      ui->comboBoxExportCompression->currentIndex()));
+  exportQueue.set_block_quality(ui->comboBoxExportFormat->currentIndex() == 2
+                                    ? BlockQuality::Quality
+                                    : BlockQuality::Fast);
+}
+
+QString MainWindow::export_suffix(QString suffix) {
+  return ui->comboBoxExportFormat->currentIndex() > 0 ? "dds" : suffix;
+}
+
+void MainWindow::export_map(QImage *image, ImageProcessor *p, QString postfix,
+                            QString path, bool isNormal) {
+  QFileInfo info(p->get_name());
+  QString suffix = info.completeSuffix();
+  QString mapSuffix = export_suffix(suffix);
   QString name;
-  QFileInfo info;
-  QString message = "";
-  if (ui->checkBoxExportNormal->isChecked()) {
-    foreach (ImageProcessor *p, processorList) {
-      n = *p->get_normal();
-      info = QFileInfo(p->get_name());
-      suffix = info.completeSuffix();
-      name = info.absoluteFilePath().remove("." + suffix) + "_n." + suffix;
-      n.save(name);
-    }
-    message += tr("All normal maps were exported.\n");
-  }
-  if (ui->checkBoxExportParallax->isChecked()) {
-    foreach (ImageProcessor *p, processorList) {
-      n = *p->get_parallax();
-      info = QFileInfo(p->get_name());
-      suffix = info.completeSuffix();
-      name = info.absoluteFilePath().remove("." + suffix) + "_p." + suffix;
-      n.save(name);
-    }
-    message += tr("All parallax maps were exported.\n");
+  if (path == "") {
+    name = info.absoluteFilePath().remove("." + suffix) + postfix + "." +
+           mapSuffix;
+  } else {
+    name = exportQueue.unique_name(path, info.baseName(), postfix, mapSuffix);
   }
-  if (ui->checkBoxExportSpecular->isChecked()) {
-    foreach (ImageProcessor *p, processorList) {
-      n = *p->get_specular();
-      info = QFileInfo(p->get_name());
-      suffix = info.completeSuffix();
-      name = info.absoluteFilePath().remove("." + suffix) + "_s." + suffix;
-      n.save(name);
-    }
-    message += tr("All specular maps were exported.\n");
+  exportQueue.enqueue(*image, name, isNormal, p);
+}
+
+void MainWindow::export_all(QString path) {
+  apply_export_settings();
+  QString layout = ui->lineEditExportPackedLayout->text();
+  bool packed = ui->checkBoxExportPacked->isChecked();
+  if (packed && !ImageProcessor::is_valid_pack_layout(layout)) {
+    ui->statusBar->showMessage(tr("Invalid packed layout ") + layout);
+    packed = false;
   }
-  if (ui->checkBoxExportOcclusion->isChecked()) {
-    foreach (ImageProcessor *p, processorList) {
-      n = *p->get_occlusion();
-      info = QFileInfo(p->get_name());
-      suffix = info.completeSuffix();
-      name = info.absoluteFilePath().remove("." + suffix) + "_o." + suffix;
-      n.save(name);
+  foreach (ImageProcessor *p, processorList) {
+    if (ui->checkBoxExportNormal->isChecked())
+      export_map(p->get_normal(), p, "_n", path, true);
+    if (ui->checkBoxExportParallax->isChecked())
+      export_map(p->get_parallax(), p, "_p", path);
+    if (ui->checkBoxExportCone->isChecked())
+      export_map(p->get_cone(), p, "_c", path);
+    if (ui->checkBoxExportSpecular->isChecked())
+      export_map(p->get_specular(), p, "_s", path);
+    if (ui->checkBoxExportOcclusion->isChecked())
+      export_map(p->get_occlusion(), p, "_o", path);
+    if (packed) {
+      QImage packedImage = p->get_packed(layout);
+      export_map(&packedImage, p, "_" + layout, path);
     }
-    message += tr("All occlussion maps were exported.\n");
   }
   if (ui->checkBoxExportPreview->isChecked()) {
-    ui->openGLPreviewWidget->get_preview(false, true);
-    message += tr("All previews were exported.\n");
-  }
-  if (message != "") {
-    QMessageBox msgBox;
-    msgBox.setText(message);
-    msgBox.exec();
+    ui->openGLPreviewWidget->get_preview(false, true, path);
   }
 }
 
+/* Queues a preview rendered for export_all, named like the maps */
+void MainWindow::export_preview(ImageProcessor *p, QImage preview,
+                                QString path) {
+  QFileInfo info(p->get_name());
+  QString suffix = info.completeSuffix();
+  if (suffix == "")
+    suffix = "png";
+  QString name =
+      path == ""
+          ? info.absoluteFilePath().remove("." + suffix) + "_v." + suffix
+          : exportQueue.unique_name(path, info.baseName(), "_v", suffix);
+  exportQueue.enqueue(preview, name);
+}
+
+void MainWindow::export_progress(int done, int total) {
+  ui->progressBarExport->setVisible(true);
+  ui->progressBarExport->setMaximum(total);
+  ui->progressBarExport->setValue(done);
+}
+
+void MainWindow::export_finished(int written, QStringList failed) {
+  ui->progressBarExport->setVisible(false);
+  QString message = QString::number(written) + tr(" maps were exported.");
+  if (failed.count() > 0)
+    message += " " + tr("Could not write: ") + failed.join(", ");
+  ui->statusBar->showMessage(message);
+}
+
 void MainWindow::on_pushButtonBackgroundColor_clicked() {
   QColorDialog *cd = new QColorDialog(currentColor);
   connect(cd, SIGNAL(currentColorChanged(const QColor &)), this,
@@ -731,80 +873,12 @@ void MainWindow::on_comboBox_currentIndexChanged(int index) {
 }
 
 void MainWindow::on_pushButtonExportTo_clicked() {
-  QImage n;
-  QString suffix;
-  QString name;
-  QFileInfo info;
-  QString message = "";
   QString path = QFileDialog::getExistingDirectory();
   if (path != nullptr) {
-    if (ui->checkBoxExportNormal->isChecked()) {
-      foreach (ImageProcessor *p, processorList) {
-        n = *p->get_normal();
-        info = QFileInfo(p->get_name());
-        suffix = info.completeSuffix();
-        name = path + "/" + info.baseName() + "_n." + suffix;
-        int i = 1;
-        while (QFileInfo::exists(name))
-          name = path + "/" + info.baseName() + "(" + QString::number(++i) +
-                 ")" + "_n." + suffix;
-        n.save(name);
-      }
-      message += tr("All normal maps were exported.\n");
-    }
-    if (ui->checkBoxExportParallax->isChecked()) {
-      foreach (ImageProcessor *p, processorList) {
-        n = *p->get_parallax();
-        info = QFileInfo(p->get_name());
-        suffix = info.completeSuffix();
-        name = path + "/" + info.baseName() + "_p." + suffix;
-        int i = 1;
-        while (QFileInfo::exists(name))
-          name = path + "/" + info.baseName() + "(" + QString::number(++i) +
-                 ")" + "_p." + suffix;
-        n.save(name);
-      }
-      message += tr("All parallax maps were exported.\n");
-    }
-    if (ui->checkBoxExportSpecular->isChecked()) {
-      foreach (ImageProcessor *p, processorList) {
-        n = *p->get_specular();
-        info = QFileInfo(p->get_name());
-        suffix = info.completeSuffix();
-        name = path + "/" + info.baseName() + "_s." + suffix;
-        int i = 1;
-        while (QFileInfo::exists(name))
-          name = path + "/" + info.baseName() + "(" + QString::number(++i) +
-                 ")" + "_s." + suffix;
-        n.save(name);
-      }
-      message += tr("All specular maps were exported.\n");
-    }
-    if (ui->checkBoxExportOcclusion->isChecked()) {
-      foreach (ImageProcessor *p, processorList) {
-        n = *p->get_occlusion();
-        info = QFileInfo(p->get_name());
-        suffix = info.completeSuffix();
-        name = path + "/" + info.baseName() + "_o." + suffix;
-        int i = 1;
-        while (QFileInfo::exists(name))
-          name = path + "/" + info.baseName() + "(" + QString::number(++i) +
-                 ")" + "_o." + suffix;
-        n.save(name);
-      }
-      message += tr("All occlussion maps were exported.\n");
-    }
-    if (ui->checkBoxExportPreview->isChecked()) {
-      ui->openGLPreviewWidget->get_preview(false, true, path);
-      message += tr("All previews were exported.\n");
-    }
-    if (message != "") {
-      QMessageBox msgBox;
-      msgBox.setText(message);
-      msgBox.exec();
-    }
+    export_all(path);
   }
 }
+
 void MainWindow::dragEnterEvent(QDragEnterEvent *e) {
   if (e->mimeData()->hasUrls()) {
     e->acceptProposedAction();
@@ -900,6 +974,7 @@ void MainWindow::selectedLightChanged(LightSource *light) {
   ui->horizontalSliderSpec->setValue(light->get_specular_intesity() * 100);
   ui->horizontalSliderSpecScatter->setValue(light->get_specular_scatter());
   ui->horizontalSliderDiffHeight->setValue(light->get_height() * 100);
+  ui->horizontalSliderRadius->setValue(light->get_radius());
 
   QPixmap pixmap(100, 100);
   currentColor = light->get_diffuse_color();
@@ -956,6 +1031,7 @@ void MainWindow::processor_selected(ImageProcessor *processor, bool selected) {
         static_cast<int>(processor->get_parallax_contrast() * 1000));
     ui->sliderParallaxErodeDilate->setValue(
         processor->get_parallax_erode_dilate());
+    ui->spinBoxConeRadius->setValue(processor->get_cone_radius());
 
     ui->sliderSpecSoft->setValue(processor->get_specular_blur());
     ui->sliderSpecBright->setValue(processor->get_specular_bright());
@@ -1042,5 +1118,5 @@ void MainWindow::onFileChanged(const QString &file_path) {
       ip->loadHeightMap(file_path, auximage);
     }
   }
-  ui->openGLPreviewWidget->need_to_update = true;
+  ui->openGLPreviewWidget->request_update();
 }
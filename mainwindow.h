@@ -20,9 +20,11 @@
 #ifndef MAINWINDOW_H
 #define MAINWINDOW_H
 
+#include "src/exportqueue.h"
 #include "src/imageloader.h"
 #include "src/imageprocessor.h"
 #include "src/lightsource.h"
+#include <QCloseEvent>
 #include <QColor>
 #include <QFileSystemWatcher>
 #include <QGraphicsScene>
@@ -45,6 +47,7 @@ public:
   ~MainWindow();
   void dropEvent(QDropEvent *event);
   void dragEnterEvent(QDragEnterEvent *e);
+  void show_frame_times(bool show);
 
 public slots:
   void update_scene();
@@ -69,6 +72,10 @@ private slots:
   void openGL_initialized();
   void on_actionOpen_triggered();
 
+  void on_actionOpenProject_triggered();
+
+  void on_actionSaveProject_triggered();
+
   void on_actionFitZoom_triggered();
 
   void on_actionZoom_100_triggered();
@@ -82,6 +89,7 @@ private slots:
   void on_pushButtonColor_clicked();
 
   void on_horizontalSliderDiffHeight_valueChanged(int value);
+  void on_horizontalSliderRadius_valueChanged(int value);
 
   void on_horizontalSliderDiffLight_valueChanged(int value);
 
@@ -121,7 +129,22 @@ private slots:
 
   void onFileChanged(const QString &file_path);
 
+  void export_progress(int done, int total);
+
+  void export_finished(int written, QStringList failed);
+
+  void export_preview(ImageProcessor *p, QImage preview, QString path);
+
+protected:
+  void closeEvent(QCloseEvent *event) override;
+
 private:
+  void apply_export_settings();
+  QString export_suffix(QString suffix);
+  void export_map(QImage *image, ImageProcessor *p, QString postfix,
+                  QString path, bool isNormal = false);
+  void export_all(QString path);
+
   Ui::MainWindow *ui;
   QOpenGLWidget *gl;
   QGraphicsScene *m_normal_scene;
@@ -135,6 +158,7 @@ private:
   QList<ImageProcessor *> selectedProcessors;
   ImageLoader il;
   QFileSystemWatcher fs_watcher;
+  ExportQueue exportQueue;
 };
 
 #endif // MAINWINDOW_H
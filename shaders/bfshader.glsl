@@ -0,0 +1,103 @@
+/*
+ * Laigter: an automatic map generator for lighting effects.
+ * Copyright (C) 2019  Pablo Ivan Fonovich
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ * Contact: azagaya.games@gmail.com
+ */
+
+/* Instanced variant of fshader.glsl, only built as GLSL 3.30. Every sprite
+ * lives in one layer of the map arrays, anchored at the top left corner;
+ * uvScale maps the quad onto the part of the layer it fills. flags holds
+ * selected and parallax. */
+#include "sprite.glsl"
+
+in vec2 texCoord;
+in vec3 FragPos;
+flat in float layer;
+flat in vec2 uvScale;
+flat in vec2 pixels;
+flat in vec2 flags;
+
+uniform sampler2DArray TEX;
+uniform sampler2DArray normalMap;
+uniform sampler2DArray parallaxMap;
+uniform sampler2DArray specularMap;
+uniform sampler2DArray occlusionMap;
+uniform sampler2DArray coneMap;
+uniform vec3 viewPos;
+
+uniform vec3 outlineColor;
+
+vec4 sampleMap(sampler2DArray map, vec2 coords) {
+  return texture(map, vec3(coords * uvScale, layer));
+}
+
+float depthAt(vec2 texCoords) { return sampleMap(parallaxMap, texCoords).r; }
+
+float coneAt(vec2 texCoords) {
+  float cone = sampleMap(coneMap, texCoords).r;
+  return cone * cone;
+}
+
+void main() {
+  vec3 viewDir = normalize(viewPos - FragPos);
+
+  vec2 texCoords = texCoord;
+  if (PIXELATED) {
+    vec2 coords = texCoords * pixels;
+
+    texCoords = (floor(coords) + 0.5 / pixels) / pixels;
+  }
+  if (PARALLAX && flags.y > 0.5) {
+    texCoords = CONE_STEP ? ConeStepMapping(texCoords, viewDir)
+                         : ParallaxMapping(texCoords, viewDir);
+
+    if (texCoords.x > 1.0 || texCoords.y > 1.0 || texCoords.x < 0.0 ||
+        texCoords.y < 0.0)
+      discard;
+  }
+
+  vec3 normal = normalize(sampleMap(normalMap, texCoords).xyz * 2.0 - 1.0);
+  vec3 specMap = sampleMap(specularMap, texCoords).xyz;
+  vec4 l_color = vec4(0.0);
+  vec4 tex = sampleMap(TEX, texCoords);
+
+  float occlusion = sampleMap(occlusionMap, texCoords).x;
+
+#ifdef GBUFFER
+  l_color = tex;
+#else
+  l_color = Lighting(tex, normal, specMap, occlusion, viewDir, FragPos.xy);
+#endif
+
+  bool outline = flags.x > 0.5 && (texCoord.x <= 1.0 / pixels.x ||
+                                   texCoord.x >= (pixels.x - 1.0) / pixels.x ||
+                                   texCoord.y <= 1.0 / pixels.y ||
+                                   texCoord.y >= (pixels.y - 1.0) / pixels.y);
+  if (outline) {
+    fragColor.xyz = 1.0 - outlineColor;
+    fragColor.a = 0.5;
+  } else if (LIGHTING) {
+    fragColor = l_color;
+  } else {
+    fragColor = tex;
+  }
+#ifdef GBUFFER
+  // the outline is not lit
+  gNormal = vec4(normal * 0.5 + 0.5, fragColor.a);
+  gSpecular = vec4(specMap, fragColor.a);
+  gOcclusion = vec4(occlusion, outline ? 0.0 : 1.0, 0.0, fragColor.a);
+#endif
+}
@@ -0,0 +1,48 @@
+/*
+ * Laigter: an automatic map generator for lighting effects.
+ * Copyright (C) 2019  Pablo Ivan Fonovich
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ * Contact: azagaya.games@gmail.com
+ */
+
+/* Instanced variant of vshader.glsl: the quad is shared and each instance
+ * carries its sprite's placement and texture array layer. Only built as
+ * GLSL 3.30. */
+in vec3 aPos;
+in vec2 aTexCoord;
+// fixed so every variant of the program shares the vertex array
+layout(location = 2) in vec3 aOffset;
+layout(location = 3) in vec2 aScale;
+layout(location = 4) in float aLayer;
+layout(location = 5) in vec2 aUvScale;
+layout(location = 6) in vec2 aPixels;
+layout(location = 7) in vec2 aFlags;
+
+out vec2 texCoord;
+out vec3 FragPos;
+flat out float layer;
+flat out vec2 uvScale;
+flat out vec2 pixels;
+flat out vec2 flags;
+
+void main() {
+  gl_Position = vec4(aOffset + vec3(aPos.xy * aScale, aPos.z), 1.0);
+  FragPos = gl_Position.xyz;
+  texCoord = aTexCoord;
+  layer = aLayer;
+  uvScale = aUvScale;
+  pixels = aPixels;
+  flags = aFlags;
+}
@@ -0,0 +1,98 @@
+/*
+ * Laigter: an automatic map generator for lighting effects.
+ * Copyright (C) 2019  Pablo Ivan Fonovich
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ * Contact: azagaya.games@gmail.com
+ */
+
+/* Deferred lighting, only built as GLSL 3.30. The G-buffer holds what
+ * fshader.glsl reads from the maps, written by its GBUFFER variants for
+ * every pixel of the view: the texture, normal, specular and, in the
+ * occlusion buffer, occlusion and whether the pixel is lit. Blending left
+ * every buffer premultiplied by the coverage in alpha. With AMBIENT this
+ * puts the ambient term over the background, otherwise it adds the light
+ * of one instance of dvshader.glsl. */
+struct lightSource {
+  vec3 lightPos;
+  vec3 lightColor;
+  float diffIntensity;
+  vec3 specColor;
+  float specIntensity;
+  float specScatter;
+  float radius;
+};
+
+layout(std140) uniform Lights {
+  int lightNum;
+  vec2 viewSize;
+  vec3 ambientColor;
+  float ambientIntensity;
+  lightSource Light[MAX_LIGHTS];
+};
+
+in vec3 FragPos;
+flat in int lightIndex;
+
+uniform sampler2D albedoBuffer;
+uniform sampler2D normalBuffer;
+uniform sampler2D specularBuffer;
+uniform sampler2D occlusionBuffer;
+uniform vec3 viewPos;
+
+float Attenuation(lightSource l, vec2 fragPos);
+
+void main() {
+  ivec2 pixel = ivec2(gl_FragCoord.xy);
+  vec4 albedo = texelFetch(albedoBuffer, pixel, 0);
+  if (albedo.a <= 0.0)
+    discard;
+  vec4 surface = texelFetch(occlusionBuffer, pixel, 0) / albedo.a;
+  float occlusion = surface.x;
+  float lit = surface.y;
+
+#ifdef AMBIENT
+  vec3 ambient = ambientColor * ambientIntensity * occlusion;
+  fragColor = vec4(albedo.rgb * mix(vec3(1.0), ambient, lit), albedo.a);
+#else
+  if (lit <= 0.0)
+    discard;
+  vec3 normal = normalize(
+      texelFetch(normalBuffer, pixel, 0).xyz / albedo.a * 2.0 - 1.0);
+  vec3 specMap = texelFetch(specularBuffer, pixel, 0).xyz / albedo.a;
+  vec3 viewDir = normalize(viewPos - FragPos);
+
+  lightSource l = Light[lightIndex];
+  vec3 lightDir = normalize(l.lightPos - vec3(FragPos.xy, 0.0));
+  vec3 reflectDir = reflect(-lightDir, normal);
+  float spec = pow(max(dot(viewDir, reflectDir), 0.0), l.specScatter);
+  vec3 specular = l.specIntensity * spec * l.specColor * specMap;
+  float diff = max(dot(normal, lightDir), 0.0);
+  vec3 diffuse = diff * l.lightColor * l.diffIntensity;
+
+  // added with GL_ONE, GL_ONE
+  fragColor = vec4(albedo.rgb * (diffuse + specular) * lit *
+                       Attenuation(l, FragPos.xy),
+                   0.0);
+#endif
+}
+
+// see sprite.glsl
+float Attenuation(lightSource l, vec2 fragPos) {
+  if (l.radius <= 0.0)
+    return 1.0;
+  vec2 d = (l.lightPos.xy - fragPos) * viewSize * 0.5 / l.radius;
+  float f = clamp(1.0 - dot(d, d), 0.0, 1.0);
+  return f * f;
+}
@@ -0,0 +1,58 @@
+/*
+ * Laigter: an automatic map generator for lighting effects.
+ * Copyright (C) 2019  Pablo Ivan Fonovich
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ * Contact: azagaya.games@gmail.com
+ */
+
+/* Light volumes of the deferred pass, only built as GLSL 3.30. The shared
+ * quad is moved over the square each light's radius reaches, or left over
+ * the whole view for lights without one; one instance per light. With
+ * AMBIENT it always covers the view. */
+struct lightSource {
+  vec3 lightPos;
+  vec3 lightColor;
+  float diffIntensity;
+  vec3 specColor;
+  float specIntensity;
+  float specScatter;
+  float radius;
+};
+
+layout(std140) uniform Lights {
+  int lightNum;
+  vec2 viewSize;
+  vec3 ambientColor;
+  float ambientIntensity;
+  lightSource Light[MAX_LIGHTS];
+};
+
+in vec3 aPos;
+in vec2 aTexCoord;
+
+out vec3 FragPos;
+flat out int lightIndex;
+
+void main() {
+  vec2 pos = aPos.xy;
+  lightIndex = gl_InstanceID;
+#ifndef AMBIENT
+  float radius = Light[lightIndex].radius;
+  if (radius > 0.0)
+    pos = Light[lightIndex].lightPos.xy + pos * radius * 2.0 / viewSize;
+#endif
+  gl_Position = vec4(pos, 0.0, 1.0);
+  FragPos = gl_Position.xyz;
+}
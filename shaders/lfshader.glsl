@@ -34,5 +34,5 @@ void main() {
   } else {
     color.xyz *= (lightColor + vec3(0.8, 0.8, 0.8));
   }
-  gl_FragColor = vec4(color.xyz, alpha);
+  fragColor = vec4(color.xyz, alpha);
 }
@@ -0,0 +1,192 @@
+/*
+ * Laigter: an automatic map generator for lighting effects.
+ * Copyright (C) 2019  Pablo Ivan Fonovich
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ * Contact: azagaya.games@gmail.com
+ */
+
+/* Shared by fshader.glsl and bfshader.glsl, which ShaderLoader expands in
+ * place of their #include line: the lights, the variant switches and
+ * G-buffer outputs, and the parallax and lighting functions. The shader
+ * defines depthAt and coneAt to read its parallax and cone step maps. */
+struct lightSource {
+  vec3 lightPos;
+  vec3 lightColor;
+  float diffIntensity;
+  vec3 specColor;
+  float specIntensity;
+  float specScatter;
+  float radius;
+};
+
+#ifndef MAX_LIGHTS
+#define MAX_LIGHTS 32
+#endif
+
+/* One uniform buffer shared by every program when built as GLSL 3.30, see
+ * src/lightbuffer.cpp for the layout */
+#ifdef LIGHT_BLOCK
+layout(std140) uniform Lights {
+  int lightNum;
+  vec2 viewSize;
+  vec3 ambientColor;
+  float ambientIntensity;
+  lightSource Light[MAX_LIGHTS];
+};
+#else
+uniform lightSource Light[MAX_LIGHTS];
+uniform int lightNum;
+uniform vec2 viewSize;
+uniform vec3 ambientColor;
+uniform float ambientIntensity;
+#endif
+
+/* Variants built by src/shadervariants.cpp define these as constants, and
+ * LIGHT_COUNT as the number of lights padded to a fixed bucket */
+#ifndef VARIANT
+uniform bool light;
+uniform bool parallax;
+uniform bool pixelated;
+uniform bool coneStep;
+#define LIGHTING light
+#define PARALLAX parallax
+#define PIXELATED pixelated
+#define CONE_STEP coneStep
+#define LIGHT_COUNT lightNum
+#endif
+
+/* The rest of the surface for the deferred light pass, see dfshader.glsl.
+ * Only built as GLSL 3.30, where fragColor is at location 0. */
+#ifdef GBUFFER
+layout(location = 1) out vec4 gNormal;
+layout(location = 2) out vec4 gSpecular;
+layout(location = 3) out vec4 gOcclusion;
+#endif
+
+uniform float height_scale;
+uniform int parallaxLayers;
+
+// upper bound of parallaxLayers, and binary search steps after the layers
+const int maxParallaxLayers = 256;
+const int parallaxRefinement = 5;
+// fetches of the cone step map when it replaces the layers
+const int coneSteps = 16;
+
+// depth, and cone ratio measured on one repetition of the texture, at
+// texCoords of the sprite
+float depthAt(vec2 texCoords);
+float coneAt(vec2 texCoords);
+
+vec2 ParallaxMapping(vec2 texCoords, vec3 viewDir) {
+  // number of depth layers: parallaxLayers at grazing angles, a quarter of
+  // that looking straight down, where the steps are shortest
+  float maxLayers = float(parallaxLayers);
+  float minLayers = max(maxLayers * 0.25, 1.0);
+  float numLayers =
+      mix(maxLayers, minLayers, abs(dot(vec3(0.0, 0.0, 1.0), viewDir)));
+  // calculate the size of each layer
+  float layerDepth = 1.0 / numLayers;
+  // the amount to shift the texture coordinates per layer (from vector P)
+  vec2 P = viewDir.xy * height_scale;
+  vec2 deltaTexCoords = vec2(-P.x, P.y) / numLayers;
+
+  // linear search for the first layer below the surface
+  vec2 currentTexCoords = texCoords;
+  float currentLayerDepth = 0.0;
+  float currentDepthMapValue = depthAt(currentTexCoords);
+  for (int i = 0; i < maxParallaxLayers; i++) {
+    if (currentLayerDepth >= currentDepthMapValue)
+      break;
+    currentTexCoords += deltaTexCoords;
+    currentDepthMapValue = depthAt(currentTexCoords);
+    currentLayerDepth += layerDepth;
+  }
+
+  // binary search between that layer and the one before it
+  vec2 prevTexCoords = currentTexCoords - deltaTexCoords;
+  float prevLayerDepth = currentLayerDepth - layerDepth;
+  float prevDepthMapValue = depthAt(prevTexCoords);
+  for (int i = 0; i < parallaxRefinement; i++) {
+    vec2 midTexCoords = 0.5 * (prevTexCoords + currentTexCoords);
+    float midLayerDepth = 0.5 * (prevLayerDepth + currentLayerDepth);
+    float midDepthMapValue = depthAt(midTexCoords);
+    if (midLayerDepth < midDepthMapValue) {
+      prevTexCoords = midTexCoords;
+      prevLayerDepth = midLayerDepth;
+      prevDepthMapValue = midDepthMapValue;
+    } else {
+      currentTexCoords = midTexCoords;
+      currentLayerDepth = midLayerDepth;
+      currentDepthMapValue = midDepthMapValue;
+    }
+  }
+
+  // interpolation of texture coordinates
+  float afterDepth = currentDepthMapValue - currentLayerDepth;
+  float beforeDepth = prevDepthMapValue - prevLayerDepth;
+  float weight = afterDepth / (afterDepth - beforeDepth);
+  return prevTexCoords * weight + currentTexCoords * (1.0 - weight);
+}
+
+// every step goes as far along the ray as the cone stored for the point
+// allows, which never passes the surface, see cone_step_map() in
+// src/imageprocessor.cpp
+vec2 ConeStepMapping(vec2 texCoords, vec3 viewDir) {
+  vec2 P = viewDir.xy * height_scale;
+  vec3 rayStep = vec3(-P.x, P.y, 1.0);
+  float rayRatio = length(rayStep.xy);
+  vec3 pos = vec3(texCoords, 0.0);
+  for (int i = 0; i < coneSteps; i++) {
+    float cone = coneAt(pos.xy);
+    float height = max(depthAt(pos.xy) - pos.z, 0.0);
+    pos += rayStep * (cone * height / max(rayRatio + cone, 1e-6));
+  }
+  return pos.xy;
+}
+
+// 1 at the light, fading out to 0 at its radius, which is in view pixels
+float Attenuation(lightSource l, vec2 fragPos) {
+  if (l.radius <= 0.0)
+    return 1.0;
+  vec2 d = (l.lightPos.xy - fragPos) * viewSize * 0.5 / l.radius;
+  float f = clamp(1.0 - dot(d, d), 0.0, 1.0);
+  return f * f;
+}
+
+// tex lit by every light and the ambient light, which occlusion darkens.
+// Each light adds 2.0 to the alpha; that is added once for the lightNum real
+// ones, so the padding up to LIGHT_COUNT (see src/lightbuffer.cpp) needs no
+// branch in the loop.
+vec4 Lighting(vec4 tex, vec3 normal, vec3 specMap, float occlusion,
+              vec3 viewDir, vec2 fragPos) {
+  vec3 lit = vec3(0.0);
+  for (int i = 0; i < LIGHT_COUNT; i++) {
+    vec3 lightDir = normalize(Light[i].lightPos - vec3(fragPos, 0.0));
+
+    vec3 reflectDir = reflect(-lightDir, normal);
+
+    float spec = pow(max(dot(viewDir, reflectDir), 0.0), Light[i].specScatter);
+    vec3 specular =
+        Light[i].specIntensity * spec * Light[i].specColor * specMap;
+
+    float diff = max(dot(normal, lightDir), 0.0);
+    vec3 diffuse = diff * Light[i].lightColor * Light[i].diffIntensity;
+
+    lit += (diffuse + specular) * Attenuation(Light[i], fragPos);
+  }
+  vec4 l_color = vec4(lit, 2.0 * float(lightNum));
+  return tex *
+         (l_color + vec4(ambientColor, 1.0) * ambientIntensity * occlusion);
+}
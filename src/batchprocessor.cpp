@@ -0,0 +1,521 @@
+/*
+ * Laigter: an automatic map generator for lighting effects.
+ * Copyright (C) 2019  Pablo Ivan Fonovich
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ * Contact: azagaya.games@gmail.com
+ */
+
+#include "batchprocessor.h"
+#include "src/exportqueue.h"
+#include "src/imageloader.h"
+#include "src/mapframe.h"
+#include "src/spritesheet.h"
+#include <QCoreApplication>
+#include <QCryptographicHash>
+#include <QDir>
+#include <QDirIterator>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QImageReader>
+#include <QMutexLocker>
+#include <QRunnable>
+#include <QSet>
+#include <QTextStream>
+#include <QThread>
+#include <QThreadPool>
+#include <QVector>
+
+BatchProcessor::BatchProcessor(BatchOptions options) : options(options) {}
+
+/* Outputs of a previous run sit next to their inputs, don't pick them up
+ * again when scanning a directory. Cone maps, packed maps and previews are
+ * only recognised when this run writes them too, their postfixes are too
+ * common in sprite names otherwise. */
+bool BatchProcessor::is_generated_map(QString baseName) {
+  QStringList postfixes = {"_n", "_s", "_o", "_p"};
+  postfixes << requested_maps();
+  foreach (QString postfix, postfixes) {
+    if (baseName.endsWith(postfix))
+      return true;
+  }
+  return false;
+}
+
+static QStringList supported_filters() {
+  QStringList filters;
+  foreach (QByteArray format, QImageReader::supportedImageFormats())
+    filters << "*." + QString(format);
+  filters << "*.tga";
+  return filters;
+}
+
+/* Each pattern is a file, a directory (scanned recursively) or a file name
+ * wildcard such as *.png. The manifest lists one pattern per line. */
+QStringList BatchProcessor::collect_inputs(QStringList patterns,
+                                           QString manifest) {
+  if (!manifest.isEmpty()) {
+    QFile file(manifest);
+    if (file.open(QIODevice::ReadOnly | QIODevice::Text)) {
+      QTextStream in(&file);
+      while (!in.atEnd()) {
+        QString line = in.readLine().trimmed();
+        if (!line.isEmpty() && !line.startsWith('#'))
+          patterns << line;
+      }
+    }
+  }
+
+  QStringList files;
+  QSet<QString> seen;
+  QStringList filters = supported_filters();
+  auto add = [&](QString fileName) {
+    QString path = QFileInfo(fileName).absoluteFilePath();
+    if (!seen.contains(path)) {
+      seen.insert(path);
+      files << path;
+    }
+  };
+
+  foreach (QString pattern, patterns) {
+    QFileInfo info(pattern);
+    if (info.isDir()) {
+      QDirIterator it(pattern, filters, QDir::Files,
+                      QDirIterator::Subdirectories);
+      QStringList found;
+      while (it.hasNext()) {
+        it.next();
+        if (!is_generated_map(it.fileInfo().completeBaseName()))
+          found << it.filePath();
+      }
+      found.sort();
+      foreach (QString f, found)
+        add(f);
+    } else if (pattern.contains('*') || pattern.contains('?') ||
+               pattern.contains('[')) {
+      QDir dir = info.dir();
+      QStringList found = dir.entryList(QStringList() << info.fileName(),
+                                        QDir::Files, QDir::Name);
+      foreach (QString f, found)
+        add(dir.filePath(f));
+    } else {
+      /* Missing files are kept so they show up as failures */
+      add(pattern);
+    }
+  }
+  return files;
+}
+
+bool BatchProcessor::load(QString fileName, ImageProcessor *processor,
+                          QString *error) {
+  bool success;
+  ImageLoader il;
+  QImage image = il.loadImage(fileName, &success);
+  if (!success) {
+    *error = "cannot load image";
+    return false;
+  }
+  return load_image(fileName, image, processor, error);
+}
+
+/* With configure false the processor is expected to carry the settings of
+ * an earlier load already, only the image is replaced. Everything is set up
+ * with updates held, so the maps are calculated once at the end. */
+bool BatchProcessor::load_image(QString name, QImage image,
+                                ImageProcessor *processor, QString *error,
+                                bool configure) {
+  image = image.convertToFormat(QImage::Format_RGBA8888_Premultiplied);
+  processor->hold_updates();
+  processor->loadImage(name, image);
+  bool ok = !configure || apply_options(name, image.size(), processor, error);
+  processor->release_updates();
+  return ok;
+}
+
+/* "{name}" in the map input options stands for the input path without its
+ * extension, so one pattern serves a whole batch. */
+QString BatchProcessor::input_path(QString pattern, QString fileName) {
+  QFileInfo info(fileName);
+  return pattern.replace("{name}",
+                         info.absoluteFilePath().remove("." + info.suffix()));
+}
+
+QStringList BatchProcessor::extra_inputs(QString fileName) {
+  QStringList files;
+  if (!options.heightMap.isEmpty())
+    files << input_path(options.heightMap, fileName);
+  if (!options.specularMap.isEmpty())
+    files << input_path(options.specularMap, fileName);
+  foreach (QString n, options.neighbours)
+    files << input_path(n, fileName);
+  return files;
+}
+
+bool BatchProcessor::apply_options(QString name, QSize size,
+                                   ImageProcessor *processor, QString *error) {
+  ImageLoader il;
+  bool success;
+  if (!options.heightMap.isEmpty()) {
+    QString path = input_path(options.heightMap, name);
+    QImage height = il.loadImage(path, &success);
+    if (!success) {
+      *error = "cannot load heightmap " + path;
+      return false;
+    }
+    processor->loadHeightMap(
+        path, height.convertToFormat(QImage::Format_RGBA8888_Premultiplied));
+  }
+  if (!options.specularMap.isEmpty()) {
+    QString path = input_path(options.specularMap, name);
+    QImage spec = il.loadImage(path, &success);
+    if (!success) {
+      *error = "cannot load specular map " + path;
+      return false;
+    }
+    processor->loadSpecularMap(
+        path, spec.convertToFormat(QImage::Format_RGBA8888_Premultiplied));
+  }
+  foreach (int i, options.neighbours.keys()) {
+    QString path = input_path(options.neighbours[i], name);
+    QImage n = il.loadImage(path, &success);
+    if (!success) {
+      *error = "cannot load neighbour " + path;
+      return false;
+    }
+    processor->set_neighbour_image(
+        path, n.convertToFormat(QImage::Format_RGBA8888), i / 3, i % 3);
+  }
+
+  if (!options.preset.is_empty())
+    options.preset.apply(*processor);
+  if (!options.neighbours.isEmpty())
+    processor->set_tileable(true);
+
+  if (!options.sheetGrid.isEmpty()) {
+    bool ok;
+    QList<QRect> cells = SpriteSheet::grid(size, options.sheetGrid, &ok);
+    if (!ok) {
+      *error = "invalid sprite sheet grid";
+      return false;
+    }
+    processor->set_cells(cells);
+  } else if (!options.sheetRects.isEmpty()) {
+    bool ok;
+    QList<QRect> cells = SpriteSheet::from_json(options.sheetRects, &ok);
+    if (!ok) {
+      *error = "cannot read sprite sheet rects";
+      return false;
+    }
+    processor->set_cells(cells);
+  }
+  return true;
+}
+
+QStringList BatchProcessor::requested_maps() {
+  QStringList maps;
+  if (options.normal)
+    maps << "_n";
+  if (options.specular)
+    maps << "_s";
+  if (options.occlusion)
+    maps << "_o";
+  if (options.parallax)
+    maps << "_p";
+  if (options.cone)
+    maps << "_c";
+  if (!options.packedLayout.isEmpty())
+    maps << "_" + options.packedLayout;
+  if (options.preview)
+    maps << "_v";
+  return maps;
+}
+
+QString BatchProcessor::output_name(QString fileName, QString postfix) {
+  QFileInfo info(fileName);
+  QString suffix = info.suffix();
+  return info.absoluteFilePath().remove("." + suffix) + postfix + "." +
+         (options.dds ? QString("dds") : suffix);
+}
+
+QImage BatchProcessor::map_image(ImageProcessor *processor, QString postfix) {
+  if (postfix == "_n")
+    return *processor->get_normal();
+  if (postfix == "_s")
+    return *processor->get_specular();
+  if (postfix == "_o")
+    return *processor->get_occlusion();
+  if (postfix == "_p")
+    return *processor->get_parallax();
+  if (postfix == "_c")
+    return *processor->get_cone();
+  if (postfix == "_v")
+    return previewRenderer ? previewRenderer->render(processor) : QImage();
+  return processor->get_packed(options.packedLayout);
+}
+
+/* Writes the given maps (postfixes as returned by requested_maps), or all
+ * the requested ones when the list is empty. */
+bool BatchProcessor::export_maps(ImageProcessor *processor, QString *error,
+                                 QStringList maps) {
+  if (maps.isEmpty())
+    maps = requested_maps();
+  if (!options.packedLayout.isEmpty() &&
+      !ImageProcessor::is_valid_pack_layout(options.packedLayout)) {
+    *error = "invalid packed layout " + options.packedLayout;
+    return false;
+  }
+  QStringList failed;
+  foreach (QString postfix, maps) {
+    QImage image = map_image(processor, postfix);
+    QString name = output_name(processor->get_name(), postfix);
+    if (image.isNull()) {
+      failed << QFileInfo(name).fileName();
+      continue;
+    }
+    bool ok = options.dds
+                  ? BlockCompressor::write_dds(name, image, postfix == "_n",
+                                               options.blockQuality)
+                  : ExportQueue::write_image(image, name, options.compression);
+    if (!ok)
+      failed << QFileInfo(name).fileName();
+  }
+  if (!failed.isEmpty()) {
+    *error = "cannot write " + failed.join(", ");
+    return false;
+  }
+  return true;
+}
+
+/* Hash of everything besides the input image that changes the output
+ * pixels. Which maps are requested is left out on purpose, missing maps
+ * are checked on disk. */
+QByteArray BatchProcessor::settings_hash() {
+  QCryptographicHash hash(QCryptographicHash::Sha1);
+  hash.addData(QCoreApplication::applicationVersion().toUtf8());
+  hash.addData(options.preset.data());
+  hash.addData(options.sheetGrid.toUtf8());
+  QFile rects(options.sheetRects);
+  if (rects.open(QIODevice::ReadOnly))
+    hash.addData(&rects);
+  hash.addData(options.heightMap.toUtf8());
+  hash.addData(options.specularMap.toUtf8());
+  foreach (int i, options.neighbours.keys())
+    hash.addData(QByteArray::number(i) + options.neighbours[i].toUtf8());
+  hash.addData(options.packedLayout.toUtf8());
+  hash.addData(QByteArray::number(options.dds));
+  hash.addData(QByteArray::number(static_cast<int>(options.blockQuality)));
+  hash.addData(QByteArray::number(static_cast<int>(options.compression)));
+  /* Previews also depend on how they are lit and rendered */
+  if (options.preview && previewRenderer) {
+    PreviewSettings preview = previewRenderer->get_settings();
+    hash.addData(preview.ambientColor.name(QColor::HexArgb).toUtf8());
+    hash.addData(QByteArray::number(preview.ambientIntensity));
+    hash.addData(QByteArray::number(preview.parallaxHeight));
+    hash.addData(QByteArray::number(preview.parallaxLayers));
+    hash.addData(QByteArray::number(preview.coneStep));
+    hash.addData(QByteArray::number(preview.pixelated));
+    hash.addData(QByteArray::number(previewRenderer->get_cpu()));
+    LightSource light;
+    PreviewRenderer::default_light(&light);
+    hash.addData(
+        PresetSettings::lights_text(QList<LightSource *>() << &light));
+  }
+  return hash.result().toHex();
+}
+
+static QByteArray file_hash(QStringList fileNames) {
+  QCryptographicHash hash(QCryptographicHash::Sha1);
+  foreach (QString fileName, fileNames) {
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly))
+      return QByteArray();
+    hash.addData(&file);
+  }
+  return hash.result().toHex();
+}
+
+/* The cache is a text file with one "path<TAB>input hash<TAB>settings hash"
+ * line per input. */
+bool BatchProcessor::load_cache(QString fileName) {
+  cacheFile = fileName;
+  settingsHash = settings_hash();
+  cache.clear();
+  QFile file(fileName);
+  if (!file.exists())
+    return true;
+  if (!file.open(QIODevice::ReadOnly | QIODevice::Text))
+    return false;
+  while (!file.atEnd()) {
+    QList<QByteArray> aux = file.readLine().trimmed().split('\t');
+    if (aux.count() == 3)
+      cache[QString::fromUtf8(aux[0])] = qMakePair(aux[1], aux[2]);
+  }
+  return true;
+}
+
+bool BatchProcessor::save_cache() {
+  if (cacheFile.isEmpty())
+    return true;
+  QFile file(cacheFile);
+  if (!file.open(QIODevice::WriteOnly | QIODevice::Text))
+    return false;
+  QStringList keys = cache.keys();
+  keys.sort();
+  foreach (QString key, keys) {
+    file.write(key.toUtf8() + '\t' + cache[key].first + '\t' +
+               cache[key].second + '\n');
+  }
+  return true;
+}
+
+void BatchProcessor::set_preview_renderer(PreviewRenderer *renderer) {
+  previewRenderer = renderer;
+  if (!cacheFile.isEmpty())
+    settingsHash = settings_hash();
+}
+
+BatchResult BatchProcessor::process(QString fileName) {
+  BatchResult result;
+  result.fileName = fileName;
+
+  QByteArray inputHash;
+  QStringList maps;
+  if (!cacheFile.isEmpty()) {
+    inputHash =
+        file_hash(QStringList() << fileName << extra_inputs(fileName));
+    cacheMutex.lock();
+    bool upToDate = cache.contains(fileName) &&
+                    cache[fileName].first == inputHash &&
+                    cache[fileName].second == settingsHash;
+    cacheMutex.unlock();
+    if (upToDate) {
+      foreach (QString postfix, requested_maps()) {
+        if (!QFileInfo::exists(output_name(fileName, postfix)))
+          maps << postfix;
+      }
+      if (maps.isEmpty()) {
+        result.ok = result.skipped = true;
+        return result;
+      }
+    }
+  }
+
+  ImageProcessor processor;
+  QElapsedTimer timer;
+  timer.start();
+  bool success;
+  ImageLoader il;
+  QImage image = il.loadImage(fileName, &success);
+  result.stages["decode"] = timer.nsecsElapsed();
+  if (!success) {
+    result.message = "cannot load image";
+    return result;
+  }
+  result.ok = load_image(fileName, image, &processor, &result.message);
+  if (result.ok) {
+    timer.restart();
+    result.ok = export_maps(&processor, &result.message, maps);
+    result.stages["encode"] = timer.nsecsElapsed();
+  }
+  QMap<QString, qint64> stages = processor.get_stage_times();
+  foreach (QString stage, stages.keys())
+    result.stages[stage] = stages[stage];
+  if (result.ok && !inputHash.isEmpty()) {
+    QMutexLocker locker(&cacheMutex);
+    cache[fileName] = qMakePair(inputHash, settingsHash);
+  }
+  return result;
+}
+
+/* Reads one encoded image (or raw RGBA8888 pixels when rawSize is valid)
+ * until the end of in, and writes the requested maps to out, either as a
+ * MapFrame or as raw planes one after the other in requested_maps() order. */
+bool BatchProcessor::process_stream(QIODevice *in, QIODevice *out,
+                                    QSize rawSize, bool rawOutput,
+                                    QString *error) {
+  QByteArray data = in->readAll();
+  QImage image;
+  if (rawSize.isValid()) {
+    int rowBytes = rawSize.width() * 4;
+    if (data.size() < rowBytes * rawSize.height()) {
+      *error = "not enough raw pixels on input";
+      return false;
+    }
+    image = QImage(reinterpret_cast<const uchar *>(data.constData()),
+                   rawSize.width(), rawSize.height(), rowBytes,
+                   QImage::Format_RGBA8888);
+  } else {
+    image = QImage::fromData(data);
+  }
+  if (image.isNull()) {
+    *error = "cannot decode input image";
+    return false;
+  }
+
+  ImageProcessor processor;
+  if (!load_image("stdin", image, &processor, error))
+    return false;
+  data.clear();
+
+  MapFrame frame;
+  foreach (QString postfix, requested_maps()) {
+    QImage map = map_image(&processor, postfix);
+    if (rawOutput) {
+      MapFrame plane;
+      plane.add_image(postfix, map);
+      if (out->write(plane.payload) != plane.payload.size()) {
+        *error = "cannot write output";
+        return false;
+      }
+    } else {
+      frame.add_image(postfix.mid(1), map);
+    }
+  }
+  if (!rawOutput && !frame.write(out)) {
+    *error = "cannot write output";
+    return false;
+  }
+  return true;
+}
+
+class BatchJob : public QRunnable {
+public:
+  BatchJob(BatchProcessor *batch, QString fileName, BatchResult *result)
+      : batch(batch), fileName(fileName), result(result) {}
+
+  void run() override { *result = batch->process(fileName); }
+
+private:
+  BatchProcessor *batch;
+  QString fileName;
+  BatchResult *result;
+};
+
+QList<BatchResult> BatchProcessor::run(QStringList fileNames, int threads) {
+  QVector<BatchResult> results(fileNames.count());
+  QThreadPool pool;
+  pool.setMaxThreadCount(threads > 0 ? threads : QThread::idealThreadCount());
+  for (int i = 0; i < fileNames.count(); i++)
+    pool.start(new BatchJob(this, fileNames[i], &results[i]));
+  /* Previews are rendered in this thread, keep serving them while waiting */
+  if (previewRenderer &&
+      previewRenderer->thread() == QThread::currentThread()) {
+    while (!pool.waitForDone(10))
+      QCoreApplication::processEvents();
+  } else {
+    pool.waitForDone();
+  }
+  return results.toList();
+}
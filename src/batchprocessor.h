@@ -0,0 +1,107 @@
+/*
+ * Laigter: an automatic map generator for lighting effects.
+ * Copyright (C) 2019  Pablo Ivan Fonovich
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ * Contact: azagaya.games@gmail.com
+ */
+
+#ifndef BATCHPROCESSOR_H
+#define BATCHPROCESSOR_H
+
+#include <QByteArray>
+#include <QHash>
+#include <QIODevice>
+#include <QList>
+#include <QMap>
+#include <QMutex>
+#include <QPair>
+#include <QSize>
+#include <QString>
+#include <QStringList>
+
+#include "src/blockcompressor.h"
+#include "src/imageprocessor.h"
+#include "src/pngwriter.h"
+#include "src/presetsettings.h"
+#include "src/previewrenderer.h"
+
+struct BatchOptions {
+  PresetSettings preset;
+  QString sheetGrid;
+  QString sheetRects;
+  QString heightMap;
+  QString specularMap;
+  QMap<int, QString> neighbours; // row * 3 + column in the 3x3 tile grid
+  bool normal = false;
+  bool specular = false;
+  bool occlusion = false;
+  bool parallax = false;
+  bool cone = false;
+  QString packedLayout;
+  bool preview = false;
+  bool dds = false;
+  BlockQuality blockQuality = BlockQuality::Fast;
+  PngCompression compression = PngCompression::Default;
+};
+
+struct BatchResult {
+  QString fileName;
+  bool ok = false;
+  bool skipped = false;
+  QString message;
+  QMap<QString, qint64> stages; // nanoseconds per stage
+};
+
+/* Runs the command line pipeline (load, preset, sprite sheet, export) over
+ * many inputs in one process. With a cache file loaded, inputs whose hash
+ * and settings match the last run only get their missing maps written. */
+class BatchProcessor {
+public:
+  explicit BatchProcessor(BatchOptions options);
+
+  QStringList collect_inputs(QStringList patterns, QString manifest);
+  bool load(QString fileName, ImageProcessor *processor, QString *error);
+  bool load_image(QString name, QImage image, ImageProcessor *processor,
+                  QString *error, bool configure = true);
+  QImage map_image(ImageProcessor *processor, QString postfix);
+  bool export_maps(ImageProcessor *processor, QString *error,
+                   QStringList maps = QStringList());
+  QStringList requested_maps();
+  QString output_name(QString fileName, QString postfix);
+  bool load_cache(QString fileName);
+  bool save_cache();
+  BatchResult process(QString fileName);
+  void set_preview_renderer(PreviewRenderer *renderer);
+  bool process_stream(QIODevice *in, QIODevice *out, QSize rawSize,
+                      bool rawOutput, QString *error);
+  QList<BatchResult> run(QStringList fileNames, int threads);
+
+private:
+  bool is_generated_map(QString baseName);
+  static QString input_path(QString pattern, QString fileName);
+  QStringList extra_inputs(QString fileName);
+  bool apply_options(QString name, QSize size, ImageProcessor *processor,
+                     QString *error);
+  QByteArray settings_hash();
+
+  BatchOptions options;
+  PreviewRenderer *previewRenderer = nullptr;
+  QString cacheFile;
+  QByteArray settingsHash;
+  QHash<QString, QPair<QByteArray, QByteArray>> cache;
+  QMutex cacheMutex;
+};
+
+#endif // BATCHPROCESSOR_H
@@ -0,0 +1,434 @@
+/*
+ * Laigter: an automatic map generator for lighting effects.
+ * Copyright (C) 2019  Pablo Ivan Fonovich
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ * Contact: azagaya.games@gmail.com
+ */
+
+#include "blockcompressor.h"
+#include <QFile>
+#include <QtConcurrent/QtConcurrent>
+#include <QtEndian>
+#include <climits>
+#include <cstring>
+
+static void fetch_block(const Mat &src, int bx, int by, int channel,
+                        uchar out[16]) {
+  int cn = src.channels();
+  for (int y = 0; y < 4; y++) {
+    const uchar *row = src.ptr<uchar>(qMin(by * 4 + y, src.rows - 1));
+    for (int x = 0; x < 4; x++) {
+      out[y * 4 + x] = row[qMin(bx * 4 + x, src.cols - 1) * cn + channel];
+    }
+  }
+}
+
+static void put_indices(uchar *out, const int idx[16], int bits, int count) {
+  quint64 packed = 0;
+  for (int i = 0; i < 16; i++)
+    packed |= static_cast<quint64>(idx[i]) << (bits * i);
+  for (int i = 0; i < count; i++)
+    out[i] = static_cast<uchar>(packed >> (8 * i));
+}
+
+/* BC4 */
+
+static void bc4_palette(int a0, int a1, int p[8]) {
+  p[0] = a0;
+  p[1] = a1;
+  if (a0 > a1) {
+    for (int i = 2; i < 8; i++)
+      p[i] = ((8 - i) * a0 + (i - 1) * a1) / 7;
+  } else {
+    for (int i = 2; i < 6; i++)
+      p[i] = ((6 - i) * a0 + (i - 1) * a1) / 5;
+    p[6] = 0;
+    p[7] = 255;
+  }
+}
+
+static int bc4_fit(const uchar v[16], int a0, int a1, int idx[16]) {
+  int p[8];
+  bc4_palette(a0, a1, p);
+  int error = 0;
+  for (int i = 0; i < 16; i++) {
+    int best = 0, bestError = INT_MAX;
+    for (int j = 0; j < 8; j++) {
+      int e = (v[i] - p[j]) * (v[i] - p[j]);
+      if (e < bestError) {
+        bestError = e;
+        best = j;
+      }
+    }
+    idx[i] = best;
+    error += bestError;
+  }
+  return error;
+}
+
+static void bc4_block(const uchar v[16], BlockQuality quality, uchar *out) {
+  int lo = 255, hi = 0;
+  for (int i = 0; i < 16; i++) {
+    lo = qMin(lo, static_cast<int>(v[i]));
+    hi = qMax(hi, static_cast<int>(v[i]));
+  }
+  int idx[16];
+  int a0 = hi, a1 = lo;
+
+  if (quality == BlockQuality::Fast) {
+    /* Range fit: every index is computed arithmetically, no palette search. */
+    static const int remap[8] = {1, 7, 6, 5, 4, 3, 2, 0};
+    int range = hi - lo;
+    for (int i = 0; i < 16; i++) {
+      int t = range ? ((v[i] - lo) * 14 + range) / (2 * range) : 7;
+      idx[i] = remap[t];
+    }
+  } else {
+    int bestError = INT_MAX;
+    int candidate[16];
+    for (int d0 = 0; d0 < 4; d0++) {
+      for (int d1 = 0; d1 < 4; d1++) {
+        int c0 = hi - d0, c1 = lo + d1;
+        if (c0 <= c1)
+          continue;
+        int e = bc4_fit(v, c0, c1, candidate);
+        if (e < bestError) {
+          bestError = e;
+          a0 = c0;
+          a1 = c1;
+          memcpy(idx, candidate, sizeof(idx));
+        }
+      }
+    }
+    /* Six value mode keeps exact 0 and 255, which the eight value mode
+     * cannot represent together with a narrow range. */
+    int innerLo = 255, innerHi = 0;
+    for (int i = 0; i < 16; i++) {
+      if (v[i] != 0 && v[i] != 255) {
+        innerLo = qMin(innerLo, static_cast<int>(v[i]));
+        innerHi = qMax(innerHi, static_cast<int>(v[i]));
+      }
+    }
+    if (innerLo > innerHi)
+      innerLo = innerHi = lo;
+    int e = bc4_fit(v, innerLo, innerHi, candidate);
+    if (e < bestError || bestError == INT_MAX) {
+      a0 = innerLo;
+      a1 = innerHi;
+      memcpy(idx, candidate, sizeof(idx));
+    }
+  }
+  out[0] = static_cast<uchar>(a0);
+  out[1] = static_cast<uchar>(a1);
+  put_indices(out + 2, idx, 3, 6);
+}
+
+/* BC1 */
+
+static int to565(const float c[3]) {
+  int r = qBound(0, qRound(c[0] * 31 / 255.0f), 31);
+  int g = qBound(0, qRound(c[1] * 63 / 255.0f), 63);
+  int b = qBound(0, qRound(c[2] * 31 / 255.0f), 31);
+  return (r << 11) | (g << 5) | b;
+}
+
+static void from565(int c, int out[3]) {
+  int r = (c >> 11) & 31, g = (c >> 5) & 63, b = c & 31;
+  out[0] = (r << 3) | (r >> 2);
+  out[1] = (g << 2) | (g >> 4);
+  out[2] = (b << 3) | (b >> 2);
+}
+
+static int bc1_fit(const uchar rgb[16][3], int c0, int c1, int idx[16]) {
+  int p[4][3];
+  from565(c0, p[0]);
+  from565(c1, p[1]);
+  for (int k = 0; k < 3; k++) {
+    p[2][k] = (2 * p[0][k] + p[1][k]) / 3;
+    p[3][k] = (p[0][k] + 2 * p[1][k]) / 3;
+  }
+  int error = 0;
+  for (int i = 0; i < 16; i++) {
+    int best = 0, bestError = INT_MAX;
+    for (int j = 0; j < 4; j++) {
+      int e = 0;
+      for (int k = 0; k < 3; k++)
+        e += (rgb[i][k] - p[j][k]) * (rgb[i][k] - p[j][k]);
+      if (e < bestError) {
+        bestError = e;
+        best = j;
+      }
+    }
+    idx[i] = best;
+    error += bestError;
+  }
+  return error;
+}
+
+/* Least squares endpoints for a fixed index assignment. */
+static bool bc1_refit(const uchar rgb[16][3], const int idx[16], float e0[3],
+                      float e1[3]) {
+  static const float w0[4] = {1, 0, 2 / 3.0f, 1 / 3.0f};
+  float aa = 0, ab = 0, bb = 0, ax[3] = {0, 0, 0}, bx[3] = {0, 0, 0};
+  for (int i = 0; i < 16; i++) {
+    float a = w0[idx[i]], b = 1 - a;
+    aa += a * a;
+    ab += a * b;
+    bb += b * b;
+    for (int k = 0; k < 3; k++) {
+      ax[k] += a * rgb[i][k];
+      bx[k] += b * rgb[i][k];
+    }
+  }
+  float det = aa * bb - ab * ab;
+  if (qAbs(det) < 1e-6f)
+    return false;
+  for (int k = 0; k < 3; k++) {
+    e0[k] = (ax[k] * bb - bx[k] * ab) / det;
+    e1[k] = (bx[k] * aa - ax[k] * ab) / det;
+  }
+  return true;
+}
+
+static void bc1_block(const uchar rgb[16][3], BlockQuality quality,
+                      uchar *out) {
+  float e0[3], e1[3];
+  if (quality == BlockQuality::Fast) {
+    /* Inset bounding box */
+    for (int k = 0; k < 3; k++) {
+      int lo = 255, hi = 0;
+      for (int i = 0; i < 16; i++) {
+        lo = qMin(lo, static_cast<int>(rgb[i][k]));
+        hi = qMax(hi, static_cast<int>(rgb[i][k]));
+      }
+      float inset = (hi - lo) / 16.0f;
+      e0[k] = hi - inset;
+      e1[k] = lo + inset;
+    }
+  } else {
+    /* Principal axis of the block colors */
+    float mean[3] = {0, 0, 0};
+    for (int i = 0; i < 16; i++)
+      for (int k = 0; k < 3; k++)
+        mean[k] += rgb[i][k] / 16.0f;
+    float cov[6] = {0, 0, 0, 0, 0, 0};
+    for (int i = 0; i < 16; i++) {
+      float d[3] = {rgb[i][0] - mean[0], rgb[i][1] - mean[1],
+                    rgb[i][2] - mean[2]};
+      cov[0] += d[0] * d[0];
+      cov[1] += d[0] * d[1];
+      cov[2] += d[0] * d[2];
+      cov[3] += d[1] * d[1];
+      cov[4] += d[1] * d[2];
+      cov[5] += d[2] * d[2];
+    }
+    float axis[3] = {1, 1, 1};
+    for (int it = 0; it < 8; it++) {
+      float n[3] = {cov[0] * axis[0] + cov[1] * axis[1] + cov[2] * axis[2],
+                    cov[1] * axis[0] + cov[3] * axis[1] + cov[4] * axis[2],
+                    cov[2] * axis[0] + cov[4] * axis[1] + cov[5] * axis[2]};
+      float len = qMax(qMax(qAbs(n[0]), qAbs(n[1])), qAbs(n[2]));
+      if (len < 1e-6f)
+        break;
+      for (int k = 0; k < 3; k++)
+        axis[k] = n[k] / len;
+    }
+    float tmin = 1e9f, tmax = -1e9f;
+    float len2 = axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2];
+    for (int i = 0; i < 16; i++) {
+      float t = ((rgb[i][0] - mean[0]) * axis[0] +
+                 (rgb[i][1] - mean[1]) * axis[1] +
+                 (rgb[i][2] - mean[2]) * axis[2]) /
+                len2;
+      tmin = qMin(tmin, t);
+      tmax = qMax(tmax, t);
+    }
+    for (int k = 0; k < 3; k++) {
+      e0[k] = mean[k] + axis[k] * tmax;
+      e1[k] = mean[k] + axis[k] * tmin;
+    }
+  }
+
+  int c0 = to565(e0), c1 = to565(e1);
+  int idx[16];
+  int error = bc1_fit(rgb, c0, c1, idx);
+  if (quality == BlockQuality::Quality) {
+    float r0[3], r1[3];
+    int candidate[16];
+    if (bc1_refit(rgb, idx, r0, r1)) {
+      int n0 = to565(r0), n1 = to565(r1);
+      if (bc1_fit(rgb, n0, n1, candidate) < error) {
+        c0 = n0;
+        c1 = n1;
+        memcpy(idx, candidate, sizeof(idx));
+      }
+    }
+  }
+
+  /* Four color mode needs c0 > c1 */
+  if (c0 < c1) {
+    static const int swapped[4] = {1, 0, 3, 2};
+    qSwap(c0, c1);
+    for (int i = 0; i < 16; i++)
+      idx[i] = swapped[idx[i]];
+  } else if (c0 == c1) {
+    for (int i = 0; i < 16; i++)
+      idx[i] = 0;
+  }
+  out[0] = static_cast<uchar>(c0);
+  out[1] = static_cast<uchar>(c0 >> 8);
+  out[2] = static_cast<uchar>(c1);
+  out[3] = static_cast<uchar>(c1 >> 8);
+  put_indices(out + 4, idx, 2, 4);
+}
+
+static void fetch_rgb(const Mat &src, int bx, int by, uchar rgb[16][3]) {
+  uchar c[16];
+  for (int k = 0; k < 3; k++) {
+    fetch_block(src, bx, by, qMin(k, src.channels() - 1), c);
+    for (int i = 0; i < 16; i++)
+      rgb[i][k] = c[i];
+  }
+}
+
+QByteArray BlockCompressor::compress(Mat src, BlockFormat format,
+                                     BlockQuality quality) {
+  if (src.empty() || src.depth() != CV_8U)
+    return QByteArray();
+  int blockSize =
+      (format == BlockFormat::BC1 || format == BlockFormat::BC4) ? 8 : 16;
+  int blocksX = (src.cols + 3) / 4, blocksY = (src.rows + 3) / 4;
+  QByteArray data(blocksX * blocksY * blockSize, 0);
+  uchar *base = reinterpret_cast<uchar *>(data.data());
+
+  QList<int> rows;
+  for (int by = 0; by < blocksY; by++)
+    rows.append(by);
+  QtConcurrent::blockingMap(rows, [&](int &by) {
+    uchar v[16];
+    uchar rgb[16][3];
+    for (int bx = 0; bx < blocksX; bx++) {
+      uchar *out = base + (by * blocksX + bx) * blockSize;
+      switch (format) {
+      case BlockFormat::BC1:
+        fetch_rgb(src, bx, by, rgb);
+        bc1_block(rgb, quality, out);
+        break;
+      case BlockFormat::BC3:
+        fetch_block(src, bx, by, qMin(3, src.channels() - 1), v);
+        if (src.channels() < 4)
+          memset(v, 255, sizeof(v));
+        bc4_block(v, quality, out);
+        fetch_rgb(src, bx, by, rgb);
+        bc1_block(rgb, quality, out + 8);
+        break;
+      case BlockFormat::BC4:
+        fetch_block(src, bx, by, 0, v);
+        bc4_block(v, quality, out);
+        break;
+      case BlockFormat::BC5:
+        fetch_block(src, bx, by, 0, v);
+        bc4_block(v, quality, out);
+        fetch_block(src, bx, by, qMin(1, src.channels() - 1), v);
+        bc4_block(v, quality, out + 8);
+        break;
+      }
+    }
+  });
+  return data;
+}
+
+static void put_u32(QByteArray &header, int offset, quint32 value) {
+  qToLittleEndian(value, reinterpret_cast<uchar *>(header.data()) + offset);
+}
+
+bool BlockCompressor::write_dds(QString fileName, Mat src, BlockFormat format,
+                                BlockQuality quality) {
+  QByteArray data = compress(src, format, quality);
+  if (data.isEmpty())
+    return false;
+
+  const char *fourCC = "DXT1";
+  switch (format) {
+  case BlockFormat::BC1:
+    fourCC = "DXT1";
+    break;
+  case BlockFormat::BC3:
+    fourCC = "DXT5";
+    break;
+  case BlockFormat::BC4:
+    fourCC = "ATI1";
+    break;
+  case BlockFormat::BC5:
+    fourCC = "ATI2";
+    break;
+  }
+
+  QByteArray header(128, 0);
+  memcpy(header.data(), "DDS ", 4);
+  put_u32(header, 4, 124);
+  /* caps | height | width | pixelformat | linearsize */
+  put_u32(header, 8, 0x1 | 0x2 | 0x4 | 0x1000 | 0x80000);
+  put_u32(header, 12, static_cast<quint32>(src.rows));
+  put_u32(header, 16, static_cast<quint32>(src.cols));
+  put_u32(header, 20, static_cast<quint32>(data.size()));
+  put_u32(header, 76, 32);
+  put_u32(header, 80, 0x4);
+  memcpy(header.data() + 84, fourCC, 4);
+  put_u32(header, 108, 0x1000);
+
+  QFile file(fileName);
+  if (!file.open(QIODevice::WriteOnly))
+    return false;
+  return file.write(header) == header.size() && file.write(data) == data.size();
+}
+
+bool BlockCompressor::write_dds(QString fileName, const QImage &image,
+                                bool isNormal, BlockQuality quality) {
+  QImage img = image;
+  int type;
+  switch (img.format()) {
+  case QImage::Format_Grayscale8:
+    type = CV_8UC1;
+    break;
+  case QImage::Format_RGB888:
+    type = CV_8UC3;
+    break;
+  case QImage::Format_RGBA8888:
+  case QImage::Format_RGBA8888_Premultiplied:
+    type = CV_8UC4;
+    break;
+  default:
+    img = image.convertToFormat(QImage::Format_RGBA8888);
+    type = CV_8UC4;
+  }
+  /* Header only, the encoder reads the QImage buffer in place */
+  Mat m(img.height(), img.width(), type, const_cast<uchar *>(img.constBits()),
+        static_cast<size_t>(img.bytesPerLine()));
+  return write_dds(fileName, m, format_for(m, isNormal), quality);
+}
+
+BlockFormat BlockCompressor::format_for(Mat src, bool isNormal) {
+  if (isNormal)
+    return BlockFormat::BC5;
+  switch (src.channels()) {
+  case 1:
+    return BlockFormat::BC4;
+  case 3:
+    return BlockFormat::BC1;
+  default:
+    return BlockFormat::BC3;
+  }
+}
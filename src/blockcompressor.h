@@ -0,0 +1,47 @@
+/*
+ * Laigter: an automatic map generator for lighting effects.
+ * Copyright (C) 2019  Pablo Ivan Fonovich
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ * Contact: azagaya.games@gmail.com
+ */
+
+#ifndef BLOCKCOMPRESSOR_H
+#define BLOCKCOMPRESSOR_H
+
+#include <QByteArray>
+#include <QImage>
+#include <QString>
+#include <opencv2/opencv.hpp>
+
+using namespace cv;
+
+enum class BlockFormat { BC1, BC3, BC4, BC5 };
+
+enum class BlockQuality { Fast, Quality };
+
+/* CPU block compression of the generated maps into DDS files.
+ * BC1 and BC3 take RGB / RGBA images, BC4 takes one channel and BC5 takes the
+ * first two channels (the normal map X and Y). */
+class BlockCompressor {
+public:
+  static QByteArray compress(Mat src, BlockFormat format, BlockQuality quality);
+  static bool write_dds(QString fileName, Mat src, BlockFormat format,
+                        BlockQuality quality);
+  static bool write_dds(QString fileName, const QImage &image, bool isNormal,
+                        BlockQuality quality);
+  static BlockFormat format_for(Mat src, bool isNormal);
+};
+
+#endif // BLOCKCOMPRESSOR_H
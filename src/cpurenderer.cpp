@@ -0,0 +1,271 @@
+/*
+ * Laigter: an automatic map generator for lighting effects.
+ * Copyright (C) 2019  Pablo Ivan Fonovich
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ * Contact: azagaya.games@gmail.com
+ */
+
+#include "cpurenderer.h"
+#include <QVector>
+#include <QtConcurrent/QtConcurrent>
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+struct Vec3 {
+  float x, y, z;
+};
+
+inline Vec3 operator+(Vec3 a, Vec3 b) {
+  return {a.x + b.x, a.y + b.y, a.z + b.z};
+}
+inline Vec3 operator-(Vec3 a, Vec3 b) {
+  return {a.x - b.x, a.y - b.y, a.z - b.z};
+}
+inline Vec3 operator*(Vec3 a, float s) { return {a.x * s, a.y * s, a.z * s}; }
+inline Vec3 operator*(Vec3 a, Vec3 b) {
+  return {a.x * b.x, a.y * b.y, a.z * b.z};
+}
+inline float dot(Vec3 a, Vec3 b) { return a.x * b.x + a.y * b.y + a.z * b.z; }
+inline Vec3 normalize(Vec3 a) {
+  float l = std::sqrt(dot(a, a));
+  return l > 0 ? a * (1.0f / l) : a;
+}
+
+struct Vec4 {
+  float r, g, b, a;
+};
+
+/* RGBA8888 copy of a map, sampled like a GL_LINEAR (or GL_NEAREST) texture
+ * with a transparent border */
+class Sampler {
+public:
+  Sampler(const QImage &image, bool nearest)
+      : image(image.convertToFormat(QImage::Format_RGBA8888)),
+        w(image.width()), h(image.height()), nearest(nearest) {}
+
+  Vec4 texel(int x, int y) const {
+    if (x < 0 || y < 0 || x >= w || y >= h)
+      return {0, 0, 0, 0};
+    const uchar *p = image.constScanLine(y) + x * 4;
+    return {p[0] / 255.0f, p[1] / 255.0f, p[2] / 255.0f, p[3] / 255.0f};
+  }
+
+  Vec4 sample(float u, float v) const {
+    if (nearest)
+      return texel(static_cast<int>(std::floor(u * w)),
+                   static_cast<int>(std::floor(v * h)));
+    float x = u * w - 0.5f, y = v * h - 0.5f;
+    int x0 = static_cast<int>(std::floor(x));
+    int y0 = static_cast<int>(std::floor(y));
+    float fx = x - x0, fy = y - y0;
+    Vec4 a = texel(x0, y0), b = texel(x0 + 1, y0);
+    Vec4 c = texel(x0, y0 + 1), d = texel(x0 + 1, y0 + 1);
+    auto mix = [](Vec4 p, Vec4 q, float t) {
+      return Vec4{p.r + (q.r - p.r) * t, p.g + (q.g - p.g) * t,
+                  p.b + (q.b - p.b) * t, p.a + (q.a - p.a) * t};
+    };
+    return mix(mix(a, b, fx), mix(c, d, fx), fy);
+  }
+
+private:
+  QImage image;
+  int w, h;
+  bool nearest;
+};
+
+struct Light {
+  Vec3 position, color, specColor;
+  float diffIntensity, specIntensity, specScatter, radius;
+};
+
+inline Vec3 color_vec(QColor c) {
+  return {static_cast<float>(c.redF()), static_cast<float>(c.greenF()),
+          static_cast<float>(c.blueF())};
+}
+
+inline float clamp01(float v) { return v < 0 ? 0 : (v > 1 ? 1 : v); }
+
+/* Attenuation() from the fragment shader, the image being the whole view */
+inline float attenuation(const Light &l, Vec3 fragPos, int w, int h) {
+  if (l.radius <= 0)
+    return 1;
+  float dx = (l.position.x - fragPos.x) * w * 0.5f / l.radius;
+  float dy = (l.position.y - fragPos.y) * h * 0.5f / l.radius;
+  float f = clamp01(1 - dx * dx - dy * dy);
+  return f * f;
+}
+
+/* ParallaxMapping() from the fragment shader */
+void parallax_mapping(const Sampler &parallaxMap, float heightScale,
+                      int layers, float &u, float &v, Vec3 viewDir) {
+  const float maxLayers = layers;
+  const float minLayers = std::max(maxLayers * 0.25f, 1.0f);
+  float numLayers =
+      maxLayers + (minLayers - maxLayers) * std::fabs(viewDir.z);
+  float layerDepth = 1.0f / numLayers;
+  float dx = viewDir.x * heightScale / numLayers;
+  float dy = viewDir.y * heightScale / numLayers;
+
+  float cu = u, cv = v, currentLayerDepth = 0.0f;
+  float currentDepth = parallaxMap.sample(cu, cv).r;
+  for (int i = 0; i < 256 && currentLayerDepth < currentDepth; i++) {
+    cv += dy;
+    cu -= dx;
+    currentDepth = parallaxMap.sample(cu, cv).r;
+    currentLayerDepth += layerDepth;
+  }
+
+  float pu = cu + dx, pv = cv - dy;
+  float prevLayerDepth = currentLayerDepth - layerDepth;
+  float prevDepth = parallaxMap.sample(pu, pv).r;
+  for (int i = 0; i < 5; i++) {
+    float mu = (pu + cu) / 2, mv = (pv + cv) / 2;
+    float midLayerDepth = (prevLayerDepth + currentLayerDepth) / 2;
+    float midDepth = parallaxMap.sample(mu, mv).r;
+    if (midLayerDepth < midDepth) {
+      pu = mu;
+      pv = mv;
+      prevLayerDepth = midLayerDepth;
+      prevDepth = midDepth;
+    } else {
+      cu = mu;
+      cv = mv;
+      currentLayerDepth = midLayerDepth;
+      currentDepth = midDepth;
+    }
+  }
+
+  float afterDepth = currentDepth - currentLayerDepth;
+  float beforeDepth = prevDepth - prevLayerDepth;
+  float weight = afterDepth / (afterDepth - beforeDepth);
+  u = pu * weight + cu * (1.0f - weight);
+  v = pv * weight + cv * (1.0f - weight);
+}
+
+/* ConeStepMapping() from the fragment shader */
+void cone_step_mapping(const Sampler &parallaxMap, const Sampler &coneMap,
+                       float heightScale, float &u, float &v, Vec3 viewDir) {
+  float du = -viewDir.x * heightScale, dv = viewDir.y * heightScale;
+  float rayRatio = std::sqrt(du * du + dv * dv);
+  float depth = 0.0f;
+  for (int i = 0; i < 16; i++) {
+    float cone = coneMap.sample(u, v).r;
+    cone *= cone;
+    float height = std::max(parallaxMap.sample(u, v).r - depth, 0.0f);
+    float step = cone * height / std::max(rayRatio + cone, 1e-6f);
+    u += du * step;
+    v += dv * step;
+    depth += step;
+  }
+}
+
+} // namespace
+
+QImage CpuRenderer::render(ImageProcessor *processor,
+                           QList<LightSource *> lights,
+                           PreviewSettings settings) {
+  const Sampler tex(*processor->get_texture(), settings.pixelated);
+  const Sampler normalMap(*processor->get_normal(), settings.pixelated);
+  const Sampler parallaxMap(*processor->get_parallax(), settings.pixelated);
+  const Sampler specularMap(*processor->get_specular(), settings.pixelated);
+  const Sampler occlusionMap(*processor->get_occlusion(), settings.pixelated);
+  const Sampler coneMap(*processor->get_cone(), settings.pixelated);
+  const int w = processor->get_texture()->width();
+  const int h = processor->get_texture()->height();
+  const bool parallax = processor->get_is_parallax();
+
+  QVector<Light> lightData;
+  foreach (LightSource *l, lights) {
+    QVector3D p = l->get_light_position();
+    lightData.append({{p.x(), p.y(), p.z()},
+                      color_vec(l->get_diffuse_color()),
+                      color_vec(l->get_specular_color()),
+                      l->get_diffuse_intensity(),
+                      l->get_specular_intesity(),
+                      l->get_specular_scatter(),
+                      l->get_radius()});
+  }
+  const Vec3 ambient =
+      color_vec(settings.ambientColor) * settings.ambientIntensity;
+  const Vec3 viewPos = {0, 0, 1};
+
+  QImage result(w, h, QImage::Format_RGBA8888_Premultiplied);
+  uchar *bits = result.bits();
+  const int stride = result.bytesPerLine();
+  QVector<int> rows(h);
+  for (int y = 0; y < h; y++)
+    rows[y] = y;
+
+  QtConcurrent::blockingMap(rows, [&](int &y) {
+    uchar *out = bits + y * stride;
+    for (int x = 0; x < w; x++, out += 4) {
+      /* Fragment centre; the top row of the image is the top of the quad */
+      float u = (x + 0.5f) / w, v = (y + 0.5f) / h;
+      Vec3 fragPos = {u * 2 - 1, 1 - v * 2, 0};
+      Vec3 viewDir = normalize(viewPos - fragPos);
+
+      if (settings.pixelated) {
+        u = (std::floor(u * w) + 0.5f / w) / w;
+        v = (std::floor(v * h) + 0.5f / h) / h;
+      }
+      if (parallax) {
+        if (settings.coneStep)
+          cone_step_mapping(parallaxMap, coneMap, settings.parallaxHeight, u,
+                            v, viewDir);
+        else
+          parallax_mapping(parallaxMap, settings.parallaxHeight,
+                           settings.parallaxLayers, u, v, viewDir);
+        if (u > 1 || v > 1 || u < 0 || v < 0) {
+          out[0] = out[1] = out[2] = out[3] = 0;
+          continue;
+        }
+      }
+
+      Vec4 n = normalMap.sample(u, v);
+      Vec3 normal = normalize({n.r * 2 - 1, n.g * 2 - 1, n.b * 2 - 1});
+      Vec4 s = specularMap.sample(u, v);
+      Vec3 specMap = {s.r, s.g, s.b};
+      Vec4 t = tex.sample(u, v);
+      float occlusion = occlusionMap.sample(u, v).r;
+
+      Vec3 lit = {0, 0, 0};
+      float litAlpha = 0;
+      foreach (const Light &l, lightData) {
+        Vec3 lightDir = normalize(l.position - Vec3{fragPos.x, fragPos.y, 0});
+        Vec3 reflectDir = normal * (2 * dot(normal, lightDir)) - lightDir;
+        float spec = std::pow(std::max(dot(viewDir, reflectDir), 0.0f),
+                              l.specScatter);
+        Vec3 specular = l.specColor * specMap * (l.specIntensity * spec);
+        float diff = std::max(dot(normal, lightDir), 0.0f);
+        float fade = attenuation(l, fragPos, w, h);
+        lit = lit + (l.color * (diff * l.diffIntensity) + specular) * fade;
+        litAlpha += 2;
+      }
+      lit = lit + ambient * occlusion;
+      litAlpha += settings.ambientIntensity * occlusion;
+
+      /* Clamped to the framebuffer range, then blended with SRC_ALPHA,
+       * ONE_MINUS_SRC_ALPHA over transparent black */
+      float a = clamp01(t.a * litAlpha);
+      out[0] = static_cast<uchar>(clamp01(t.r * lit.x) * a * 255 + 0.5f);
+      out[1] = static_cast<uchar>(clamp01(t.g * lit.y) * a * 255 + 0.5f);
+      out[2] = static_cast<uchar>(clamp01(t.b * lit.z) * a * 255 + 0.5f);
+      out[3] = static_cast<uchar>(a * a * 255 + 0.5f);
+    }
+  });
+  return result;
+}
@@ -0,0 +1,42 @@
+/*
+ * Laigter: an automatic map generator for lighting effects.
+ * Copyright (C) 2019  Pablo Ivan Fonovich
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ * Contact: azagaya.games@gmail.com
+ */
+
+#ifndef CPURENDERER_H
+#define CPURENDERER_H
+
+#include <QImage>
+#include <QList>
+
+#include "src/imageprocessor.h"
+#include "src/lightsource.h"
+#include "src/previewrenderer.h"
+
+/* CPU port of shaders/fshader.glsl for the lit preview: diffuse and Phong
+ * specular per light faded out by its radius, ambient times occlusion,
+ * pixelated sampling and parallax occlusion or cone step mapping. Texture
+ * fetches are bilinear with a transparent border, and the result is
+ * blended over transparent black like the framebuffer in PreviewRenderer,
+ * so both give the same image. Rows are shaded in parallel. */
+class CpuRenderer {
+public:
+  static QImage render(ImageProcessor *processor, QList<LightSource *> lights,
+                       PreviewSettings settings);
+};
+
+#endif // CPURENDERER_H
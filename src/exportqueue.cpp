@@ -0,0 +1,147 @@
+/*
+ * Laigter: an automatic map generator for lighting effects.
+ * Copyright (C) 2019  Pablo Ivan Fonovich
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ * Contact: azagaya.games@gmail.com
+ */
+
+#include "exportqueue.h"
+#include <QDir>
+#include <QFileInfo>
+#include <QImageWriter>
+#include <QRunnable>
+
+class ExportJob : public QRunnable {
+public:
+  ExportJob(ExportQueue *queue, QImage image, QString fileName,
+            PngCompression compression, BlockQuality blockQuality,
+            bool isNormal)
+      : queue(queue), image(image), fileName(fileName),
+        compression(compression), blockQuality(blockQuality),
+        isNormal(isNormal) {}
+
+  void run() override {
+    bool ok;
+    if (QFileInfo(fileName).suffix().toLower() == "dds")
+      ok = BlockCompressor::write_dds(fileName, image, isNormal, blockQuality);
+    else
+      ok = ExportQueue::write_image(image, fileName, compression);
+    QMetaObject::invokeMethod(queue, "job_done", Qt::QueuedConnection,
+                              Q_ARG(QString, fileName), Q_ARG(bool, ok));
+  }
+
+private:
+  ExportQueue *queue;
+  QImage image;
+  QString fileName;
+  PngCompression compression;
+  BlockQuality blockQuality;
+  bool isNormal;
+};
+
+ExportQueue::ExportQueue(QObject *parent) : QObject(parent) {
+  compression = PngCompression::Default;
+  blockQuality = BlockQuality::Fast;
+  streamThreshold = 4096 * 4096;
+  total = done = written = 0;
+  streamPool.setMaxThreadCount(1);
+}
+
+ExportQueue::~ExportQueue() { wait_for_done(); }
+
+bool ExportQueue::write_image(const QImage &image, QString fileName,
+                              PngCompression compression) {
+  QString suffix = QFileInfo(fileName).suffix().toLower();
+  if (suffix == "png")
+    return PngWriter::write(fileName, image, compression);
+  QImageWriter writer(fileName);
+  return writer.write(image);
+}
+
+void ExportQueue::enqueue(QImage image, QString fileName, bool isNormal,
+                          ImageProcessor *owner) {
+  total++;
+  QString suffix = QFileInfo(fileName).suffix().toLower();
+  bool streamable = suffix == "png" || suffix == "dds";
+  if (owner && streamable &&
+      static_cast<qint64>(image.width()) * image.height() > streamThreshold) {
+    /* Too big to duplicate: encode from the processor buffer, which stays
+     * valid as long as the processor holds its updates. A single thread
+     * keeps one such map in flight at a time. */
+    owner->hold_updates();
+    heldOwners.insert(fileName, owner);
+    streamPool.start(new ExportJob(this, image, fileName, compression,
+                                   blockQuality, isNormal));
+  } else {
+    /* Maps wrap processor owned buffers, so take our own copy before leaving
+     * the GUI thread. */
+    pool.start(new ExportJob(this, image.copy(), fileName, compression,
+                             blockQuality, isNormal));
+  }
+  progress(done, total);
+}
+
+QString ExportQueue::unique_name(QString path, QString baseName,
+                                 QString postfix, QString suffix) {
+  if (!reservedNames.contains(path)) {
+    reservedNames[path] = QDir(path).entryList(QDir::Files).toSet();
+  }
+  QSet<QString> &names = reservedNames[path];
+  QString name = baseName + postfix + "." + suffix;
+  int i = 1;
+  while (names.contains(name))
+    name = baseName + "(" + QString::number(++i) + ")" + postfix + "." + suffix;
+  names.insert(name);
+  return path + "/" + name;
+}
+
+void ExportQueue::set_compression(PngCompression c) { compression = c; }
+
+PngCompression ExportQueue::get_compression() { return compression; }
+
+void ExportQueue::set_block_quality(BlockQuality q) { blockQuality = q; }
+
+BlockQuality ExportQueue::get_block_quality() { return blockQuality; }
+
+void ExportQueue::set_stream_threshold(qint64 pixels) {
+  streamThreshold = pixels;
+}
+
+bool ExportQueue::is_busy() { return done < total; }
+
+void ExportQueue::wait_for_done() {
+  pool.waitForDone();
+  streamPool.waitForDone();
+}
+
+void ExportQueue::job_done(QString fileName, bool ok) {
+  if (heldOwners.contains(fileName)) {
+    QPointer<ImageProcessor> owner = heldOwners.take(fileName);
+    if (owner)
+      owner->release_updates();
+  }
+  done++;
+  if (ok)
+    written++;
+  else
+    failed.append(fileName);
+  progress(done, total);
+  if (done == total) {
+    finished(written, failed);
+    total = done = written = 0;
+    failed.clear();
+    reservedNames.clear();
+  }
+}
@@ -0,0 +1,79 @@
+/*
+ * Laigter: an automatic map generator for lighting effects.
+ * Copyright (C) 2019  Pablo Ivan Fonovich
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ * Contact: azagaya.games@gmail.com
+ */
+
+#ifndef EXPORTQUEUE_H
+#define EXPORTQUEUE_H
+
+#include <QHash>
+#include <QImage>
+#include <QObject>
+#include <QPointer>
+#include <QSet>
+#include <QStringList>
+#include <QThreadPool>
+
+#include "src/blockcompressor.h"
+#include "src/imageprocessor.h"
+#include "src/pngwriter.h"
+
+/* Encodes and writes exported maps on a thread pool, so the GUI thread only
+ * pays for copying each map out of its processor. Maps bigger than the
+ * stream threshold are not copied: they are streamed from the buffer of
+ * their processor, one at a time, while its updates are held. */
+class ExportQueue : public QObject {
+  Q_OBJECT
+public:
+  explicit ExportQueue(QObject *parent = nullptr);
+  ~ExportQueue();
+
+  static bool write_image(const QImage &image, QString fileName,
+                          PngCompression compression);
+
+  void enqueue(QImage image, QString fileName, bool isNormal = false,
+               ImageProcessor *owner = nullptr);
+  QString unique_name(QString path, QString baseName, QString postfix,
+                      QString suffix);
+  void set_compression(PngCompression c);
+  PngCompression get_compression();
+  void set_block_quality(BlockQuality q);
+  BlockQuality get_block_quality();
+  void set_stream_threshold(qint64 pixels);
+  bool is_busy();
+  void wait_for_done();
+
+signals:
+  void progress(int done, int total);
+  void finished(int written, QStringList failed);
+
+private slots:
+  void job_done(QString fileName, bool ok);
+
+private:
+  QThreadPool pool;
+  QThreadPool streamPool;
+  QMultiHash<QString, QPointer<ImageProcessor>> heldOwners;
+  PngCompression compression;
+  BlockQuality blockQuality;
+  qint64 streamThreshold;
+  int total, done, written;
+  QStringList failed;
+  QHash<QString, QSet<QString>> reservedNames;
+};
+
+#endif // EXPORTQUEUE_H
@@ -20,7 +20,25 @@
 #include "imageprocessor.h"
 #include <QApplication>
 #include <QDebug>
+#include <QElapsedTimer>
+#include <QtConcurrent/QtConcurrent>
 #include <cmath>
+#include <cstring>
+
+/* Adds the lifetime of the object to the processor's time for a stage */
+class StageTimer {
+public:
+  StageTimer(ImageProcessor *p, const char *stage) : p(p), stage(stage) {
+    timer.start();
+  }
+  ~StageTimer() { p->add_stage_time(stage, timer.nsecsElapsed()); }
+
+private:
+  ImageProcessor *p;
+  const char *stage;
+  QElapsedTimer timer;
+};
+
 ImageProcessor::ImageProcessor(QObject *parent) : QObject(parent) {
   position = offset = QVector2D(0, 0);
   zoom = 1.0;
@@ -65,6 +83,10 @@ ImageProcessor::ImageProcessor(QObject *parent) : QObject(parent) {
   occlusion_distance_mode = true;
   occlusion_distance = 10;
 
+  cone_radius = 32;
+  coneRadius = -1;
+  coneTileable = false;
+
   settings.tileable = &tileable;
   settings.gradient_end = &gradient_end;
   settings.parallax_max = &parallax_max;
@@ -102,6 +124,8 @@ ImageProcessor::ImageProcessor(QObject *parent) : QObject(parent) {
   settings.occlusion_distance = &occlusion_distance;
   settings.occlusion_distance_mode = &occlusion_distance_mode;
 
+  settings.cone_radius = &cone_radius;
+
   settings.lightList = &lightList;
 
   is_parallax = false;
@@ -109,12 +133,21 @@ ImageProcessor::ImageProcessor(QObject *parent) : QObject(parent) {
 
   customSpecularMap = false;
   customHeightMap = false;
+
+  updatesHeld = 0;
+  updatePending = false;
+  mapsRestored = false;
+  for (int i = 0; i < ProcessedImageCount; i++)
+    revisions[i] = 0;
 }
 
+ImageProcessor::~ImageProcessor() { qDeleteAll(cellProcessors); }
+
 int ImageProcessor::loadImage(QString fileName, QImage image) {
   m_fileName = fileName;
   m_name = fileName;
   texture = image;
+  bump_revision(ProcessedImage::Raw);
   m_img = Mat(image.height(), image.width(), CV_8UC4, image.scanLine(0));
   int aux = m_img.depth();
   switch (aux) {
@@ -146,6 +179,9 @@ int ImageProcessor::loadImage(QString fileName, QImage image) {
   if (!customSpecularMap) {
     m_img.copyTo(m_specular);
   }
+  if (!cells.isEmpty()) {
+    build_cells();
+  }
   if (!customHeightMap) {
     neighbours = Mat::zeros(m_img.rows * 3, m_img.cols * 3, m_img.type());
 
@@ -164,6 +200,8 @@ void ImageProcessor::set_current_heightmap() {
 }
 
 void ImageProcessor::calculate() {
+  if (defer_update() || calculate_cells())
+    return;
 
   set_current_heightmap();
 
@@ -180,85 +218,564 @@ void ImageProcessor::calculate() {
   calculate_occlusion();
 }
 
+/* Bounding box of the pixels that differ between two versions of a map, the
+ * whole map when the size or type changed, or an empty rectangle when
+ * nothing changed. Lets uploads skip the parts that stayed the same. */
+static QRect changed_rect(const Mat &before, const Mat &after) {
+  QRect all(0, 0, after.cols, after.rows);
+  if (before.size() != after.size() || before.type() != after.type())
+    return all;
+  Mat mask = before != after;
+  mask = mask.reshape(1, mask.rows);
+  Mat columns, rows;
+  reduce(mask, columns, 0, REDUCE_MAX);
+  reduce(mask, rows, 1, REDUCE_MAX);
+  int left = -1, right = -1, top = -1, bottom = -1;
+  for (int x = 0; x < columns.cols; x++) {
+    if (columns.at<uchar>(0, x)) {
+      if (left < 0)
+        left = x;
+      right = x;
+    }
+  }
+  for (int y = 0; y < rows.rows; y++) {
+    if (rows.at<uchar>(y, 0)) {
+      if (top < 0)
+        top = y;
+      bottom = y;
+    }
+  }
+  if (left < 0)
+    return QRect();
+  int channels = after.channels();
+  return QRect(QPoint(left / channels, top),
+               QPoint(right / channels, bottom));
+}
+
 void ImageProcessor::calculate_parallax() {
+  if (defer_update() ||
+      update_cells([](ImageProcessor *cell) { cell->calculate_parallax(); },
+                   {ProcessedImage::Parallax, ProcessedImage::ConeStep}))
+    return;
+  StageTimer timer(this, "calculate_parallax");
   Mat p = modify_parallax();
 
+  Mat result;
   Rect rect(m_img.cols, m_img.rows, m_img.cols, m_img.rows);
   if (tileable && p.rows == m_img.rows * 3) {
-    p(rect).copyTo(current_parallax);
+    p(rect).copyTo(result);
   } else {
-    p.copyTo(current_parallax);
+    p.copyTo(result);
   }
 
-  switch (current_parallax.channels()) {
+  switch (result.channels()) {
   case 3:
-    cvtColor(current_parallax, current_parallax, COLOR_RGB2GRAY);
+    cvtColor(result, result, COLOR_RGB2GRAY);
     break;
   case 4:
-    cvtColor(current_parallax, current_parallax, COLOR_RGBA2GRAY);
+    cvtColor(result, result, COLOR_RGBA2GRAY);
     break;
   }
 
+  QRect dirty = changed_rect(current_parallax, result);
+  result.copyTo(current_parallax);
+
   QImage pa = QImage(static_cast<unsigned char *>(current_parallax.data),
                      current_parallax.cols, current_parallax.rows,
                      current_parallax.step, QImage::Format_Grayscale8);
   parallax = pa;
+  if (!dirty.isEmpty())
+    bump_revision(ProcessedImage::Parallax, dirty);
+  /* The cone map also depends on the radius and on wrapping around */
+  if (!dirty.isEmpty() || coneRadius != cone_radius ||
+      coneTileable != tileable)
+    update_cone();
+  processed();
+}
+
+/* Cone ratios (horizontal over vertical distance, in texture units) of a
+ * depth map: for every pixel the widest cone standing on it that holds no
+ * higher pixel, so a ray can step that far without passing the surface.
+ * Only pixels within radius are searched, and cones are narrowed to not
+ * leave that area above the top. The square root is stored, which keeps
+ * precision on the narrow cones. Tiles are searched in parallel, each
+ * pixel in rings of growing distance until no closer obstacle is
+ * possible. */
+static Mat cone_step_map(const Mat &depth, int radius, bool wrap) {
+  Mat cone(depth.size(), CV_8UC1);
+  int cols = depth.cols, rows = depth.rows;
+  float unitX = 1.0f / cols, unitY = 1.0f / rows;
+  float minStep = 1.0f / qMax(cols, rows);
+  const int tile = 64;
+
+  QList<QPoint> tiles;
+  for (int y = 0; y < rows; y += tile)
+    for (int x = 0; x < cols; x += tile)
+      tiles.append(QPoint(x, y));
+  QtConcurrent::blockingMap(tiles, [&](QPoint &t) {
+    int endX = qMin(t.x() + tile, cols), endY = qMin(t.y() + tile, rows);
+    for (int y = t.y(); y < endY; y++) {
+      const uchar *row = depth.ptr<uchar>(y);
+      uchar *out = cone.ptr<uchar>(y);
+      for (int x = t.x(); x < endX; x++) {
+        int d = row[x];
+        float ratio = 1.0f;
+        if (d > 0) {
+          float pixelDepth = d / 255.0f;
+          ratio = qMin(ratio, (radius + 1) * minStep / pixelDepth);
+          auto visit = [&](int dx, int dy) {
+            int qx = x + dx, qy = y + dy;
+            if (wrap) {
+              qx = (qx % cols + cols) % cols;
+              qy = (qy % rows + rows) % rows;
+            } else if (qx < 0 || qy < 0 || qx >= cols || qy >= rows) {
+              return;
+            }
+            int rise = d - depth.at<uchar>(qy, qx);
+            if (rise <= 0)
+              return;
+            float u = dx * unitX, v = dy * unitY;
+            ratio = qMin(ratio, std::sqrt(u * u + v * v) * 255.0f / rise);
+          };
+          for (int k = 1; k <= radius && k * minStep < ratio * pixelDepth;
+               k++) {
+            for (int i = -k; i <= k; i++) {
+              visit(i, -k);
+              visit(i, k);
+            }
+            for (int i = 1 - k; i < k; i++) {
+              visit(-k, i);
+              visit(k, i);
+            }
+          }
+        }
+        /* Rounded down, a wider cone could step through the surface */
+        out[x] = static_cast<uchar>(std::sqrt(ratio) * 255.0f);
+      }
+    }
+  });
+  return cone;
+}
+
+/* Rebuilds the cone step map from current_parallax */
+void ImageProcessor::update_cone() {
+  if (current_parallax.empty())
+    return;
+  Mat result = cone_step_map(current_parallax, cone_radius, tileable);
+  coneRadius = cone_radius;
+  coneTileable = tileable;
+
+  QRect dirty = changed_rect(current_cone, result);
+  result.copyTo(current_cone);
+
+  cone = QImage(static_cast<unsigned char *>(current_cone.data),
+                current_cone.cols, current_cone.rows, current_cone.step,
+                QImage::Format_Grayscale8);
+  if (!dirty.isEmpty())
+    bump_revision(ProcessedImage::ConeStep, dirty);
+}
+
+void ImageProcessor::calculate_cone() {
+  if (defer_update() ||
+      update_cells([](ImageProcessor *cell) { cell->calculate_cone(); },
+                   {ProcessedImage::ConeStep}))
+    return;
+  StageTimer timer(this, "calculate_cone");
+  update_cone();
   processed();
 }
 
 void ImageProcessor::calculate_specular() {
+  if (defer_update() ||
+      update_cells([](ImageProcessor *cell) { cell->calculate_specular(); },
+                   {ProcessedImage::Specular}))
+    return;
+  StageTimer timer(this, "calculate_specular");
   Mat p = modify_specular();
 
+  Mat result;
   Rect rect(m_img.cols, m_img.rows, m_img.cols, m_img.rows);
   if (tileable && p.rows == m_img.rows * 3) {
-    p(rect).copyTo(current_specular);
+    p(rect).copyTo(result);
   } else {
-    p.copyTo(current_specular);
+    p.copyTo(result);
   }
 
-  switch (current_specular.channels()) {
+  switch (result.channels()) {
   case 3:
-    cvtColor(current_specular, current_specular, COLOR_RGB2GRAY);
+    cvtColor(result, result, COLOR_RGB2GRAY);
     break;
   case 4:
-    cvtColor(current_specular, current_specular, COLOR_RGBA2GRAY);
+    cvtColor(result, result, COLOR_RGBA2GRAY);
     break;
   }
 
+  QRect dirty = changed_rect(current_specular, result);
+  result.copyTo(current_specular);
+
   QImage pa = QImage(static_cast<unsigned char *>(current_specular.data),
                      current_specular.cols, current_specular.rows,
                      current_specular.step, QImage::Format_Grayscale8);
   specular = pa;
+  if (!dirty.isEmpty())
+    bump_revision(ProcessedImage::Specular, dirty);
   processed();
 }
 
 void ImageProcessor::calculate_occlusion() {
+  if (defer_update() ||
+      update_cells([](ImageProcessor *cell) { cell->calculate_occlusion(); },
+                   {ProcessedImage::Occlusion}))
+    return;
+  StageTimer timer(this, "calculate_occlusion");
   Mat p = modify_occlusion();
 
+  Mat result;
   Rect rect(m_img.cols, m_img.rows, m_img.cols, m_img.rows);
   if (tileable && p.rows == m_img.rows * 3) {
-    p(rect).copyTo(current_occlusion);
+    p(rect).copyTo(result);
   } else {
-    p.copyTo(current_occlusion);
+    p.copyTo(result);
   }
 
-  switch (current_occlusion.channels()) {
+  switch (result.channels()) {
   case 3:
-    cvtColor(current_occlusion, current_occlusion, COLOR_RGB2GRAY);
+    cvtColor(result, result, COLOR_RGB2GRAY);
     break;
   case 4:
-    cvtColor(current_occlusion, current_occlusion, COLOR_RGBA2GRAY);
+    cvtColor(result, result, COLOR_RGBA2GRAY);
     break;
   }
 
+  QRect dirty = changed_rect(current_occlusion, result);
+  result.copyTo(current_occlusion);
+
   QImage pa = QImage(static_cast<unsigned char *>(current_occlusion.data),
                      current_occlusion.cols, current_occlusion.rows,
                      current_occlusion.step, QImage::Format_Grayscale8);
   occlussion = pa;
+  if (!dirty.isEmpty())
+    bump_revision(ProcessedImage::Occlusion, dirty);
   processed();
 }
 
+void ImageProcessor::set_cells(QList<QRect> c) {
+  cells.clear();
+  QRect bounds(0, 0, m_img.cols, m_img.rows);
+  foreach (QRect r, c) {
+    r = r.intersected(bounds);
+    if (!r.isEmpty())
+      cells.append(r);
+  }
+  build_cells();
+  calculate();
+}
+
+QList<QRect> ImageProcessor::get_cells() { return cells; }
+
+void ImageProcessor::add_stage_time(QString stage, qint64 nsecs) {
+  stageTimes[stage] += nsecs;
+}
+
+QMap<QString, qint64> ImageProcessor::get_stage_times() { return stageTimes; }
+
+void ImageProcessor::reset_stage_times() { stageTimes.clear(); }
+
+/* Between hold_updates and release_updates setters and loaders only store
+ * their input; the maps are calculated once on release. Calls nest. */
+void ImageProcessor::hold_updates() { updatesHeld++; }
+
+void ImageProcessor::release_updates() {
+  if (updatesHeld == 0 || --updatesHeld > 0)
+    return;
+  if (updatePending) {
+    updatePending = false;
+    calculate();
+  }
+}
+
+/* Ends a hold like release_updates, but drops the pending calculation for
+ * callers that calculate right after. */
+void ImageProcessor::discard_updates() {
+  if (updatesHeld == 1)
+    updatePending = false;
+  release_updates();
+}
+
+bool ImageProcessor::defer_update() {
+  if (updatesHeld == 0) {
+    if (!mapsRestored)
+      return false;
+    /* Restored maps come without the intermediate stages the setters work
+     * on, so the first change rebuilds everything */
+    mapsRestored = false;
+    calculate();
+    return true;
+  }
+  updatePending = true;
+  return true;
+}
+
+static QImage restore_map(QImage image, QImage::Format format, int type,
+                          Mat &mat) {
+  image = image.convertToFormat(format);
+  Mat(image.height(), image.width(), type, image.bits(),
+      static_cast<size_t>(image.bytesPerLine()))
+      .copyTo(mat);
+  return QImage(static_cast<unsigned char *>(mat.data), mat.cols, mat.rows,
+                mat.step, format);
+}
+
+/* Installs maps calculated earlier for the same image and settings instead
+ * of calculating them, e.g. from a project file. A pending update from
+ * loading or setters under hold_updates is dropped. */
+void ImageProcessor::restore_maps(QImage n, QImage p, QImage s, QImage o) {
+  normal = restore_map(n, QImage::Format_RGB888, CV_8UC3, m_normal);
+  parallax = restore_map(p, QImage::Format_Grayscale8, CV_8UC1,
+                         current_parallax);
+  specular = restore_map(s, QImage::Format_Grayscale8, CV_8UC1,
+                         current_specular);
+  occlussion = restore_map(o, QImage::Format_Grayscale8, CV_8UC1,
+                           current_occlusion);
+  updatePending = false;
+  mapsRestored = true;
+  bump_revision(ProcessedImage::Normal);
+  bump_revision(ProcessedImage::Parallax);
+  bump_revision(ProcessedImage::Specular);
+  bump_revision(ProcessedImage::Occlusion);
+  /* Not saved with the maps, it only depends on the parallax map */
+  update_cone();
+  processed();
+}
+
+/* Each map, the texture included, has a revision that grows whenever it is
+ * replaced, so consumers like GPU uploads can skip unchanged maps. The last
+ * few revisions also keep the region they touched; a null rect means the
+ * whole map. */
+void ImageProcessor::bump_revision(ProcessedImage map, QRect rect) {
+  int i = static_cast<int>(map);
+  revisions[i]++;
+  dirtyRects[i].append(qMakePair(revisions[i], rect));
+  if (dirtyRects[i].size() > 8)
+    dirtyRects[i].removeFirst();
+}
+
+quint64 ImageProcessor::get_revision(ProcessedImage map) {
+  return revisions[static_cast<int>(map)];
+}
+
+/* Region of map changed after revision since, or a null rect when that
+ * reaches further back than the history kept or covers the whole map. */
+QRect ImageProcessor::dirty_rect(ProcessedImage map, quint64 since) {
+  int i = static_cast<int>(map);
+  QRect rect;
+  if (dirtyRects[i].isEmpty() || dirtyRects[i].first().first > since + 1)
+    return QRect();
+  typedef QPair<quint64, QRect> Entry;
+  foreach (Entry entry, dirtyRects[i]) {
+    if (entry.first <= since)
+      continue;
+    if (entry.second.isNull())
+      return QRect();
+    rect |= entry.second;
+  }
+  return rect;
+}
+
+/* Maps whose revision differs from the one in seen; seen is updated to the
+ * current revisions. Maps missing from seen count as changed. */
+QList<ProcessedImage>
+ImageProcessor::changed_maps(QMap<ProcessedImage, quint64> &seen) {
+  QList<ProcessedImage> changed;
+  for (int i = 0; i < ProcessedImageCount; i++) {
+    ProcessedImage map = static_cast<ProcessedImage>(i);
+    if (!seen.contains(map) || seen[map] != revisions[i]) {
+      changed.append(map);
+      seen[map] = revisions[i];
+    }
+  }
+  return changed;
+}
+
+static QImage mat_to_image(Mat m, QRect r) {
+  return QImage(static_cast<unsigned char *>(m.data), m.cols, m.rows, m.step,
+                QImage::Format_RGBA8888_Premultiplied)
+      .copy(r);
+}
+
+/* Every cell of a sprite sheet gets its own processor, so blur, distance and
+ * bevel stop at the cell border and tileable mode tiles each cell. */
+void ImageProcessor::build_cells() {
+  qDeleteAll(cellProcessors);
+  cellProcessors.clear();
+
+  ProcessorSettings s = get_settings();
+  QList<LightSource *> noLights;
+  s.lightList = &noLights;
+  foreach (QRect r, cells) {
+    ImageProcessor *cell = new ImageProcessor();
+    cell->copy_settings(s);
+    cell->m_name = m_name + "#" + QString::number(cellProcessors.count());
+    cell->texture = texture.copy(r);
+    cellProcessors.append(cell);
+  }
+
+  QList<int> indices;
+  for (int i = 0; i < cellProcessors.count(); i++)
+    indices.append(i);
+  /* Cells are calculated by calculate_cells, loading them is enough here */
+  QtConcurrent::blockingMap(indices, [this](int &i) {
+    ImageProcessor *cell = cellProcessors.at(i);
+    cell->hold_updates();
+    cell->loadImage(cell->m_name, cell->texture);
+    if (customHeightMap)
+      cell->loadHeightMap(m_heightmapPath, mat_to_image(m_heightmap, cells[i]));
+    if (customSpecularMap)
+      cell->loadSpecularMap(m_specularPath, mat_to_image(m_specular, cells[i]));
+    cell->discard_updates();
+  });
+}
+
+bool ImageProcessor::calculate_cells() {
+  return update_cells([](ImageProcessor *cell) { cell->calculate(); },
+                      {ProcessedImage::Normal, ProcessedImage::Parallax,
+                       ProcessedImage::Specular, ProcessedImage::Occlusion,
+                       ProcessedImage::ConeStep});
+}
+
+/* Runs one stage on every cell with the current settings and assembles only
+ * the maps that stage changes, so a slider does not recalculate the rest.
+ * Returns false when there are no cells and the sheet is processed whole. */
+bool ImageProcessor::update_cells(std::function<void(ImageProcessor *)> stage,
+                                  QList<ProcessedImage> maps) {
+  if (cells.isEmpty() || cellProcessors.count() != cells.count())
+    return false;
+
+  ProcessorSettings s = get_settings();
+  QList<LightSource *> noLights;
+  s.lightList = &noLights;
+  foreach (ImageProcessor *cell, cellProcessors) { cell->copy_settings(s); }
+
+  QtConcurrent::blockingMap(cellProcessors, [stage](ImageProcessor *&cell) {
+    cell->reset_stage_times();
+    stage(cell);
+  });
+  /* Stage times add up over the cells, as if the sheet ran them whole */
+  foreach (ImageProcessor *cell, cellProcessors) {
+    QMap<QString, qint64> times = cell->get_stage_times();
+    for (auto i = times.constBegin(); i != times.constEnd(); ++i)
+      add_stage_time(i.key(), i.value());
+  }
+
+  StageTimer timer(this, "assemble_cells");
+  foreach (ProcessedImage map, maps)
+    assemble_cells(map);
+  processed();
+  if (maps.contains(ProcessedImage::Normal))
+    on_idle();
+  return true;
+}
+
+/* Passes a normal map setting on to the cells */
+bool ImageProcessor::update_cell_normals(void (ImageProcessor::*set)(int),
+                                         int value) {
+  return update_cells(
+      [set, value](ImageProcessor *cell) { (cell->*set)(value); },
+      {ProcessedImage::Normal});
+}
+
+bool ImageProcessor::update_cell_normals(void (ImageProcessor::*set)(bool),
+                                         bool value) {
+  return update_cells(
+      [set, value](ImageProcessor *cell) { (cell->*set)(value); },
+      {ProcessedImage::Normal});
+}
+
+/* Copies one map of every cell into the sheet sized map of this processor */
+void ImageProcessor::assemble_cells(ProcessedImage map) {
+  Mat ImageProcessor::*mat;
+  switch (map) {
+  case ProcessedImage::Normal:
+    mat = &ImageProcessor::m_normal;
+    break;
+  case ProcessedImage::Parallax:
+    mat = &ImageProcessor::current_parallax;
+    break;
+  case ProcessedImage::Specular:
+    mat = &ImageProcessor::current_specular;
+    break;
+  case ProcessedImage::Occlusion:
+    mat = &ImageProcessor::current_occlusion;
+    break;
+  case ProcessedImage::ConeStep:
+    mat = &ImageProcessor::current_cone;
+    break;
+  default:
+    return;
+  }
+
+  Mat sheet;
+  if (map == ProcessedImage::Normal)
+    sheet = Mat(m_img.rows, m_img.cols, CV_8UC3, Scalar(128, 128, 255));
+  else
+    sheet = Mat::zeros(m_img.rows, m_img.cols, CV_8UC1);
+  for (int i = 0; i < cells.count(); i++) {
+    Mat &part = cellProcessors.at(i)->*mat;
+    Rect rect(cells[i].x(), cells[i].y(), cells[i].width(), cells[i].height());
+    if (part.size() == rect.size() && part.type() == sheet.type())
+      part.copyTo(sheet(rect));
+  }
+  QRect dirty = changed_rect(this->*mat, sheet);
+  sheet.copyTo(this->*mat);
+
+  Mat &m = this->*mat;
+  QImage image(static_cast<unsigned char *>(m.data), m.cols, m.rows, m.step,
+               map == ProcessedImage::Normal ? QImage::Format_RGB888
+                                             : QImage::Format_Grayscale8);
+  switch (map) {
+  case ProcessedImage::Normal:
+    normal = image;
+    break;
+  case ProcessedImage::Parallax:
+    parallax = image;
+    break;
+  case ProcessedImage::Specular:
+    specular = image;
+    break;
+  case ProcessedImage::Occlusion:
+    occlussion = image;
+    break;
+  default:
+    cone = image;
+    break;
+  }
+  if (!dirty.isEmpty())
+    bump_revision(map, dirty);
+}
+
+/* A sheet sized image put together from the same image of every cell */
+QImage ImageProcessor::cell_sheet(QImage (ImageProcessor::*get)(),
+                                  QImage::Format format) {
+  QImage sheet(m_img.cols, m_img.rows, format);
+  sheet.fill(0);
+  int bytes = sheet.depth() / 8;
+  for (int i = 0; i < cells.count(); i++) {
+    QRect r = cells[i];
+    QImage part = (cellProcessors.at(i)->*get)().convertToFormat(format);
+    /* Tileable cells work on their neighbours, the cell is the middle */
+    if (part.size() == r.size() * 3)
+      part = part.copy(QRect(QPoint(r.width(), r.height()), r.size()));
+    if (part.size() != r.size())
+      continue;
+    for (int y = 0; y < r.height(); y++)
+      memcpy(sheet.scanLine(r.y() + y) + r.x() * bytes, part.constScanLine(y),
+             static_cast<size_t>(r.width() * bytes));
+  }
+  return sheet;
+}
+
 void ImageProcessor::calculate_heightmap() {
+  StageTimer timer(this, "calculate_heightmap");
   cvtColor(current_heightmap, m_gray, COLOR_RGBA2GRAY);
   if (m_gray.type() != CV_32FC1)
     m_gray.convertTo(m_gray, CV_32FC1);
@@ -398,6 +915,8 @@ int ImageProcessor::loadSpecularMap(QString fileName, QImage specular) {
   cv::resize(m_specular, m_specular, m_img.size() * 2);
   cv::resize(m_specular, m_specular, m_img.size());
 
+  if (!cells.isEmpty())
+    build_cells();
   calculate();
 
   return 0;
@@ -452,6 +971,8 @@ int ImageProcessor::loadHeightMap(QString fileName, QImage height) {
   if (m_gray.type() != CV_32FC1)
     m_gray.convertTo(m_gray, CV_32FC1);
 
+  if (!cells.isEmpty())
+    build_cells();
   calculate();
 
   return 0;
@@ -463,7 +984,7 @@ QString ImageProcessor::get_name() { return m_name; }
 void ImageProcessor::calculate_gradient() {}
 
 void ImageProcessor::calculate_distance() {
-
+  StageTimer timer(this, "calculate_distance");
   if (!current_heightmap.ptr<int>(0))
     return;
 
@@ -500,6 +1021,9 @@ void ImageProcessor::calculate_distance() {
 
 void ImageProcessor::set_normal_invert_x(bool invert) {
   normalInvertX = -invert * 2 + 1;
+  if (defer_update() ||
+      update_cell_normals(&ImageProcessor::set_normal_invert_x, invert))
+    return;
   m_emboss_normal =
       (calculate_normal(m_gray, normal_depth, normal_blur_radius));
   m_distance_normal =
@@ -509,6 +1033,9 @@ void ImageProcessor::set_normal_invert_x(bool invert) {
 }
 void ImageProcessor::set_normal_invert_y(bool invert) {
   normalInvertY = -invert * 2 + 1;
+  if (defer_update() ||
+      update_cell_normals(&ImageProcessor::set_normal_invert_y, invert))
+    return;
   m_emboss_normal =
       (calculate_normal(m_gray, normal_depth, normal_blur_radius));
   m_distance_normal =
@@ -518,6 +1045,9 @@ void ImageProcessor::set_normal_invert_y(bool invert) {
 }
 void ImageProcessor::set_normal_invert_z(bool invert) {
   normalInvertZ = -invert * 2 + 1;
+  if (defer_update() ||
+      update_cell_normals(&ImageProcessor::set_normal_invert_z, invert))
+    return;
   m_emboss_normal =
       (calculate_normal(m_gray, normal_depth, normal_blur_radius));
   m_distance_normal =
@@ -527,6 +1057,9 @@ void ImageProcessor::set_normal_invert_z(bool invert) {
 }
 void ImageProcessor::set_normal_depth(int depth) {
   normal_depth = depth;
+  if (defer_update() ||
+      update_cell_normals(&ImageProcessor::set_normal_depth, depth))
+    return;
   Mat gray;
   m_gray.copyTo(gray);
   m_emboss_normal = calculate_normal(gray, normal_depth, normal_blur_radius);
@@ -534,6 +1067,9 @@ void ImageProcessor::set_normal_depth(int depth) {
 }
 void ImageProcessor::set_normal_bisel_soft(bool soft) {
   normal_bisel_soft = soft;
+  if (defer_update() ||
+      update_cell_normals(&ImageProcessor::set_normal_bisel_soft, soft))
+    return;
   new_distance = modify_distance();
   m_distance_normal =
       calculate_normal(new_distance, normal_bisel_depth * normal_bisel_distance,
@@ -542,6 +1078,9 @@ void ImageProcessor::set_normal_bisel_soft(bool soft) {
 }
 void ImageProcessor::set_normal_blur_radius(int radius) {
   normal_blur_radius = radius;
+  if (defer_update() ||
+      update_cell_normals(&ImageProcessor::set_normal_blur_radius, radius))
+    return;
   Mat gray;
   m_gray.copyTo(gray);
   // calculate_heightmap();
@@ -551,6 +1090,9 @@ void ImageProcessor::set_normal_blur_radius(int radius) {
 
 void ImageProcessor::set_normal_bisel_depth(int depth) {
   normal_bisel_depth = depth;
+  if (defer_update() ||
+      update_cell_normals(&ImageProcessor::set_normal_bisel_depth, depth))
+    return;
   m_distance_normal =
       calculate_normal(new_distance, normal_bisel_depth * normal_bisel_distance,
                        normal_bisel_blur_radius);
@@ -559,6 +1101,9 @@ void ImageProcessor::set_normal_bisel_depth(int depth) {
 
 void ImageProcessor::set_normal_bisel_distance(int distance) {
   normal_bisel_distance = distance;
+  if (defer_update() ||
+      update_cell_normals(&ImageProcessor::set_normal_bisel_distance, distance))
+    return;
   new_distance = modify_distance();
 
   m_distance_normal =
@@ -718,6 +1263,10 @@ Mat ImageProcessor::modify_specular() {
 
 void ImageProcessor::set_normal_bisel_blur_radius(int radius) {
   normal_bisel_blur_radius = radius;
+  if (defer_update() ||
+      update_cell_normals(&ImageProcessor::set_normal_bisel_blur_radius,
+                          radius))
+    return;
   new_distance = modify_distance();
   m_distance_normal =
       calculate_normal(new_distance, normal_bisel_depth * normal_bisel_distance,
@@ -726,8 +1275,13 @@ void ImageProcessor::set_normal_bisel_blur_radius(int radius) {
 }
 
 void ImageProcessor::generate_normal_map() {
+  if (defer_update() ||
+      update_cells([](ImageProcessor *cell) { cell->generate_normal_map(); },
+                   {ProcessedImage::Normal}))
+    return;
   if (!current_heightmap.ptr<int>(0) || busy)
     return;
+  StageTimer timer(this, "generate_normal_map");
   busy = true;
   Mat normals;
   normals = (m_emboss_normal + m_distance_normal);
@@ -739,10 +1293,13 @@ void ImageProcessor::generate_normal_map() {
   }
 
   normals.convertTo(normals, CV_8UC3, 255);
+  QRect dirty = changed_rect(m_normal, normals);
   normals.copyTo(m_normal);
   QImage p = QImage(static_cast<unsigned char *>(m_normal.data), m_normal.cols,
                     m_normal.rows, m_normal.step, QImage::Format_RGB888);
   normal = p;
+  if (!dirty.isEmpty())
+    bump_revision(ProcessedImage::Normal, dirty);
   processed();
 
   busy = false;
@@ -833,6 +1390,71 @@ QImage *ImageProcessor::get_specular() { return &specular; }
 
 QImage *ImageProcessor::get_occlusion() { return &occlussion; }
 
+QImage *ImageProcessor::get_cone() { return &cone; }
+
+bool ImageProcessor::is_valid_pack_layout(QString layout) {
+  if (layout.length() < 3 || layout.length() > 4)
+    return false;
+  foreach (QChar c, layout) {
+    if (!QString("ospca01").contains(c))
+      return false;
+  }
+  return true;
+}
+
+static void release_mat(void *info) { delete static_cast<Mat *>(info); }
+
+/* Wraps a temporary Mat without copying it; the image keeps the Mat alive
+ * until its last shared copy is gone. */
+static QImage owning_image(Mat m, QImage::Format format) {
+  Mat *owner = new Mat(m);
+  return QImage(static_cast<unsigned char *>(owner->data), owner->cols,
+                owner->rows, owner->step, format, release_mat, owner);
+}
+
+/* Packs single channel maps into one image, one layout character per
+ * channel: o(cclusion), s(pecular), p(arallax), c(one step), a(lpha), 0
+ * or 1. Every call packs into a buffer of its own, which the image owns,
+ * so an export can keep writing it while the next one is packed. */
+QImage ImageProcessor::get_packed(QString layout) {
+  if (!is_valid_pack_layout(layout) || current_occlusion.empty())
+    return QImage();
+
+  QImage rgba = texture.convertToFormat(QImage::Format_RGBA8888);
+  Mat alpha;
+  extractChannel(Mat(rgba.height(), rgba.width(), CV_8UC4, rgba.bits(),
+                     static_cast<size_t>(rgba.bytesPerLine())),
+                 alpha, 3);
+
+  Size size = current_occlusion.size();
+  std::vector<Mat> channels;
+  foreach (QChar c, layout) {
+    if (c == 'o')
+      channels.push_back(current_occlusion);
+    else if (c == 's')
+      channels.push_back(current_specular);
+    else if (c == 'p')
+      channels.push_back(current_parallax);
+    else if (c == 'c')
+      channels.push_back(current_cone);
+    else if (c == 'a')
+      channels.push_back(alpha);
+    else if (c == '0')
+      channels.push_back(Mat::zeros(size, CV_8UC1));
+    else
+      channels.push_back(Mat(size, CV_8UC1, Scalar(255)));
+  }
+  for (size_t i = 0; i < channels.size(); i++) {
+    if (channels[i].size() != size)
+      return QImage();
+  }
+  Mat packed;
+  merge(channels, packed);
+
+  return owning_image(packed, layout.length() == 4 ? QImage::Format_RGBA8888
+                                                   : QImage::Format_RGB888);
+}
+
 bool ImageProcessor::get_parallax_invert() { return parallax_invert; }
 
 void ImageProcessor::set_parallax_invert(bool invert) {
@@ -995,6 +1617,13 @@ void ImageProcessor::set_occlusion_distance(int distance) {
 
 int ImageProcessor::get_occlusion_distance() { return occlusion_distance; }
 
+void ImageProcessor::set_cone_radius(int radius) {
+  cone_radius = radius;
+  calculate_cone();
+}
+
+int ImageProcessor::get_cone_radius() { return cone_radius; }
+
 ProcessorSettings &ProcessorSettings::operator=(ProcessorSettings other) {
   *tileable = *(other.tileable);
   *gradient_end = *(other.gradient_end);
@@ -1033,6 +1662,8 @@ ProcessorSettings &ProcessorSettings::operator=(ProcessorSettings other) {
   *occlusion_distance = *(other.occlusion_distance);
   *occlusion_distance_mode = *(other.occlusion_distance_mode);
 
+  *cone_radius = *(other.cone_radius);
+
   lightList->clear();
   foreach (LightSource *light, *(other.lightList)) {
     LightSource *l = new LightSource();
@@ -1043,22 +1674,25 @@ ProcessorSettings &ProcessorSettings::operator=(ProcessorSettings other) {
 }
 
 QImage ImageProcessor::get_heightmap() {
+  if (!cells.isEmpty() && cellProcessors.count() == cells.count())
+    return cell_sheet(&ImageProcessor::get_heightmap, QImage::Format_RGB888);
   Mat m;
   cvtColor(current_heightmap, m, CV_RGBA2GRAY);
   cvtColor(m, m, CV_GRAY2RGB);
   m.convertTo(m, CV_8UC3, 1);
   GaussianBlur(m, m,
                Size(normal_blur_radius * 2 + 1, normal_blur_radius * 2 + 1), 0);
-  return QImage(static_cast<unsigned char *>(m.data), m.cols, m.rows, m.step,
-                QImage::Format_RGB888);
+  return owning_image(m, QImage::Format_RGB888);
 }
 
 QImage ImageProcessor::get_distance_map() {
+  if (!cells.isEmpty() && cellProcessors.count() == cells.count())
+    return cell_sheet(&ImageProcessor::get_distance_map,
+                      QImage::Format_RGBA8888_Premultiplied);
   Mat m;
   cvtColor(new_distance, m, CV_GRAY2RGBA);
   m.convertTo(m, CV_8UC4, 255);
-  return QImage(static_cast<unsigned char *>(m.data), m.cols, m.rows, m.step,
-                QImage::Format_RGBA8888_Premultiplied);
+  return owning_image(m, QImage::Format_RGBA8888_Premultiplied);
 }
 
 void ImageProcessor::set_light_list(QList<LightSource *> &list) {
@@ -22,7 +22,11 @@
 
 #include <QImage>
 #include <QList>
+#include <QMap>
 #include <QObject>
+#include <QPair>
+#include <QRect>
+#include <functional>
 #include <opencv2/opencv.hpp>
 #if defined(Q_OS_WIN)
 #include <opencv2/imgcodecs.hpp>
@@ -34,7 +38,15 @@
 
 using namespace cv;
 
-enum class ProcessedImage { Raw, Normal, Parallax, Specular, Occlusion };
+enum class ProcessedImage {
+  Raw,
+  Normal,
+  Parallax,
+  Specular,
+  Occlusion,
+  ConeStep
+};
+const int ProcessedImageCount = 6;
 
 enum class ParallaxType { Binary, HeightMap, Quantization, Intervals };
 
@@ -74,6 +86,8 @@ public:
   bool *occlusion_distance_mode;
   int *occlusion_distance;
 
+  int *cone_radius;
+
   QList<LightSource *> *lightList;
 };
 
@@ -81,6 +95,7 @@ class ImageProcessor : public QObject {
   Q_OBJECT
 public:
   explicit ImageProcessor(QObject *parent = nullptr);
+  ~ImageProcessor();
   int loadImage(QString fileName, QImage image);
   int loadHeightMap(QString fileName, QImage height);
   int loadSpecularMap(QString fileName, QImage specular);
@@ -107,17 +122,35 @@ public:
   QImage *get_parallax();
   QImage *get_specular();
   QImage *get_occlusion();
+  QImage *get_cone();
+  QImage get_packed(QString layout);
+  static bool is_valid_pack_layout(QString layout);
 
   QImage texture;
   QImage normal;
   QImage parallax;
   QImage specular;
   QImage occlussion;
+  QImage cone;
 
   void calculate();
   void calculate_parallax();
   void calculate_specular();
   void calculate_occlusion();
+  void calculate_cone();
+
+  void set_cells(QList<QRect> c);
+  QList<QRect> get_cells();
+  void hold_updates();
+  void release_updates();
+  void discard_updates();
+  void restore_maps(QImage n, QImage p, QImage s, QImage o);
+  quint64 get_revision(ProcessedImage map);
+  QRect dirty_rect(ProcessedImage map, quint64 since);
+  QList<ProcessedImage> changed_maps(QMap<ProcessedImage, quint64> &seen);
+  void add_stage_time(QString stage, qint64 nsecs);
+  QMap<QString, qint64> get_stage_times();
+  void reset_stage_times();
 
 signals:
   void processed();
@@ -192,6 +225,9 @@ public slots:
   void set_occlusion_distance(int distance);
   int get_occlusion_distance();
 
+  void set_cone_radius(int radius);
+  int get_cone_radius();
+
   ProcessorSettings get_settings();
 
   ParallaxType get_parallax_type();
@@ -229,6 +265,18 @@ public slots:
   void set_connected(bool c);
 
 private:
+  void build_cells();
+  bool calculate_cells();
+  bool update_cells(std::function<void(ImageProcessor *)> stage,
+                    QList<ProcessedImage> maps);
+  bool update_cell_normals(void (ImageProcessor::*set)(int), int value);
+  bool update_cell_normals(void (ImageProcessor::*set)(bool), bool value);
+  void assemble_cells(ProcessedImage map);
+  QImage cell_sheet(QImage (ImageProcessor::*get)(), QImage::Format format);
+  bool defer_update();
+  void bump_revision(ProcessedImage map, QRect rect = QRect());
+  void update_cone();
+
   ProcessorSettings settings;
 
   ImageLoader il;
@@ -287,6 +335,11 @@ private:
   bool occlusion_distance_mode;
   int occlusion_distance;
 
+  Mat current_cone;
+  int cone_radius;
+  int coneRadius;
+  bool coneTileable;
+
   QList<LightSource *> lightList;
 
   QVector3D position;
@@ -296,6 +349,15 @@ private:
   bool selected, tileX, tileY, is_parallax, connected;
 
   bool customHeightMap, customSpecularMap;
+  int updatesHeld;
+  bool updatePending;
+  bool mapsRestored;
+  quint64 revisions[ProcessedImageCount];
+  QList<QPair<quint64, QRect>> dirtyRects[ProcessedImageCount];
+  QMap<QString, qint64> stageTimes;
+
+  QList<QRect> cells;
+  QList<ImageProcessor *> cellProcessors;
 };
 
 #endif // IMAGEPROCESSOR_H
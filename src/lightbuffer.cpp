@@ -0,0 +1,189 @@
+/*
+ * Laigter: an automatic map generator for lighting effects.
+ * Copyright (C) 2019  Pablo Ivan Fonovich
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ * Contact: azagaya.games@gmail.com
+ */
+
+#include "lightbuffer.h"
+#include "src/shaderloader.h"
+#include <QOpenGLContext>
+#include <cstring>
+
+/* std140 layout of the Lights block in sprite.glsl: lightNum, viewSize,
+ * ambientColor and ambientIntensity, then MAX_LIGHTS lightSource structs
+ * of 64 bytes. Programs built with fewer lights read a prefix of it. */
+static const int lightNumOffset = 0;
+static const int viewSizeOffset = 8;
+static const int ambientColorOffset = 16;
+static const int ambientIntensityOffset = 28;
+static const int headerSize = 32;
+static const int lightStride = 64;
+static const GLuint bindingPoint = 0;
+
+static void put(QByteArray &data, int offset, QVector3D v) {
+  float f[3] = {v.x(), v.y(), v.z()};
+  memcpy(data.data() + offset, f, sizeof(f));
+}
+
+static void put(QByteArray &data, int offset, QSize s) {
+  float f[2] = {static_cast<float>(s.width()), static_cast<float>(s.height())};
+  memcpy(data.data() + offset, f, sizeof(f));
+}
+
+static void put(QByteArray &data, int offset, float f) {
+  memcpy(data.data() + offset, &f, sizeof(f));
+}
+
+static QVector3D color_vector(QColor color) {
+  double r, g, b;
+  color.getRgbF(&r, &g, &b, nullptr);
+  return QVector3D(r, g, b);
+}
+
+LightBuffer::LightBuffer() {
+  buffer = 0;
+  lightCapacity = legacyLights;
+}
+
+/* Most lights the shaders of the current context take */
+int LightBuffer::capacity() {
+  if (!ShaderLoader::modern())
+    return legacyLights;
+  GLint size = 0;
+  QOpenGLContext::currentContext()->functions()->glGetIntegerv(
+      GL_MAX_UNIFORM_BLOCK_SIZE, &size);
+  return qBound(legacyLights, (size - headerSize) / lightStride, maxLights);
+}
+
+/* Smallest light count the shaders are specialised for that holds lights:
+ * 0 or a power of two, up to capacity() */
+int LightBuffer::bucket(int lights) {
+  if (lights <= 0)
+    return 0;
+  int n = 1;
+  while (n < lights)
+    n *= 2;
+  return qMin(n, capacity());
+}
+
+/* Creates the uniform buffer when the context takes the GLSL 3.30 shaders.
+ * Needs the context to be current. */
+void LightBuffer::init() {
+  if (!ShaderLoader::modern())
+    return;
+  initializeOpenGLFunctions();
+  lightCapacity = capacity();
+  glGenBuffers(1, &buffer);
+  glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+  glBufferData(GL_UNIFORM_BUFFER, headerSize + lightCapacity * lightStride,
+               nullptr, GL_DYNAMIC_DRAW);
+  glBindBuffer(GL_UNIFORM_BUFFER, 0);
+  uploaded.clear();
+}
+
+void LightBuffer::destroy() {
+  if (buffer)
+    glDeleteBuffers(1, &buffer);
+  buffer = 0;
+}
+
+/* Points the program's Lights block at the buffer */
+void LightBuffer::attach(QOpenGLShaderProgram *program) {
+  if (!buffer)
+    return;
+  GLuint index = glGetUniformBlockIndex(program->programId(), "Lights");
+  if (index != GL_INVALID_INDEX)
+    glUniformBlockBinding(program->programId(), index, bindingPoint);
+}
+
+/* Sets the lights for program, which has to be bound. With the uniform
+ * buffer they are shared, and the program is only needed for the older
+ * path. Lights past the capacity are left out. */
+void LightBuffer::apply(QOpenGLShaderProgram *program,
+                        QList<LightSource *> lights, QColor ambientColor,
+                        float ambientIntensity, QSize viewSize) {
+  int n = qMin(lights.count(), buffer ? lightCapacity : legacyLights);
+  lights = lights.mid(0, n);
+
+  /* Dark padding, off the sprite plane so its direction is defined and
+   * with a scatter that keeps pow() defined. It adds no light, and the
+   * shaders take the alpha of the lights from lightNum, the real count,
+   * so it changes nothing. */
+  LightSource dark;
+  dark.set_light_position(QVector3D(0, 0, 1));
+  dark.set_diffuse_color(Qt::black);
+  dark.set_diffuse_intensity(0);
+  dark.set_specular_color(Qt::black);
+  dark.set_specular_intensity(0);
+  dark.set_specular_scatter(1);
+  while (lights.count() < bucket(n))
+    lights.append(&dark);
+
+  if (!buffer) {
+    program->setUniformValue("lightNum", n);
+    for (int i = 0; i < lights.count(); i++) {
+      LightSource *light = lights.at(i);
+      QString Light = "Light[" + QString::number(i) + "]";
+      program->setUniformValue((Light + ".lightPos").toUtf8().constData(),
+                               light->get_light_position());
+      program->setUniformValue((Light + ".lightColor").toUtf8().constData(),
+                               color_vector(light->get_diffuse_color()));
+      program->setUniformValue((Light + ".specColor").toUtf8().constData(),
+                               color_vector(light->get_specular_color()));
+      program->setUniformValue(
+          (Light + ".diffIntensity").toUtf8().constData(),
+          light->get_diffuse_intensity());
+      program->setUniformValue(
+          (Light + ".specIntensity").toUtf8().constData(),
+          light->get_specular_intesity());
+      program->setUniformValue((Light + ".specScatter").toUtf8().constData(),
+                               light->get_specular_scatter());
+      program->setUniformValue((Light + ".radius").toUtf8().constData(),
+                               light->get_radius());
+    }
+    program->setUniformValue("viewSize", QSizeF(viewSize));
+    program->setUniformValue("ambientColor", color_vector(ambientColor));
+    program->setUniformValue("ambientIntensity", ambientIntensity);
+    return;
+  }
+
+  /* Only the lights in use are uploaded, nothing reads past them */
+  QByteArray data(headerSize + lights.count() * lightStride, 0);
+  qint32 count = n;
+  memcpy(data.data() + lightNumOffset, &count, sizeof(count));
+  put(data, viewSizeOffset, viewSize);
+  put(data, ambientColorOffset, color_vector(ambientColor));
+  put(data, ambientIntensityOffset, ambientIntensity);
+  for (int i = 0; i < lights.count(); i++) {
+    LightSource *light = lights.at(i);
+    int offset = headerSize + i * lightStride;
+    put(data, offset, light->get_light_position());
+    put(data, offset + 16, color_vector(light->get_diffuse_color()));
+    put(data, offset + 28, light->get_diffuse_intensity());
+    put(data, offset + 32, color_vector(light->get_specular_color()));
+    put(data, offset + 44, light->get_specular_intesity());
+    put(data, offset + 48, light->get_specular_scatter());
+    put(data, offset + 52, light->get_radius());
+  }
+
+  glBindBufferBase(GL_UNIFORM_BUFFER, bindingPoint, buffer);
+  if (data == uploaded)
+    return;
+  glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+  glBufferSubData(GL_UNIFORM_BUFFER, 0, data.size(), data.constData());
+  glBindBuffer(GL_UNIFORM_BUFFER, 0);
+  uploaded = data;
+}
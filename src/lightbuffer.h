@@ -0,0 +1,62 @@
+/*
+ * Laigter: an automatic map generator for lighting effects.
+ * Copyright (C) 2019  Pablo Ivan Fonovich
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ * Contact: azagaya.games@gmail.com
+ */
+
+#ifndef LIGHTBUFFER_H
+#define LIGHTBUFFER_H
+
+#include <QByteArray>
+#include <QColor>
+#include <QList>
+#include <QOpenGLExtraFunctions>
+#include <QOpenGLShaderProgram>
+#include <QSize>
+
+#include "src/lightsource.h"
+
+/* The scene lights and ambient term as the shaders see them. When the
+ * programs are built as GLSL 3.30 (see ShaderLoader) they read them from
+ * one std140 uniform block shared by every program, and a change is a
+ * single sub-upload that is skipped when nothing moved. The block holds
+ * as many lights as the context allows, up to maxLights. On older contexts
+ * they are set as plain uniforms on each program, up to legacyLights.
+ * Lights are padded with dark ones up to bucket() of their count, the
+ * fixed loop bound of the specialised shaders (see ShaderVariants).
+ * viewSize is the size in pixels of what the -1 to 1 view spans, the
+ * scale of the light radii. */
+class LightBuffer : protected QOpenGLExtraFunctions {
+public:
+  static const int legacyLights = 32;
+  static const int maxLights = 256;
+
+  LightBuffer();
+  static int capacity();
+  static int bucket(int lights);
+  void init();
+  void destroy();
+  void attach(QOpenGLShaderProgram *program);
+  void apply(QOpenGLShaderProgram *program, QList<LightSource *> lights,
+             QColor ambientColor, float ambientIntensity, QSize viewSize);
+
+private:
+  GLuint buffer;
+  int lightCapacity;
+  QByteArray uploaded;
+};
+
+#endif // LIGHTBUFFER_H
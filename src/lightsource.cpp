@@ -46,4 +46,8 @@ float LightSource::get_specular_intesity() {
   return settings.specularIntensity;
 }
 
+void LightSource::set_radius(float radius) { settings.radius = radius; }
+
+float LightSource::get_radius() { return settings.radius; }
+
 void LightSource::copy_settings(LightSource *l) { settings = l->settings; }
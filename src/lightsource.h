@@ -9,6 +9,9 @@ struct LightSettings {
   QColor diffuseColor, specularColor;
   float diffuseIntensity, specularIntensity, specularScatter;
   QVector3D lightPosition;
+  /* Distance in view pixels at which the light fades out, 0 for a light
+   * that reaches the whole scene */
+  float radius = 0;
 };
 
 class LightSource : public QObject {
@@ -37,6 +40,9 @@ public slots:
   void set_light_position(QVector3D position);
   QVector3D get_light_position();
 
+  void set_radius(float radius);
+  float get_radius();
+
   void copy_settings(LightSource *l);
 
 private:
@@ -0,0 +1,132 @@
+/*
+ * Laigter: an automatic map generator for lighting effects.
+ * Copyright (C) 2019  Pablo Ivan Fonovich
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ * Contact: azagaya.games@gmail.com
+ */
+
+#include "mapframe.h"
+#include <QJsonDocument>
+#include <QtEndian>
+#include <climits>
+#include <cstring>
+
+static const char magic[4] = {'L', 'G', 'T', 'F'};
+static const int prefixSize = 16;
+
+void MapFrame::add_image(QString name, const QImage &image) {
+  QImage img = image;
+  int channels;
+  switch (img.format()) {
+  case QImage::Format_Grayscale8:
+    channels = 1;
+    break;
+  case QImage::Format_RGB888:
+    channels = 3;
+    break;
+  case QImage::Format_RGBA8888:
+    channels = 4;
+    break;
+  default:
+    img = image.convertToFormat(QImage::Format_RGBA8888);
+    channels = 4;
+  }
+  int rowBytes = img.width() * channels;
+  QJsonObject entry;
+  entry["width"] = img.width();
+  entry["height"] = img.height();
+  entry["channels"] = channels;
+  entry["offset"] = payload.size();
+  entry["size"] = rowBytes * img.height();
+  payload.reserve(payload.size() + rowBytes * img.height());
+  for (int y = 0; y < img.height(); y++)
+    payload.append(reinterpret_cast<const char *>(img.constScanLine(y)),
+                   rowBytes);
+
+  QJsonObject maps = header["maps"].toObject();
+  maps[name] = entry;
+  header["maps"] = maps;
+}
+
+QImage MapFrame::image(QString name) const {
+  QJsonObject entry = header["maps"].toObject()[name].toObject();
+  int width = entry["width"].toInt(), height = entry["height"].toInt();
+  int channels = entry["channels"].toInt(4);
+  int offset = entry["offset"].toInt();
+  QImage::Format format = channels == 1   ? QImage::Format_Grayscale8
+                          : channels == 3 ? QImage::Format_RGB888
+                                          : QImage::Format_RGBA8888;
+  int rowBytes = width * channels;
+  if (width <= 0 || height <= 0 || (channels != 1 && channels != 3 &&
+                                    channels != 4) || offset < 0 ||
+      static_cast<qint64>(offset) + static_cast<qint64>(rowBytes) * height >
+          payload.size())
+    return QImage();
+  QImage img(width, height, format);
+  for (int y = 0; y < height; y++)
+    memcpy(img.scanLine(y), payload.constData() + offset + y * rowBytes,
+           static_cast<size_t>(rowBytes));
+  return img;
+}
+
+QByteArray MapFrame::encode() const {
+  QByteArray json = QJsonDocument(header).toJson(QJsonDocument::Compact);
+  QByteArray data(prefixSize, 0);
+  uchar *p = reinterpret_cast<uchar *>(data.data());
+  memcpy(p, magic, 4);
+  qToBigEndian(static_cast<quint32>(json.size()), p + 4);
+  qToBigEndian(static_cast<quint64>(payload.size()), p + 8);
+  return data + json + payload;
+}
+
+bool MapFrame::write(QIODevice *device) const {
+  QByteArray data = encode();
+  return device->write(data) == data.size();
+}
+
+/* Takes one complete frame off the front of buffer. Returns false while
+ * more bytes are needed, or with *error set when the data is not a frame. */
+bool MapFrame::decode(QByteArray &buffer, MapFrame *frame, bool *error) {
+  *error = false;
+  if (buffer.size() < prefixSize)
+    return false;
+  const uchar *p = reinterpret_cast<const uchar *>(buffer.constData());
+  if (memcmp(p, magic, 4) != 0) {
+    *error = true;
+    return false;
+  }
+  quint32 headerSize = qFromBigEndian<quint32>(p + 4);
+  quint64 payloadSize = qFromBigEndian<quint64>(p + 8);
+  quint64 total = prefixSize + headerSize + payloadSize;
+  if (total > static_cast<quint64>(INT_MAX)) {
+    *error = true;
+    return false;
+  }
+  if (static_cast<quint64>(buffer.size()) < total)
+    return false;
+
+  QJsonParseError parseError;
+  QJsonDocument doc = QJsonDocument::fromJson(
+      buffer.mid(prefixSize, static_cast<int>(headerSize)), &parseError);
+  if (parseError.error != QJsonParseError::NoError || !doc.isObject()) {
+    *error = true;
+    return false;
+  }
+  frame->header = doc.object();
+  frame->payload = buffer.mid(prefixSize + static_cast<int>(headerSize),
+                              static_cast<int>(payloadSize));
+  buffer.remove(0, static_cast<int>(total));
+  return true;
+}
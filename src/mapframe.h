@@ -0,0 +1,47 @@
+/*
+ * Laigter: an automatic map generator for lighting effects.
+ * Copyright (C) 2019  Pablo Ivan Fonovich
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ * Contact: azagaya.games@gmail.com
+ */
+
+#ifndef MAPFRAME_H
+#define MAPFRAME_H
+
+#include <QByteArray>
+#include <QIODevice>
+#include <QImage>
+#include <QJsonObject>
+#include <QString>
+
+/* A JSON header plus a binary payload, the unit exchanged with the map
+ * server and written by the --stdin mode. On the wire: "LGTF", header size
+ * (u32 BE), payload size (u64 BE), header, payload.
+ *
+ * Images in the payload are raw planes with tightly packed rows, described
+ * by header["maps"][name] = {width, height, channels, offset, size}. */
+class MapFrame {
+public:
+  QJsonObject header;
+  QByteArray payload;
+
+  void add_image(QString name, const QImage &image);
+  QImage image(QString name) const;
+  QByteArray encode() const;
+  bool write(QIODevice *device) const;
+  static bool decode(QByteArray &buffer, MapFrame *frame, bool *error);
+};
+
+#endif // MAPFRAME_H
@@ -0,0 +1,292 @@
+/*
+ * Laigter: an automatic map generator for lighting effects.
+ * Copyright (C) 2019  Pablo Ivan Fonovich
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ * Contact: azagaya.games@gmail.com
+ */
+
+#include "mapserver.h"
+#include <QCryptographicHash>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QJsonArray>
+#include <QLocalSocket>
+#include <QRunnable>
+#include <QThread>
+
+/* Largest raw payload image accepted, 1 GiB of RGBA8888 */
+static const qint64 maxPixels = 16384 * 16384;
+
+class MapRequestJob : public QRunnable {
+public:
+  MapRequestJob(MapServer *server, int connection, MapFrame request)
+      : server(server), connection(connection), request(request) {}
+
+  void run() override {
+    QByteArray reply = server->handle(request).encode();
+    QMetaObject::invokeMethod(server, "send_reply", Qt::QueuedConnection,
+                              Q_ARG(int, connection), Q_ARG(QByteArray, reply));
+  }
+
+private:
+  MapServer *server;
+  int connection;
+  MapFrame request;
+};
+
+MapServer::MapServer(QObject *parent) : QObject(parent) {
+  nextConnection = 0;
+  root = QDir::current().canonicalPath();
+  /* Idle processors belong to the thread that created them, so pool threads
+   * must live as long as the server. */
+  pool.setExpiryTimeout(-1);
+  connect(&server, SIGNAL(newConnection()), this, SLOT(new_connection()));
+}
+
+MapServer::~MapServer() {
+  /* Pool threads run no event loop, so once they are done nothing can be
+   * pending on their processors and deleting them here is safe. */
+  pool.waitForDone();
+  foreach (auto list, idle) {
+    foreach (auto entry, list)
+      delete entry.second;
+  }
+}
+
+bool MapServer::listen(QString name) {
+  QLocalServer::removeServer(name);
+  return server.listen(name);
+}
+
+QString MapServer::error_string() { return server.errorString(); }
+
+bool MapServer::set_root(QString path) {
+  QString canonical = QDir(path).canonicalPath();
+  if (canonical.isEmpty())
+    return false;
+  root = canonical;
+  return true;
+}
+
+/* Absolute path of a file inside the root, or an empty string when it falls
+ * outside. Relative paths are taken from the root. Symbolic links are
+ * resolved first, of the file itself when it must exist, or of its
+ * directory otherwise. */
+QString MapServer::inside_root(QString path, bool existing) {
+  QFileInfo info(QDir(root).absoluteFilePath(path));
+  QString resolved;
+  if (existing) {
+    resolved = info.canonicalFilePath();
+  } else {
+    QString dir = info.dir().canonicalPath();
+    if (!dir.isEmpty())
+      resolved = QDir(dir).filePath(info.fileName());
+  }
+  QString prefix = root.endsWith('/') ? root : root + '/';
+  if (resolved.isEmpty() || !resolved.startsWith(prefix))
+    return QString();
+  return resolved;
+}
+
+void MapServer::set_max_threads(int n) {
+  pool.setMaxThreadCount(n > 0 ? n : QThread::idealThreadCount());
+}
+
+void MapServer::new_connection() {
+  while (server.hasPendingConnections()) {
+    QLocalSocket *socket = server.nextPendingConnection();
+    int id = nextConnection++;
+    connections[id] = socket;
+    socket->setProperty("connection", id);
+    connect(socket, SIGNAL(readyRead()), this, SLOT(read_request()));
+    connect(socket, SIGNAL(disconnected()), socket, SLOT(deleteLater()));
+    connect(socket, &QLocalSocket::destroyed, this, [this, socket, id]() {
+      connections.remove(id);
+      buffers.remove(socket);
+    });
+  }
+}
+
+void MapServer::read_request() {
+  QLocalSocket *socket = qobject_cast<QLocalSocket *>(sender());
+  if (!socket)
+    return;
+  QByteArray &buffer = buffers[socket];
+  buffer += socket->readAll();
+  int connection = socket->property("connection").toInt();
+  MapFrame request;
+  bool error;
+  while (MapFrame::decode(buffer, &request, &error)) {
+    pool.start(new MapRequestJob(this, connection, request));
+  }
+  if (error) {
+    MapFrame reply;
+    reply.header["ok"] = false;
+    reply.header["error"] = "malformed request";
+    reply.write(socket);
+    socket->disconnectFromServer();
+  }
+}
+
+void MapServer::send_reply(int connection, QByteArray reply) {
+  QLocalSocket *socket = connections.value(connection);
+  if (socket)
+    socket->write(reply);
+}
+
+PresetSettings MapServer::preset(QString fileName, QStringList *errors) {
+  QFileInfo info(fileName);
+  QMutexLocker locker(&mutex);
+  if (presets.contains(fileName) &&
+      presets[fileName].first == info.lastModified())
+    return presets[fileName].second;
+  PresetSettings settings = PresetSettings::load(fileName, errors);
+  if (errors->isEmpty())
+    presets[fileName] = qMakePair(info.lastModified(), settings);
+  return settings;
+}
+
+/* Processors are QObjects, and only ever used on the thread that has their
+ * affinity: the one that created them. */
+ImageProcessor *MapServer::take_processor(QByteArray key, bool *warm) {
+  QMutexLocker locker(&mutex);
+  auto &list = idle[QThread::currentThread()];
+  for (int i = list.size() - 1; i >= 0; i--) {
+    if (list[i].first == key) {
+      *warm = true;
+      return list.takeAt(i).second;
+    }
+  }
+  *warm = false;
+  return new ImageProcessor();
+}
+
+/* At most two idle processors per thread are kept, the one used least
+ * recently is deleted first. */
+void MapServer::give_back(QByteArray key, ImageProcessor *processor) {
+  QMutexLocker locker(&mutex);
+  auto &list = idle[QThread::currentThread()];
+  list.append(qMakePair(key, processor));
+  if (list.size() > 2)
+    delete list.takeFirst().second;
+}
+
+MapFrame MapServer::handle(MapFrame request) {
+  MapFrame reply;
+  QJsonObject h = request.header;
+  reply.header["id"] = h["id"];
+
+  BatchOptions options;
+  QString presetPath = h["preset"].toString();
+  if (!presetPath.isEmpty()) {
+    QStringList errors;
+    options.preset = preset(presetPath, &errors);
+    if (!errors.isEmpty()) {
+      reply.header["ok"] = false;
+      reply.header["error"] = errors.join("; ");
+      return reply;
+    }
+  }
+  foreach (QJsonValue v, h["maps"].toArray()) {
+    QString m = v.toString();
+    options.normal |= m == "n";
+    options.specular |= m == "s";
+    options.occlusion |= m == "o";
+    options.parallax |= m == "p";
+    options.cone |= m == "c";
+  }
+  options.packedLayout = h["packed"].toString();
+  options.dds = h.contains("dds");
+  options.blockQuality = h["dds"].toString() == "quality"
+                             ? BlockQuality::Quality
+                             : BlockQuality::Fast;
+  BatchProcessor batch(options);
+
+  bool replyPixels = h["reply"].toString() == "pixels";
+  QString name = h["input"].toString();
+  QImage image;
+  if (!name.isEmpty()) {
+    name = inside_root(name, true);
+    if (name.isEmpty()) {
+      reply.header["ok"] = false;
+      reply.header["error"] = "input outside the root directory";
+      return reply;
+    }
+    bool success;
+    ImageLoader il;
+    image = il.loadImage(name, &success);
+  } else if (h["encoded"].toBool()) {
+    image = QImage::fromData(request.payload);
+  } else {
+    int width = h["width"].toInt(), height = h["height"].toInt();
+    qint64 pixels = static_cast<qint64>(width) * height;
+    if (width > 0 && height > 0 && pixels > maxPixels) {
+      reply.header["ok"] = false;
+      reply.header["error"] = "image too large";
+      return reply;
+    }
+    if (width > 0 && height > 0 && request.payload.size() >= pixels * 4) {
+      const uchar *pixels =
+          reinterpret_cast<const uchar *>(request.payload.constData());
+      image = QImage(pixels, width, height, width * 4, QImage::Format_RGBA8888)
+                  .copy();
+    }
+  }
+  if (name.isEmpty()) {
+    name = h["name"].toString("image.png");
+    if (!replyPixels)
+      name = inside_root(name, false);
+    if (name.isEmpty()) {
+      reply.header["ok"] = false;
+      reply.header["error"] = "output outside the root directory";
+      return reply;
+    }
+  }
+  if (image.isNull()) {
+    reply.header["ok"] = false;
+    reply.header["error"] = "cannot load image";
+    return reply;
+  }
+
+  QByteArray key =
+      QCryptographicHash::hash(options.preset.data(), QCryptographicHash::Sha1);
+  bool warm;
+  ImageProcessor *processor = take_processor(key, &warm);
+  QString error;
+  if (!batch.load_image(name, image, processor, &error, !warm)) {
+    delete processor;
+    reply.header["ok"] = false;
+    reply.header["error"] = error;
+    return reply;
+  }
+
+  bool ok = true;
+  if (replyPixels) {
+    foreach (QString postfix, batch.requested_maps())
+      reply.add_image(postfix.mid(1), batch.map_image(processor, postfix));
+  } else {
+    ok = batch.export_maps(processor, &error);
+    QJsonObject paths;
+    foreach (QString postfix, batch.requested_maps())
+      paths[postfix.mid(1)] = batch.output_name(name, postfix);
+    reply.header["paths"] = paths;
+  }
+  give_back(key, processor);
+  reply.header["ok"] = ok;
+  if (!ok)
+    reply.header["error"] = error;
+  return reply;
+}
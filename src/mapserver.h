@@ -0,0 +1,98 @@
+/*
+ * Laigter: an automatic map generator for lighting effects.
+ * Copyright (C) 2019  Pablo Ivan Fonovich
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ * Contact: azagaya.games@gmail.com
+ */
+
+#ifndef MAPSERVER_H
+#define MAPSERVER_H
+
+#include <QByteArray>
+#include <QDateTime>
+#include <QHash>
+#include <QList>
+#include <QLocalServer>
+#include <QMutex>
+#include <QObject>
+#include <QPair>
+#include <QThreadPool>
+
+#include "src/batchprocessor.h"
+#include "src/mapframe.h"
+
+class QLocalSocket;
+class QThread;
+
+/* Long running map generation over a local socket (--daemon). Clients send
+ * MapFrame requests and get one MapFrame reply per request, tagged with the
+ * request "id". Requests run concurrently on a bounded pool, and processors
+ * are kept per preset so a repeated request skips applying it again. Idle
+ * processors stay with the pool thread that created them and only the two
+ * used last on each thread are kept. Raw payloads are limited to
+ * 16384 x 16384 pixels. Input files are read and maps written only inside
+ * the root directory (the working directory unless set_root is called);
+ * other paths are refused.
+ *
+ * Request header:
+ *   input     path of the diffuse texture, or
+ *   width,
+ *   height    size of raw RGBA8888 pixels sent as the payload, or
+ *   encoded   true when the payload is an encoded image file
+ *   name      file name used for outputs of payload inputs
+ *   preset    preset file path
+ *   maps      any of "n", "s", "o", "p", "c"
+ *   packed    packed channel layout, e.g. "osp"
+ *   dds       "fast" or "quality" to write block compressed maps
+ *   reply     "paths" (default) to write files, "pixels" to get raw planes
+ *
+ * Reply header: id, ok, error, paths {map: file} or maps (see MapFrame). */
+class MapServer : public QObject {
+  Q_OBJECT
+public:
+  explicit MapServer(QObject *parent = nullptr);
+  ~MapServer();
+
+  bool listen(QString name);
+  QString error_string();
+  void set_max_threads(int n);
+  bool set_root(QString path);
+
+  MapFrame handle(MapFrame request);
+
+private slots:
+  void new_connection();
+  void read_request();
+  void send_reply(int connection, QByteArray reply);
+
+private:
+  PresetSettings preset(QString fileName, QStringList *errors);
+  ImageProcessor *take_processor(QByteArray key, bool *warm);
+  void give_back(QByteArray key, ImageProcessor *processor);
+  QString inside_root(QString path, bool existing);
+
+  QLocalServer server;
+  QThreadPool pool;
+  QString root;
+  int nextConnection;
+  QHash<int, QLocalSocket *> connections;
+  QHash<QLocalSocket *, QByteArray> buffers;
+
+  QMutex mutex;
+  QHash<QString, QPair<QDateTime, PresetSettings>> presets;
+  QHash<QThread *, QList<QPair<QByteArray, ImageProcessor *>>> idle;
+};
+
+#endif // MAPSERVER_H
@@ -18,16 +18,21 @@
  */
 
 #include "openglwidget.h"
+#include "src/shaderloader.h"
 #include <QApplication>
 #include <QDebug>
-#include <QFileInfo>
+#include <QOpenGLExtraFunctions>
 #include <QOpenGLFramebufferObject>
 #include <QOpenGLVersionProfile>
 #include <QOpenGLVertexArrayObject>
 #include <QPainter>
+#include <cstring>
 #include <math.h>
 
-OpenGlWidget::OpenGlWidget(QWidget *parent) {
+OpenGlWidget::OpenGlWidget(QWidget *parent)
+    : pixelBuffer(QOpenGLBuffer::PixelUnpackBuffer),
+      spriteVariants(":/shaders/vshader.glsl", ":/shaders/fshader.glsl",
+                     ShaderVariants::sprite_samplers(), &lightBuffer) {
   m_zoom = 1.0;
 
   laigter = QImage(":/images/laigter-texture.png");
@@ -37,6 +42,10 @@ OpenGlWidget::OpenGlWidget(QWidget *parent) {
   m_light = true;
   m_parallax = false;
   parallax_height = 0.03;
+  parallaxLayers = 32;
+  coneStep = false;
+  deferred = deferredReady = gBufferPass = false;
+  gBuffer = nullptr;
   //    processor->set_tile_x(false);
   //    processor->set_tile_y(false);
   m_pixelated = false;
@@ -59,14 +68,9 @@ OpenGlWidget::OpenGlWidget(QWidget *parent) {
 
   pixelSize = 3;
 
-  refreshTimer.setInterval(1.0 / 30.0 * 1000.0);
-  refreshTimer.setSingleShot(false);
-
-  connect(&refreshTimer, SIGNAL(timeout()), this, SLOT(force_update()));
-
-  refreshTimer.start();
-
   need_to_update = true;
+  frameTimesVisible = false;
+  frameTime = latency = frameInterval = 0;
   export_render = false;
   exportFullView = false;
 
@@ -79,6 +83,14 @@ OpenGlWidget::OpenGlWidget(QWidget *parent) {
   sample_light_list_used = true;
 }
 
+/* The sprite batch owns textures of this widget's context, release them
+ * while it can still be made current */
+OpenGlWidget::~OpenGlWidget() {
+  makeCurrent();
+  batch.release();
+  doneCurrent();
+}
+
 void OpenGlWidget::initializeGL() {
   initializeOpenGLFunctions();
   glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
@@ -91,26 +103,62 @@ void OpenGlWidget::initializeGL() {
   setUpdateBehavior(QOpenGLWidget::PartialUpdate);
 
   m_program.create();
-  m_program.addShaderFromSourceFile(QOpenGLShader::Vertex,
-                                    ":/shaders/vshader.glsl");
-  m_program.addShaderFromSourceFile(QOpenGLShader::Fragment,
-                                    ":/shaders/fshader.glsl");
-  m_program.link();
+  if (!ShaderLoader::build(&m_program, ":/shaders/vshader.glsl",
+                           ":/shaders/fshader.glsl"))
+    qWarning() << m_program.log();
 
   lightProgram.create();
-  lightProgram.addShaderFromSourceFile(QOpenGLShader::Vertex,
-                                       ":/shaders/lvshader.glsl");
-  lightProgram.addShaderFromSourceFile(QOpenGLShader::Fragment,
-                                       ":/shaders/lfshader.glsl");
-  m_program.link();
+  if (!ShaderLoader::build(&lightProgram, ":/shaders/lvshader.glsl",
+                           ":/shaders/lfshader.glsl"))
+    qWarning() << lightProgram.log();
+
+  lightBuffer.init();
+  lightBuffer.attach(&m_program);
+
+  /* The G-buffer takes several render targets and the light quads are
+   * instanced, so deferred lighting needs the GLSL 3.30 programs */
+  if (ShaderLoader::modern()) {
+    ambientProgram.create();
+    deferredLightProgram.create();
+    deferredReady =
+        ShaderLoader::build(&ambientProgram, ":/shaders/dvshader.glsl",
+                            ":/shaders/dfshader.glsl", "#define AMBIENT\n") &&
+        ShaderLoader::build(&deferredLightProgram, ":/shaders/dvshader.glsl",
+                            ":/shaders/dfshader.glsl");
+    if (!deferredReady)
+      qWarning() << ambientProgram.log() << deferredLightProgram.log();
+  }
+  if (deferredReady) {
+    QStringList buffers = QStringList() << "albedoBuffer"
+                                        << "normalBuffer"
+                                        << "specularBuffer"
+                                        << "occlusionBuffer";
+    foreach (QOpenGLShaderProgram *program,
+             QList<QOpenGLShaderProgram *>() << &ambientProgram
+                                             << &deferredLightProgram) {
+      lightBuffer.attach(program);
+      program->bind();
+      for (int i = 0; i < buffers.count(); i++)
+        program->setUniformValue(buffers[i].toUtf8().constData(), i);
+      program->release();
+    }
+  }
+
+  /* Samplers never change units, and the rest of the per sprite uniforms
+   * are set through locations looked up once, see sprite_uniforms() */
+  QStringList samplers = ShaderVariants::sprite_samplers();
+  m_program.bind();
+  for (int i = 0; i < samplers.count(); i++)
+    m_program.setUniformValue(samplers[i].toUtf8().constData(), i);
+  m_program.release();
 
   // set up vertex data (and buffer(s)) and configure vertex attributes
   // ------------------------------------------------------------------
   float vertices[] = {
       -1.0f, -1.0f, 0.0f, 0.0f, 1.0f, // bot left
       1.0f,  -1.0f, 0.0f, 1.0f, 1.0f, // bot right
-      1.0f,  1.0f,  0.0f, 1.0f, 0.0f, // top right
-      -1.0f, 1.0f,  0.0f, 0.0f, 0.0f  // top left
+      -1.0f, 1.0f,  0.0f, 0.0f, 0.0f, // top left
+      1.0f,  1.0f,  0.0f, 1.0f, 0.0f  // top right
   };
 
   // bind the Vertex Array Object first, then bind and set vertex buffer(s), and
@@ -151,30 +199,192 @@ void OpenGlWidget::initializeGL() {
   lightVAO.release();
   VBO.release();
 
+  batch.init(&VBO, &lightBuffer);
+
   initialized();
 }
 
 void OpenGlWidget::loadTextures() {
   processor = processorList.at(0);
-  m_image = processor->get_texture();
-  parallaxMap = processor->get_parallax();
-  specularMap = processor->get_specular();
-  normalMap = processor->get_normal();
-  occlusionMap = processor->get_occlusion();
-  m_texture = new QOpenGLTexture(*m_image);
+  use_textures(processor);
+  laigterTexture = new QOpenGLTexture(laigter);
+}
+
+/* Makes the processor's texture set current, uploading only the maps that
+ * changed since they were last drawn. Needs the context to be current. */
+void OpenGlWidget::use_textures(ImageProcessor *p) {
+  if (!textureSets.contains(p))
+    connect(p, SIGNAL(destroyed(QObject *)), this,
+            SLOT(processor_destroyed(QObject *)));
+  ProcessorTextures &set = textureSets[p];
+  QMap<ProcessedImage, quint64> uploaded = set.revisions;
+  foreach (ProcessedImage map, p->changed_maps(set.revisions)) {
+    QRect dirty = uploaded.contains(map)
+                      ? p->dirty_rect(map, uploaded[map])
+                      : QRect();
+    switch (map) {
+    case ProcessedImage::Raw:
+      upload(set.texture, p->get_texture(), dirty, set.staleMipMaps);
+      break;
+    case ProcessedImage::Normal:
+      upload(set.normal, p->get_normal(), dirty, set.staleMipMaps);
+      break;
+    case ProcessedImage::Parallax:
+      upload(set.parallax, p->get_parallax(), dirty, set.staleMipMaps);
+      break;
+    case ProcessedImage::Specular:
+      upload(set.specular, p->get_specular(), dirty, set.staleMipMaps);
+      break;
+    case ProcessedImage::Occlusion:
+      upload(set.occlusion, p->get_occlusion(), dirty, set.staleMipMaps);
+      break;
+    case ProcessedImage::ConeStep:
+      /* The cone map is only built once parallax needs it, until then bind
+       * a texel of zero cone, which never steps away from the surface */
+      if (p->get_cone()->isNull()) {
+        QImage placeholder(1, 1, QImage::Format_Grayscale8);
+        placeholder.fill(0);
+        upload(set.cone, &placeholder, QRect(), set.staleMipMaps);
+      } else {
+        upload(set.cone, p->get_cone(), dirty, set.staleMipMaps);
+      }
+    }
+  }
+
+  /* Mipmaps are only sampled when the sprite is drawn smaller than its
+   * size, rebuild them then instead of after every edit */
+  if (is_minified(p)) {
+    foreach (QOpenGLTexture *t, set.staleMipMaps)
+      t->generateMipMaps();
+    set.staleMipMaps.clear();
+  }
+
+  m_texture = set.texture;
+  m_normalTexture = set.normal;
+  m_parallaxTexture = set.parallax;
+  m_specularTexture = set.specular;
+  m_occlusionTexture = set.occlusion;
+  m_coneTexture = set.cone;
+  use_image(p);
+
+  /* The textures keep their parameters between frames, set them on each
+   * one instead of on whatever happens to be bound */
+  QOpenGLTexture::Filter min = m_pixelated
+                                   ? QOpenGLTexture::NearestMipMapNearest
+                                   : QOpenGLTexture::LinearMipMapLinear;
+  QOpenGLTexture::Filter mag =
+      m_pixelated ? QOpenGLTexture::Nearest : QOpenGLTexture::Linear;
+  QOpenGLTexture::WrapMode wrap = p->get_tile_x() || p->get_tile_y()
+                                      ? QOpenGLTexture::Repeat
+                                      : QOpenGLTexture::ClampToBorder;
+  foreach (QOpenGLTexture *t, QList<QOpenGLTexture *>()
+                                  << set.texture << set.normal << set.parallax
+                                  << set.specular << set.occlusion
+                                  << set.cone) {
+    t->setMinMagFilters(min, mag);
+    t->setWrapMode(wrap);
+  }
+}
+
+/* Whether the sprite covers fewer device pixels than it has texels. A texel
+ * is drawn zoom logical pixels wide, tiled or not. */
+bool OpenGlWidget::is_minified(ImageProcessor *p) {
+  QSizeF shown =
+      QSizeF(p->get_texture()->size()) * p->get_zoom() * devicePixelRatioF();
+  return shown.width() < p->get_texture()->width() ||
+         shown.height() < p->get_texture()->height();
+}
+
+/* Points the current maps and sprite scale at the processor's images */
+void OpenGlWidget::use_image(ImageProcessor *p) {
+  m_image = p->get_texture();
+  normalMap = p->get_normal();
+  parallaxMap = p->get_parallax();
+  specularMap = p->get_specular();
+  occlusionMap = p->get_occlusion();
+  sx = (float)m_image->width() / width();
+  sy = (float)m_image->height() / height();
   pixelsX = m_image->width();
   pixelsY = m_image->height();
-  m_parallaxTexture = new QOpenGLTexture(*parallaxMap);
-  m_specularTexture = new QOpenGLTexture(*specularMap);
-  m_normalTexture = new QOpenGLTexture(*normalMap);
-  m_occlusionTexture = new QOpenGLTexture(*occlusionMap);
-  laigterTexture = new QOpenGLTexture(laigter);
+}
+
+/* Uploads rect of image into texture, or all of it when rect is null. A
+ * texture of the same size is updated in place through a pixel buffer so
+ * small edits only move the changed rows; anything else is re-created. */
+void OpenGlWidget::upload(QOpenGLTexture *&texture, QImage *image, QRect rect,
+                          QSet<QOpenGLTexture *> &staleMipMaps) {
+  if (!texture || !texture->isCreated() ||
+      texture->width() != image->width() ||
+      texture->height() != image->height()) {
+    if (!texture)
+      texture = new QOpenGLTexture(QOpenGLTexture::Target2D);
+    if (texture->isCreated())
+      texture->destroy();
+    texture->create();
+    texture->setData(*image);
+    staleMipMaps.remove(texture);
+    return;
+  }
+
+  if (rect.isNull())
+    rect = image->rect();
+  QImage region = image->copy(rect).convertToFormat(QImage::Format_RGBA8888);
+  int rowBytes = region.width() * 4;
+  int size = rowBytes * region.height();
+
+  if (!pixelBuffer.isCreated() && pixelBuffer.create())
+    pixelBuffer.setUsagePattern(QOpenGLBuffer::StreamDraw);
+  uchar *mapped = nullptr;
+  if (pixelBuffer.isCreated() && pixelBuffer.bind()) {
+    /* Reallocating orphans the storage still read by earlier uploads */
+    pixelBuffer.allocate(size);
+    mapped =
+        static_cast<uchar *>(pixelBuffer.map(QOpenGLBuffer::WriteOnly));
+    if (!mapped)
+      pixelBuffer.release();
+  }
+  /* With a bound pixel buffer the pointer is an offset into it */
+  const uchar *pixels = region.constBits();
+  if (mapped) {
+    for (int y = 0; y < region.height(); y++)
+      memcpy(mapped + y * rowBytes, region.constScanLine(y), rowBytes);
+    pixelBuffer.unmap();
+    pixels = nullptr;
+  }
+
+  texture->bind();
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+  glTexSubImage2D(GL_TEXTURE_2D, 0, rect.x(), rect.y(), rect.width(),
+                  rect.height(), GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+  texture->release();
+  if (mapped)
+    pixelBuffer.release();
+  staleMipMaps.insert(texture);
+}
+
+void OpenGlWidget::processor_destroyed(QObject *object) {
+  ImageProcessor *p = static_cast<ImageProcessor *>(object);
+  if (!textureSets.contains(p))
+    return;
+  ProcessorTextures set = textureSets.take(p);
+  makeCurrent();
+  delete set.texture;
+  delete set.normal;
+  delete set.parallax;
+  delete set.specular;
+  delete set.occlusion;
+  delete set.cone;
+  doneCurrent();
 }
 
 void OpenGlWidget::paintGL() {
   if (need_to_update) {
     need_to_update = false;
+    QElapsedTimer renderTimer;
+    renderTimer.start();
     update_scene();
+    if (frameTimesVisible)
+      draw_frame_times(renderTimer.nsecsElapsed());
   }
   if (export_render) {
     export_render = false;
@@ -187,10 +397,46 @@ void OpenGlWidget::update() {
   QOpenGLWidget::update();
 }
 
-void OpenGlWidget::force_update() {
+/* Marks the scene dirty and schedules a repaint. Requests made before the
+ * next frame are coalesced by Qt into a single paint, synced to the
+ * display, and nothing is drawn while nothing changes. */
+void OpenGlWidget::request_update() {
+  if (!need_to_update) {
+    need_to_update = true;
+    requestTimer.start();
+  }
+  update();
+}
+
+/* Shows how long the last frame took to render on the CPU, the time from
+ * the first change request to its paint, and the time between frames */
+void OpenGlWidget::set_frame_times_visible(bool visible) {
+  frameTimesVisible = visible;
+  request_update();
+}
 
-  if (need_to_update)
-    update();
+void OpenGlWidget::draw_frame_times(qint64 renderNsecs) {
+  /* Smoothed so the numbers stay readable while dragging */
+  const double k = 0.2;
+  frameTime += k * (renderNsecs / 1e6 - frameTime);
+  if (requestTimer.isValid())
+    latency += k * (requestTimer.nsecsElapsed() / 1e6 - latency);
+  if (frameTimer.isValid())
+    frameInterval += k * (frameTimer.nsecsElapsed() / 1e6 - frameInterval);
+  frameTimer.start();
+
+  QPainter painter(this);
+  painter.setPen(Qt::white);
+  painter.drawText(rect().adjusted(8, 8, -8, -8), Qt::AlignTop | Qt::AlignLeft,
+                   tr("frame %1 ms\nlatency %2 ms\ninterval %3 ms")
+                       .arg(frameTime, 0, 'f', 2)
+                       .arg(latency, 0, 'f', 2)
+                       .arg(frameInterval, 0, 'f', 2));
+  painter.end();
+
+  /* QPainter leaves its own blending state behind */
+  glEnable(GL_BLEND);
+  glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 }
 
 void OpenGlWidget::update_scene() {
@@ -204,233 +450,322 @@ void OpenGlWidget::update_scene() {
   double r, g, b;
   GLfloat bkColor[4];
   glGetFloatv(GL_COLOR_CLEAR_VALUE, bkColor);
-
-  int i1 = m_pixelated ? GL_NEAREST_MIPMAP_NEAREST : GL_LINEAR_MIPMAP_LINEAR;
-  int i2 = m_pixelated ? GL_NEAREST : GL_LINEAR;
+  QVector3D outlineColor(bkColor[0], bkColor[1], bkColor[2]);
 
   QMatrix4x4 transform;
 
-  foreach (ImageProcessor *processor, processorList) {
-    setImage(&processor->texture);
-    setNormalMap(processor->get_normal());
-    setSpecularMap(processor->get_specular());
-    setParallaxMap(processor->get_parallax());
-    setOcclusionMap(processor->get_occlusion());
-    transform.setToIdentity();
-    QVector3D texPos = *processor->get_position();
-    if (processor->get_tile_x())
-      texPos.setX(0);
-    if (processor->get_tile_y())
-      texPos.setY(0);
-    transform.translate(texPos);
-    float scaleX = !processor->get_tile_x() ? sx : 1;
-    float scaleY = !processor->get_tile_y() ? sy : 1;
-    transform.scale(scaleX, scaleY, 1);
-    float zoomX = !processor->get_tile_x() ? processor->get_zoom() : 1;
-    float zoomY = !processor->get_tile_y() ? processor->get_zoom() : 1;
-    transform.scale(zoomX, zoomY, 1);
-
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, i1);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, i2);
-
-    /* Start first pass */
-
-    m_program.bind();
-
-    VAO.bind();
-
-    if (processor->get_tile_x() || processor->get_tile_y()) {
-      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-    } else {
-      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
-      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
-    }
+  /* With deferred lighting the sprites only leave their surfaces in the
+   * G-buffer, and are lit after all of them are drawn */
+  gBufferPass = begin_gbuffer();
 
-    glActiveTexture(GL_TEXTURE0);
-    m_program.setUniformValue("light", m_light);
-    switch (viewmode) {
-    case Preview:
-    case Texture:
-      m_texture->bind(0);
-      break;
-    case NormalMap:
-      m_normalTexture->bind(0);
-      break;
-    case ParallaxMap:
-      m_parallaxTexture->bind(0);
-      break;
-    case SpecularMap:
-      m_specularTexture->bind(0);
-      break;
-    case OcclusionMap:
-      m_occlusionTexture->bind(0);
+  /* Consecutive untiled sprites are drawn together with one instanced call,
+   * tiled ones, or all of them without batching support, one by one */
+  QList<ImageProcessor *> batched;
+  if (batch.is_ready()) {
+    foreach (ImageProcessor *processor, processorList) {
+      if (SpriteBatch::can_batch(processor))
+        batched.append(processor);
     }
-    m_program.setUniformValue("texture", 0);
-    m_program.setUniformValue("transform", transform);
-    m_program.setUniformValue("pixelsX", pixelsX);
-    m_program.setUniformValue("pixelsY", pixelsY);
-    m_program.setUniformValue("pixelSize", pixelSize);
-    m_program.setUniformValue("pixelated", m_pixelated);
-    backgroundColor.getRgbF(&r, &g, &b, nullptr);
-    color = QVector3D(bkColor[0], bkColor[1], bkColor[2]);
-    m_program.setUniformValue("outlineColor", color);
-    m_program.setUniformValue("selected", processor->get_selected());
-
-    scaleX = processor->get_tile_x() ? sx : 1;
-    scaleY = processor->get_tile_y() ? sy : 1;
-    zoomX = processor->get_tile_x() ? processor->get_zoom() : 1;
-    zoomY = processor->get_tile_y() ? processor->get_zoom() : 1;
-    m_program.setUniformValue(
-        "ratio", QVector2D(1 / scaleX / zoomX, 1 / scaleY / zoomY));
-
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, i1);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, i2);
-
-    m_normalTexture->bind(1);
-    m_program.setUniformValue("normalMap", 1);
-
-    m_parallaxTexture->bind(2);
-    m_program.setUniformValue("parallaxMap", 2);
-
-    m_specularTexture->bind(3);
-    m_program.setUniformValue("specularMap", 3);
-
-    m_occlusionTexture->bind(4);
-    m_program.setUniformValue("occlusionMap", 4);
-
-    m_program.setUniformValue("viewPos", QVector3D(0, 0, 1));
-    m_program.setUniformValue("parallax", processor->get_is_parallax() &&
-                                              viewmode == Preview);
-    m_program.setUniformValue("height_scale", parallax_height);
-
-    apply_light_params();
-    //        m_texture->bind(0);
-    glDrawArrays(GL_QUADS, 0, 4);
-
-    m_program.release();
-
-    /* Render light texture */
   }
-  QList<LightSource *> currentLightList;
-  if (sample_light_list_used) {
-    currentLightList = *sampleLightList;
-  } else {
-    foreach (ImageProcessor *processor, processorList) {
-      foreach (LightSource *l, *processor->get_light_list_ptr()) {
-        currentLightList.append(l);
-      }
+  bool batching = !batched.isEmpty() &&
+                  batch.prepare(batched, QSize(width(), height()),
+                                devicePixelRatioF(), m_pixelated);
+
+  int first = 0;
+  for (int i = 0; i < processorList.count();) {
+    if (!batching || !SpriteBatch::can_batch(processorList.at(i))) {
+      draw_sprite(processorList.at(i++), outlineColor);
+      continue;
+    }
+    int count = 0;
+    while (i < processorList.count() &&
+           SpriteBatch::can_batch(processorList.at(i))) {
+      use_image(processorList.at(i++));
+      count++;
     }
+    draw_batch(first, count, outlineColor);
+    first += count;
+  }
+
+  if (gBufferPass) {
+    gBufferPass = false;
+    draw_deferred_lights();
   }
-  if (currentLightList.count() > 0) {
+
+  /* Render light texture */
+  QList<LightSource *> currentLightList = scene_lights();
+  if (currentLightList.count() > 0 && m_light) {
+    float x = static_cast<float>(laigter.width()) / width();
+    float y = static_cast<float>(laigter.height()) / height();
+
+    lightProgram.bind();
+    lightVAO.bind();
+    laigterTexture->bind(0);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
+                    GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
+    lightProgram.setUniformValue("texture", 0);
+    lightProgram.setUniformValue("pixelSize", 3.0 / x, 3.0 / y);
+
     foreach (LightSource *light, currentLightList) {
-      float x = static_cast<float>(laigter.width()) / width();
-      float y = static_cast<float>(laigter.height()) / height();
       transform.setToIdentity();
       transform.translate(light->get_light_position());
       transform.scale(static_cast<float>(0.3) * x, static_cast<float>(0.3) * y,
                       1);
-
-      lightProgram.bind();
-      lightVAO.bind();
       lightProgram.setUniformValue("transform", transform);
-
-      laigterTexture->bind(0);
-      if (m_light) {
-
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
-                        GL_LINEAR_MIPMAP_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-        glActiveTexture(GL_TEXTURE0);
-
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
-        lightProgram.setUniformValue("texture", 0);
-        lightProgram.setUniformValue("pixelSize", 3.0 / x, 3.0 / y);
-        lightProgram.setUniformValue("selected", currentLight == light);
-        light->get_diffuse_color().getRgbF(&r, &g, &b, nullptr);
-        color = QVector3D(r, g, b);
-        lightProgram.setUniformValue("lightColor", color);
-        glDrawArrays(GL_QUADS, 0, 4);
-      }
+      lightProgram.setUniformValue("selected", currentLight == light);
+      light->get_diffuse_color().getRgbF(&r, &g, &b, nullptr);
+      color = QVector3D(r, g, b);
+      lightProgram.setUniformValue("lightColor", color);
+      glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
     }
+    lightVAO.release();
     lightProgram.release();
   }
 }
 
-void OpenGlWidget::resizeGL(int w, int h) {
-  sx = (float)m_image->width() / w;
-  sy = (float)m_image->height() / h;
-  need_to_update = true;
-}
+void OpenGlWidget::draw_sprite(ImageProcessor *processor,
+                               QVector3D outlineColor) {
+  int i1 = m_pixelated ? GL_NEAREST_MIPMAP_NEAREST : GL_LINEAR_MIPMAP_LINEAR;
+  int i2 = m_pixelated ? GL_NEAREST : GL_LINEAR;
+
+  QMatrix4x4 transform;
 
-void OpenGlWidget::setImage(QImage *image) {
-  m_image = image;
-  if (m_texture->isCreated()) {
+  use_textures(processor);
+  QVector3D texPos = *processor->get_position();
+  if (processor->get_tile_x())
+    texPos.setX(0);
+  if (processor->get_tile_y())
+    texPos.setY(0);
+  transform.translate(texPos);
+  float scaleX = !processor->get_tile_x() ? sx : 1;
+  float scaleY = !processor->get_tile_y() ? sy : 1;
+  transform.scale(scaleX, scaleY, 1);
+  float zoomX = !processor->get_tile_x() ? processor->get_zoom() : 1;
+  float zoomY = !processor->get_tile_y() ? processor->get_zoom() : 1;
+  transform.scale(zoomX, zoomY, 1);
+
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, i1);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, i2);
+
+  /* Start first pass */
+
+  bool parallax = processor->get_is_parallax() && viewmode == Preview;
+  QOpenGLShaderProgram *program = spriteVariants.get(
+      ShaderVariants::sprite_defines(m_light, scene_lights().count(),
+                                     parallax, coneStep, m_pixelated,
+                                     gBufferPass));
+  if (!program)
+    program = &m_program;
+  const SpriteUniforms &uniforms = sprite_uniforms(program);
+  program->bind();
 
-    m_texture->destroy();
+  VAO.bind();
+
+  if (processor->get_tile_x() || processor->get_tile_y()) {
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+  } else {
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
   }
-  m_texture->create();
-  m_texture->setData(*m_image);
-  sx = (float)m_image->width() / width();
-  sy = (float)m_image->height() / height();
-  pixelsX = image->width();
-  pixelsY = image->height();
+
+  glActiveTexture(GL_TEXTURE0);
+  program->setUniformValue(uniforms.light, m_light);
+  switch (viewmode) {
+  case Preview:
+  case Texture:
+    m_texture->bind(0);
+    break;
+  case NormalMap:
+    m_normalTexture->bind(0);
+    break;
+  case ParallaxMap:
+    m_parallaxTexture->bind(0);
+    break;
+  case SpecularMap:
+    m_specularTexture->bind(0);
+    break;
+  case OcclusionMap:
+    m_occlusionTexture->bind(0);
+  }
+  program->setUniformValue(uniforms.transform, transform);
+  program->setUniformValue(uniforms.pixelsX, pixelsX);
+  program->setUniformValue(uniforms.pixelsY, pixelsY);
+  program->setUniformValue(uniforms.pixelated, m_pixelated);
+  program->setUniformValue(uniforms.outlineColor, outlineColor);
+  program->setUniformValue(uniforms.selected, processor->get_selected());
+
+  scaleX = processor->get_tile_x() ? sx : 1;
+  scaleY = processor->get_tile_y() ? sy : 1;
+  zoomX = processor->get_tile_x() ? processor->get_zoom() : 1;
+  zoomY = processor->get_tile_y() ? processor->get_zoom() : 1;
+  program->setUniformValue(
+      uniforms.ratio, QVector2D(1 / scaleX / zoomX, 1 / scaleY / zoomY));
+
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, i1);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, i2);
+
+  m_normalTexture->bind(1);
+  m_parallaxTexture->bind(2);
+  m_specularTexture->bind(3);
+  m_occlusionTexture->bind(4);
+  m_coneTexture->bind(5);
+
+  program->setUniformValue(uniforms.viewPos, QVector3D(0, 0, 1));
+  program->setUniformValue(uniforms.parallax, parallax);
+  program->setUniformValue(uniforms.heightScale, parallax_height);
+  program->setUniformValue(uniforms.parallaxLayers, parallaxLayers);
+  program->setUniformValue(uniforms.coneStep, coneStep);
+
+  apply_light_params(*program);
+  //        m_texture->bind(0);
+  glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+
+  program->release();
 }
 
-void OpenGlWidget::setNormalMap(QImage *image) {
-  normalMap = image;
-  m_normalTexture->destroy();
-  m_normalTexture->create();
-  m_normalTexture->setData(*normalMap);
+/* Draws count sprites of the batch, starting at first */
+void OpenGlWidget::draw_batch(int first, int count, QVector3D outlineColor) {
+  ProcessedImage shown;
+  switch (viewmode) {
+  case NormalMap:
+    shown = ProcessedImage::Normal;
+    break;
+  case ParallaxMap:
+    shown = ProcessedImage::Parallax;
+    break;
+  case SpecularMap:
+    shown = ProcessedImage::Specular;
+    break;
+  case OcclusionMap:
+    shown = ProcessedImage::Occlusion;
+    break;
+  default:
+    shown = ProcessedImage::Raw;
+  }
+
+  QOpenGLShaderProgram *program = batch.program(
+      ShaderVariants::sprite_defines(m_light, scene_lights().count(),
+                                     viewmode == Preview, coneStep,
+                                     m_pixelated, gBufferPass));
+  program->bind();
+  batch.bind_maps(shown);
+  program->setUniformValue("light", m_light);
+  program->setUniformValue("pixelated", m_pixelated);
+  program->setUniformValue("outlineColor", outlineColor);
+  program->setUniformValue("viewPos", QVector3D(0, 0, 1));
+  program->setUniformValue("parallax", viewmode == Preview);
+  program->setUniformValue("height_scale", parallax_height);
+  program->setUniformValue("parallaxLayers", parallaxLayers);
+  program->setUniformValue("coneStep", coneStep);
+  apply_light_params(*program);
+  batch.draw(first, count);
+  program->release();
 }
 
-void OpenGlWidget::setOcclusionMap(QImage *image) {
-  occlusionMap = image;
-  m_occlusionTexture->destroy();
-  m_occlusionTexture->create();
-  m_occlusionTexture->setData(*occlusionMap);
+/* Size of the view in device pixels, which the G-buffer and the light
+ * radii are measured in */
+QSize OpenGlWidget::device_size() { return size() * devicePixelRatioF(); }
+
+/* Binds the G-buffer, sized to the view, when the scene is lit deferred:
+ * in the lit preview with deferred lighting on, on contexts that build its
+ * programs. Blending leaves every buffer premultiplied by the sprites'
+ * coverage in alpha, see dfshader.glsl. */
+bool OpenGlWidget::begin_gbuffer() {
+  if (!deferred || !deferredReady || !m_light || viewmode != Preview)
+    return false;
+  QSize bufferSize = device_size();
+  if (!gBuffer || gBuffer->size() != bufferSize) {
+    delete gBuffer;
+    gBuffer = new QOpenGLFramebufferObject(
+        bufferSize, QOpenGLFramebufferObject::NoAttachment, GL_TEXTURE_2D,
+        GL_RGBA8);
+    /* Normal, specular and occlusion after the texture */
+    for (int i = 0; i < 3; i++)
+      gBuffer->addColorAttachment(bufferSize, GL_RGBA8);
+  }
+  if (!gBuffer->isValid() || !gBuffer->bind())
+    return false;
+
+  static const GLenum attachments[] = {
+      GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1, GL_COLOR_ATTACHMENT2,
+      GL_COLOR_ATTACHMENT3};
+  QOpenGLContext::currentContext()->extraFunctions()->glDrawBuffers(
+      4, attachments);
+  glClearColor(0, 0, 0, 0);
+  glClear(GL_COLOR_BUFFER_BIT);
+  glBlendFuncSeparate(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA, GL_ONE,
+                      GL_ONE_MINUS_SRC_ALPHA);
+  return true;
 }
 
-void OpenGlWidget::setParallaxMap(QImage *image) {
-  parallaxMap = image;
-  m_parallaxTexture->destroy();
-  m_parallaxTexture->create();
-  m_parallaxTexture->setData(*parallaxMap);
+/* Lights the G-buffer into the view: the ambient term over the background,
+ * then each light added over the square its radius reaches, all of them in
+ * one instanced call */
+void OpenGlWidget::draw_deferred_lights() {
+  glBindFramebuffer(GL_FRAMEBUFFER, defaultFramebufferObject());
+  QVector<GLuint> buffers = gBuffer->textures();
+  for (int i = 0; i < buffers.count(); i++) {
+    glActiveTexture(GL_TEXTURE0 + static_cast<GLenum>(i));
+    glBindTexture(GL_TEXTURE_2D, buffers[i]);
+  }
+  glActiveTexture(GL_TEXTURE0);
+
+  QList<LightSource *> lights = scene_lights();
+  VAO.bind();
+  glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+  ambientProgram.bind();
+  lightBuffer.apply(&ambientProgram, lights, ambientColor, ambientIntensity,
+                    device_size());
+  glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+  ambientProgram.release();
+
+  int count = qMin(lights.count(), LightBuffer::capacity());
+  if (count > 0) {
+    glBlendFunc(GL_ONE, GL_ONE);
+    deferredLightProgram.bind();
+    deferredLightProgram.setUniformValue("viewPos", QVector3D(0, 0, 1));
+    QOpenGLContext::currentContext()->extraFunctions()->glDrawArraysInstanced(
+        GL_TRIANGLE_STRIP, 0, 4, count);
+    deferredLightProgram.release();
+  }
+  VAO.release();
+  glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 }
 
-void OpenGlWidget::setSpecularMap(QImage *image) {
-  specularMap = image;
-  m_specularTexture->destroy();
-  m_specularTexture->create();
-  m_specularTexture->setData(*specularMap);
+void OpenGlWidget::resizeGL(int w, int h) {
+  sx = (float)m_image->width() / w;
+  sy = (float)m_image->height() / h;
+  request_update();
 }
 
 void OpenGlWidget::setZoom(float zoom) {
   processor->set_zoom(zoom);
-  need_to_update = true;
+  request_update();
 }
 
 void OpenGlWidget::setTileX(bool x) {
   foreach (ImageProcessor *p, get_all_selected_processors()) {
     p->set_tile_x(x);
   }
-  need_to_update = true;
+  request_update();
 }
 
 void OpenGlWidget::setTileY(bool y) {
   foreach (ImageProcessor *p, get_all_selected_processors()) {
     p->set_tile_y(y);
   }
-  need_to_update = true;
+  request_update();
 }
 
 void OpenGlWidget::setParallax(bool p) {
   foreach (ImageProcessor *processor, get_all_selected_processors()) {
     processor->set_is_parallax(p);
   }
-  need_to_update = true;
+  request_update();
 }
 
 void OpenGlWidget::wheelEvent(QWheelEvent *event) {
@@ -443,7 +778,7 @@ void OpenGlWidget::wheelEvent(QWheelEvent *event) {
                               : -processor->get_zoom() * 0.9 * step.y());
     }
   }
-  need_to_update = true;
+  request_update();
 }
 
 void OpenGlWidget::resetZoom() {
@@ -562,7 +897,7 @@ void OpenGlWidget::mousePressEvent(QMouseEvent *event) {
         stopAddingLight();
     }
   }
-  need_to_update = true;
+  request_update();
 }
 
 void OpenGlWidget::mouseMoveEvent(QMouseEvent *event) {
@@ -573,7 +908,7 @@ void OpenGlWidget::mouseMoveEvent(QMouseEvent *event) {
 
   if (addLight) {
     update_light_position(newLightPos);
-    need_to_update = true;
+    request_update();
     return;
   }
   if (event->buttons() & Qt::LeftButton) {
@@ -591,7 +926,7 @@ void OpenGlWidget::mouseMoveEvent(QMouseEvent *event) {
         }
       }
     }
-    need_to_update = true;
+    request_update();
   } else if (event->buttons() & Qt::RightButton) {
   }
 }
@@ -618,83 +953,95 @@ void OpenGlWidget::mouseReleaseEvent(QMouseEvent *event) {
 
 void OpenGlWidget::setLight(bool light) {
   m_light = light;
-  need_to_update = true;
+  request_update();
 }
 
 void OpenGlWidget::setParallaxHeight(int height) {
   parallax_height = height / 1000.0;
-  need_to_update = true;
+  request_update();
+}
+
+void OpenGlWidget::setParallaxLayers(int layers) {
+  parallaxLayers = qBound(1, layers, 256);
+  request_update();
+}
+
+void OpenGlWidget::setConeStep(bool c) {
+  coneStep = c;
+  request_update();
 }
 
 void OpenGlWidget::setLightColor(QColor color) {
   currentLight->set_diffuse_color(color);
-  need_to_update = true;
+  request_update();
 }
 
 void OpenGlWidget::setSpecColor(QColor color) {
   currentLight->set_specular_color(color);
-  need_to_update = true;
+  request_update();
 }
 
 void OpenGlWidget::setBackgroundColor(QColor color) {
   backgroundColor = color;
-  need_to_update = true;
+  request_update();
 }
 
 void OpenGlWidget::setLightHeight(float height) {
   lightPosition = currentLight->get_light_position();
   lightPosition.setZ(height);
   currentLight->set_light_position(lightPosition);
-  need_to_update = true;
+  request_update();
+}
+
+void OpenGlWidget::setLightRadius(float radius) {
+  currentLight->set_radius(radius);
+  request_update();
 }
 
 void OpenGlWidget::setLightIntensity(float intensity) {
   currentLight->set_diffuse_intensity(intensity);
-  need_to_update = true;
+  request_update();
 }
 
 void OpenGlWidget::setSpecIntensity(float intensity) {
   currentLight->set_specular_intensity(intensity);
-  need_to_update = true;
+  request_update();
 }
 
 void OpenGlWidget::setSpecScatter(int scatter) {
   currentLight->set_specular_scatter(scatter);
-  need_to_update = true;
+  request_update();
 }
 
 void OpenGlWidget::setAmbientColor(QColor color) {
   ambientColor = color;
-  need_to_update = true;
+  request_update();
 }
 
 void OpenGlWidget::setAmbientIntensity(float intensity) {
   ambientIntensity = intensity;
-  need_to_update = true;
+  request_update();
 }
 
 void OpenGlWidget::setPixelated(bool pixelated) {
   m_pixelated = pixelated;
-  need_to_update = true;
+  request_update();
 }
 
 void OpenGlWidget::setPixelSize(int size) { pixelSize = size; }
 
+void OpenGlWidget::setDeferred(bool d) {
+  deferred = d;
+  request_update();
+}
+
 QImage OpenGlWidget::renderBuffer() { return grabFramebuffer(); }
 
 QImage OpenGlWidget::calculate_preview(bool fullPreview) {
   QImage renderedPreview;
   if (!fullPreview) {
-    QString aux;
-    QImage n;
-    QString suffix;
-    QFileInfo info;
     foreach (ImageProcessor *processor, processorList) {
-      setImage(&processor->texture);
-      setNormalMap(processor->get_normal());
-      setSpecularMap(processor->get_specular());
-      setParallaxMap(processor->get_parallax());
-      setOcclusionMap(processor->get_occlusion());
+      use_textures(processor);
 
       QOpenGLFramebufferObject frameBuffer(m_image->width(), m_image->height());
 
@@ -755,6 +1102,9 @@ QImage OpenGlWidget::calculate_preview(bool fullPreview) {
       m_occlusionTexture->bind(4);
       m_program.setUniformValue("occlusionMap", 4);
 
+      m_coneTexture->bind(5);
+      m_program.setUniformValue("coneMap", 5);
+
       float scaleX = !processor->get_tile_x() ? sx : 1;
       float scaleY = !processor->get_tile_y() ? sy : 1;
       float zoomX = !processor->get_tile_x() ? processor->get_zoom() : 1;
@@ -765,39 +1115,25 @@ QImage OpenGlWidget::calculate_preview(bool fullPreview) {
                                           -processor->get_position()->y(), 1));
       m_program.setUniformValue("parallax", processor->get_is_parallax());
       m_program.setUniformValue("height_scale", parallax_height);
+      m_program.setUniformValue("parallaxLayers", parallaxLayers);
+      m_program.setUniformValue("coneStep", coneStep);
 
       QVector3D pos(
           (lightPosition.x() - processor->get_position()->x()) / scaleX / zoomX,
           (lightPosition.y() - processor->get_position()->y()) / scaleY / zoomY,
           lightPosition.z());
 
-      apply_light_params();
+      apply_light_params(m_program);
       m_texture->bind(0);
-      glDrawArrays(GL_QUADS, 0, 4);
+      glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
 
       m_program.release();
 
       frameBuffer.release();
 
       renderedPreview = frameBuffer.toImage();
-      if (m_autosave) {
-        if (exportBasePath == "") {
-          info = QFileInfo(processor->get_name());
-          suffix = info.completeSuffix();
-          if (suffix == "")
-            suffix = "png";
-          aux = info.absoluteFilePath().remove("." + suffix) + "_v." + suffix;
-        } else {
-          info = QFileInfo(processor->get_name());
-          suffix = info.completeSuffix();
-          aux = exportBasePath + "/" + info.baseName() + "_v." + suffix;
-          int i = 1;
-          while (QFileInfo::exists(aux))
-            aux = exportBasePath + "/" + info.baseName() + "(" +
-                  QString::number(++i) + ")" + "_v." + suffix;
-        }
-        renderedPreview.save(aux);
-      }
+      if (m_autosave)
+        preview_rendered(processor, renderedPreview, exportBasePath);
     }
   } else {
     QOpenGLFramebufferObject frameBuffer(width(), height());
@@ -816,11 +1152,7 @@ QImage OpenGlWidget::calculate_preview(bool fullPreview) {
     QMatrix4x4 transform;
 
     foreach (ImageProcessor *processor, processorList) {
-      setImage(&processor->texture);
-      setNormalMap(processor->get_normal());
-      setSpecularMap(processor->get_specular());
-      setParallaxMap(processor->get_parallax());
-      setOcclusionMap(processor->get_occlusion());
+      use_textures(processor);
       transform.setToIdentity();
       QVector3D texPos = *processor->get_position();
       if (processor->get_tile_x())
@@ -904,14 +1236,19 @@ QImage OpenGlWidget::calculate_preview(bool fullPreview) {
       m_occlusionTexture->bind(4);
       m_program.setUniformValue("occlusionMap", 4);
 
+      m_coneTexture->bind(5);
+      m_program.setUniformValue("coneMap", 5);
+
       m_program.setUniformValue("viewPos", QVector3D(0, 0, 1));
       m_program.setUniformValue("parallax", processor->get_is_parallax() &&
                                                 viewmode == Preview);
       m_program.setUniformValue("height_scale", parallax_height);
+      m_program.setUniformValue("parallaxLayers", parallaxLayers);
+      m_program.setUniformValue("coneStep", coneStep);
 
-      apply_light_params();
+      apply_light_params(m_program);
       //        m_texture->bind(0);
-      glDrawArrays(GL_QUADS, 0, 4);
+      glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
 
       m_program.release();
     }
@@ -927,55 +1264,51 @@ QImage OpenGlWidget::get_preview(bool fullPreview, bool autosave,
   m_autosave = autosave;
   exportBasePath = basePath;
   export_render = true;
-  need_to_update = true;
+  request_update();
   while (export_render) {
     QApplication::processEvents();
   }
   return renderedPreview;
 }
 
-void OpenGlWidget::apply_light_params() {
-  double r, g, b;
-  QVector3D color;
+/* Lights of the sample scene, or of every sprite */
+QList<LightSource *> OpenGlWidget::scene_lights() {
+  if (sample_light_list_used)
+    return *sampleLightList;
+  QList<LightSource *> lights;
+  foreach (ImageProcessor *processor, processorList)
+    lights.append(*processor->get_light_list_ptr());
+  return lights;
+}
 
-  QList<LightSource *> currentLightList;
-  if (sample_light_list_used) {
-    currentLightList = *sampleLightList;
-  } else {
-    foreach (ImageProcessor *processor, processorList) {
-      foreach (LightSource *l, *processor->get_light_list_ptr()) {
-        currentLightList.append(l);
-      }
-    }
-  }
-  int n = currentLightList.count();
-  if (n == 0)
+/* Locations of the per sprite uniforms in program, looked up once */
+const SpriteUniforms &
+OpenGlWidget::sprite_uniforms(QOpenGLShaderProgram *program) {
+  if (spriteUniforms.contains(program))
+    return spriteUniforms[program];
+  SpriteUniforms &uniforms = spriteUniforms[program];
+  uniforms.light = program->uniformLocation("light");
+  uniforms.transform = program->uniformLocation("transform");
+  uniforms.pixelsX = program->uniformLocation("pixelsX");
+  uniforms.pixelsY = program->uniformLocation("pixelsY");
+  uniforms.pixelated = program->uniformLocation("pixelated");
+  uniforms.outlineColor = program->uniformLocation("outlineColor");
+  uniforms.selected = program->uniformLocation("selected");
+  uniforms.ratio = program->uniformLocation("ratio");
+  uniforms.viewPos = program->uniformLocation("viewPos");
+  uniforms.parallax = program->uniformLocation("parallax");
+  uniforms.heightScale = program->uniformLocation("height_scale");
+  uniforms.parallaxLayers = program->uniformLocation("parallaxLayers");
+  uniforms.coneStep = program->uniformLocation("coneStep");
+  return uniforms;
+}
+
+void OpenGlWidget::apply_light_params(QOpenGLShaderProgram &program) {
+  QList<LightSource *> lights = scene_lights();
+  if (lights.isEmpty())
     return;
-  m_program.setUniformValue("lightNum", n);
-  for (int i = 0; i < n; i++) {
-    LightSource *light = currentLightList.at(i);
-    light->get_diffuse_color().getRgbF(&r, &g, &b, nullptr);
-    color = QVector3D(r, g, b);
-    QString Light = "Light[" + QString::number(i) + "]";
-    m_program.setUniformValue((Light + ".lightPos").toUtf8().constData(),
-                              light->get_light_position());
-    m_program.setUniformValue((Light + ".lightColor").toUtf8().constData(),
-                              color);
-    light->get_specular_color().getRgbF(&r, &g, &b, nullptr);
-    color = QVector3D(r, g, b);
-    m_program.setUniformValue((Light + ".specColor").toUtf8().constData(),
-                              color);
-    m_program.setUniformValue((Light + ".diffIntensity").toUtf8().constData(),
-                              light->get_diffuse_intensity());
-    m_program.setUniformValue((Light + ".specIntensity").toUtf8().constData(),
-                              light->get_specular_intesity());
-    m_program.setUniformValue((Light + ".specScatter").toUtf8().constData(),
-                              light->get_specular_scatter());
-    ambientColor.getRgbF(&r, &g, &b, nullptr);
-    color = QVector3D(r, g, b);
-    m_program.setUniformValue("ambientColor", color);
-    m_program.setUniformValue("ambientIntensity", ambientIntensity);
-  }
+  lightBuffer.apply(&program, lights, ambientColor, ambientIntensity,
+                    device_size());
 }
 
 void OpenGlWidget::set_add_light(bool add) {
@@ -988,7 +1321,7 @@ void OpenGlWidget::set_add_light(bool add) {
       sampleLightList->append(l);
     else
       currentLightList->append(l);
-    need_to_update = true;
+    request_update();
   } else {
     remove_light(currentLight);
   }
@@ -1006,7 +1339,7 @@ void OpenGlWidget::remove_light(LightSource *light) {
     if (currentLight == light)
       select_light(lList->last());
     delete light;
-    need_to_update = true;
+    request_update();
   }
 }
 
@@ -1061,11 +1394,11 @@ void OpenGlWidget::set_view_mode(int mode) { viewmode = mode; }
 
 void OpenGlWidget::use_sample_light_list(bool l) {
   sample_light_list_used = l;
-  need_to_update = true;
+  request_update();
 }
 
 void OpenGlWidget::set_current_light_list(QList<LightSource *> *list) {
   currentLightList = list;
   select_light(currentLightList->last());
-  need_to_update = true;
+  request_update();
 }
@@ -20,20 +20,27 @@
 #ifndef OPENGLWIDGET_H
 #define OPENGLWIDGET_H
 
+#include <QElapsedTimer>
+#include <QHash>
 #include <QList>
+#include <QMap>
 #include <QObject>
 #include <QOpenGLBuffer>
+#include <QOpenGLFramebufferObject>
 #include <QOpenGLFunctions>
 #include <QOpenGLShaderProgram>
 #include <QOpenGLTexture>
 #include <QOpenGLVertexArrayObject>
 #include <QOpenGLWidget>
 #include <QPixmap>
-#include <QTimer>
+#include <QSet>
 #include <QWheelEvent>
 
 #include "lightsource.h"
 #include "src/imageprocessor.h"
+#include "src/lightbuffer.h"
+#include "src/shadervariants.h"
+#include "src/spritebatch.h"
 
 enum ViewMode {
   Texture,
@@ -44,22 +51,35 @@ enum ViewMode {
   Preview
 };
 
+/* GPU copies of a processor's maps, with the map revisions they were
+ * uploaded at (see ImageProcessor::changed_maps) */
+struct ProcessorTextures {
+  QOpenGLTexture *texture = nullptr, *normal = nullptr, *parallax = nullptr,
+                 *specular = nullptr, *occlusion = nullptr, *cone = nullptr;
+  QMap<ProcessedImage, quint64> revisions;
+  /* Textures updated in place whose mipmaps have not been rebuilt yet */
+  QSet<QOpenGLTexture *> staleMipMaps;
+};
+
+/* Locations of the sprite program uniforms set for every sprite; the
+ * specialised variants lack some of them (-1) */
+struct SpriteUniforms {
+  int light, transform, pixelsX, pixelsY, pixelated, outlineColor, selected,
+      ratio, viewPos, parallax, heightScale, parallaxLayers, coneStep;
+};
+
 class OpenGlWidget : public QOpenGLWidget, protected QOpenGLFunctions {
   Q_OBJECT
 public:
   OpenGlWidget(QWidget *parent = nullptr);
-  bool need_to_update;
+  ~OpenGlWidget();
   ImageProcessor *processor;
   QList<LightSource *> *sampleLightList;
 
 public slots:
   void update();
-  void force_update();
-  void setImage(QImage *image);
-  void setNormalMap(QImage *normalMap);
-  void setParallaxMap(QImage *parallaxMap);
-  void setSpecularMap(QImage *image);
-  void setOcclusionMap(QImage *occlusionMap);
+  void request_update();
+  void set_frame_times_visible(bool visible);
   void setZoom(float zoom);
   void resetZoom();
   void fitZoom();
@@ -68,6 +88,7 @@ public slots:
   void setLightColor(QColor color);
   void setSpecColor(QColor color);
   void setLightHeight(float height);
+  void setLightRadius(float radius);
   void setLightIntensity(float intensity);
   void setAmbientIntensity(float intensity);
   void setSpecIntensity(float intensity);
@@ -79,8 +100,11 @@ public slots:
 
   void setPixelated(bool pixelated);
   void setPixelSize(int size);
+  void setDeferred(bool d);
 
   void setParallaxHeight(int height);
+  void setParallaxLayers(int layers);
+  void setConeStep(bool c);
   void setParallax(bool p);
 
   QImage calculate_preview(bool fullPreview = false);
@@ -119,6 +143,9 @@ signals:
   void selectedProcessorsChanged(QList<ImageProcessor *> list);
   void processor_selected(ImageProcessor *processor, bool selected);
   void set_enabled_map_controls(bool e);
+  /* A preview rendered by get_preview with autosave, to be written */
+  void preview_rendered(ImageProcessor *processor, QImage preview,
+                        QString basePath);
 
 protected:
   void initializeGL() override;
@@ -129,22 +156,52 @@ protected:
   void mousePressEvent(QMouseEvent *event) override;
   void mouseReleaseEvent(QMouseEvent *event) override;
 
+private slots:
+  void processor_destroyed(QObject *object);
+
 private:
   void select_current_light_list();
+  void use_textures(ImageProcessor *p);
+  void use_image(ImageProcessor *p);
+  bool is_minified(ImageProcessor *p);
+  QSize device_size();
+  void draw_sprite(ImageProcessor *processor, QVector3D outlineColor);
+  void draw_batch(int first, int count, QVector3D outlineColor);
+  bool begin_gbuffer();
+  void draw_deferred_lights();
+  void draw_frame_times(qint64 renderNsecs);
+  void upload(QOpenGLTexture *&texture, QImage *image, QRect rect,
+              QSet<QOpenGLTexture *> &staleMipMaps);
 
   GLuint shaderProgram, vertexShader, fragmentShader;
   QOpenGLTexture *m_texture, *m_normalTexture, *laigterTexture,
-      *m_parallaxTexture, *m_specularTexture, *m_occlusionTexture;
+      *m_parallaxTexture, *m_specularTexture, *m_occlusionTexture,
+      *m_coneTexture;
   QOpenGLVertexArrayObject VAO;
   QOpenGLVertexArrayObject lightVAO;
   QOpenGLBuffer VBO;
+  QOpenGLBuffer pixelBuffer;
+  SpriteBatch batch;
+  LightBuffer lightBuffer;
+  ShaderVariants spriteVariants;
+  QHash<QOpenGLShaderProgram *, SpriteUniforms> spriteUniforms;
   QOpenGLShaderProgram m_program, simpleProgram, lightProgram;
+  /* Deferred lighting: the sprites' surfaces are drawn into gBuffer, then
+   * lit by ambientProgram and one deferredLightProgram quad per light */
+  QOpenGLFramebufferObject *gBuffer;
+  QOpenGLShaderProgram ambientProgram, deferredLightProgram;
+  bool deferred, deferredReady, gBufferPass;
   QImage *m_image, *normalMap, *parallaxMap, laigter, *specularMap,
       *occlusionMap, renderedPreview;
   QVector3D lightPosition, texturePosition, textureOffset;
-  QTimer refreshTimer;
+  bool need_to_update;
+  bool frameTimesVisible;
+  QElapsedTimer requestTimer, frameTimer;
+  double frameTime, latency, frameInterval;
   bool m_light, tileX, tileY, m_parallax, m_pixelated;
   float sx, sy, parallax_height;
+  int parallaxLayers;
+  bool coneStep;
   float m_zoom;
   float diffIntensity, ambientIntensity, specIntensity, specScatter;
   int pixelsX, pixelsY, pixelSize;
@@ -158,9 +215,12 @@ private:
   LightSource *currentLight;
 
   void select_light(LightSource *light);
-  void apply_light_params();
+  QList<LightSource *> scene_lights();
+  const SpriteUniforms &sprite_uniforms(QOpenGLShaderProgram *program);
+  void apply_light_params(QOpenGLShaderProgram &program);
 
   QList<ImageProcessor *> processorList, selectedProcessors;
+  QHash<ImageProcessor *, ProcessorTextures> textureSets;
 
   int viewmode;
 
@@ -0,0 +1,225 @@
+/*
+ * Laigter: an automatic map generator for lighting effects.
+ * Copyright (C) 2019  Pablo Ivan Fonovich
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ * Contact: azagaya.games@gmail.com
+ */
+
+#include "pngwriter.h"
+#include <QFile>
+#include <QVector>
+#include <QtEndian>
+#include <climits>
+#include <zlib.h>
+
+namespace {
+
+class ChunkWriter {
+public:
+  explicit ChunkWriter(QFile *file) : file(file), ok(true) {}
+
+  void write(const char *type, const uchar *data, quint32 size) {
+    uchar length[4];
+    qToBigEndian(size, length);
+    uLong crc = crc32(0L, reinterpret_cast<const Bytef *>(type), 4);
+    if (size > 0)
+      crc = crc32(crc, data, size);
+    uchar crcBytes[4];
+    qToBigEndian(static_cast<quint32>(crc), crcBytes);
+    ok = ok && file->write(reinterpret_cast<const char *>(length), 4) == 4 &&
+         file->write(type, 4) == 4 &&
+         file->write(reinterpret_cast<const char *>(data), size) == size &&
+         file->write(reinterpret_cast<const char *>(crcBytes), 4) == 4;
+  }
+
+  QFile *file;
+  bool ok;
+};
+
+int paeth(int a, int b, int c) {
+  int p = a + b - c;
+  int pa = qAbs(p - a), pb = qAbs(p - b), pc = qAbs(p - c);
+  if (pa <= pb && pa <= pc)
+    return a;
+  return pb <= pc ? b : c;
+}
+
+/* Writes filter type f for row into out (without the filter byte) */
+void filter_row(int f, const uchar *row, const uchar *prev, int bytes, int bpp,
+                uchar *out) {
+  for (int i = 0; i < bytes; i++) {
+    int a = i >= bpp ? row[i - bpp] : 0;
+    int b = prev[i];
+    int c = i >= bpp ? prev[i - bpp] : 0;
+    int v = row[i];
+    switch (f) {
+    case 1:
+      v -= a;
+      break;
+    case 2:
+      v -= b;
+      break;
+    case 3:
+      v -= (a + b) / 2;
+      break;
+    case 4:
+      v -= paeth(a, b, c);
+      break;
+    }
+    out[i] = static_cast<uchar>(v);
+  }
+}
+
+int filter_cost(const uchar *data, int bytes) {
+  int sum = 0;
+  for (int i = 0; i < bytes; i++)
+    sum += qAbs(static_cast<signed char>(data[i]));
+  return sum;
+}
+
+} // namespace
+
+bool PngWriter::write(QString fileName, const QImage &image,
+                      PngCompression compression) {
+  if (image.isNull())
+    return false;
+
+  QImage::Format format;
+  int colorType, bpp;
+  switch (image.format()) {
+  case QImage::Format_Grayscale8:
+    format = QImage::Format_Grayscale8;
+    colorType = 0;
+    bpp = 1;
+    break;
+  case QImage::Format_RGB888:
+    format = QImage::Format_RGB888;
+    colorType = 2;
+    bpp = 3;
+    break;
+  default:
+    format = image.hasAlphaChannel() ? QImage::Format_RGBA8888
+                                     : QImage::Format_RGB888;
+    colorType = image.hasAlphaChannel() ? 6 : 2;
+    bpp = image.hasAlphaChannel() ? 4 : 3;
+  }
+
+  int level, filter;
+  switch (compression) {
+  case PngCompression::Store:
+    level = 0;
+    filter = 0;
+    break;
+  case PngCompression::Fast:
+    level = 1;
+    filter = 1;
+    break;
+  case PngCompression::Best:
+    level = 9;
+    filter = -1;
+    break;
+  default:
+    level = 6;
+    filter = -1;
+  }
+
+  QFile file(fileName);
+  if (!file.open(QIODevice::WriteOnly))
+    return false;
+  ChunkWriter chunks(&file);
+  static const char signature[8] = {'\x89', 'P',  'N',    'G',
+                                    '\r',   '\n', '\x1a', '\n'};
+  chunks.ok = file.write(signature, 8) == 8;
+
+  uchar ihdr[13];
+  qToBigEndian(static_cast<quint32>(image.width()), ihdr);
+  qToBigEndian(static_cast<quint32>(image.height()), ihdr + 4);
+  ihdr[8] = 8;
+  ihdr[9] = static_cast<uchar>(colorType);
+  ihdr[10] = ihdr[11] = ihdr[12] = 0;
+  chunks.write("IHDR", ihdr, 13);
+
+  z_stream zs;
+  zs.zalloc = Z_NULL;
+  zs.zfree = Z_NULL;
+  zs.opaque = Z_NULL;
+  if (deflateInit(&zs, level) != Z_OK) {
+    file.remove();
+    return false;
+  }
+
+  const int rowBytes = image.width() * bpp;
+  QVector<uchar> prev(rowBytes, 0);
+  QVector<uchar> filtered(rowBytes + 1);
+  QVector<uchar> candidate(rowBytes);
+  QVector<uchar> out(1 << 16);
+
+  auto deflate_into = [&](int flush) {
+    int ret;
+    do {
+      zs.next_out = out.data();
+      zs.avail_out = static_cast<uInt>(out.size());
+      ret = deflate(&zs, flush);
+      quint32 size = static_cast<quint32>(out.size()) - zs.avail_out;
+      if (size > 0)
+        chunks.write("IDAT", out.data(), size);
+    } while (zs.avail_out == 0 && ret != Z_STREAM_ERROR);
+    if (ret == Z_STREAM_ERROR || (flush == Z_FINISH && ret != Z_STREAM_END))
+      chunks.ok = false;
+  };
+
+  QImage converted;
+  for (int y = 0; y < image.height() && chunks.ok; y++) {
+    const uchar *row;
+    if (image.format() == format) {
+      row = image.constScanLine(y);
+    } else {
+      /* Convert a single line, never the whole image */
+      converted = image.copy(0, y, image.width(), 1).convertToFormat(format);
+      row = converted.constScanLine(0);
+    }
+
+    int best = filter;
+    if (filter < 0) {
+      int bestCost = INT_MAX;
+      for (int f = 0; f < 5; f++) {
+        filter_row(f, row, prev.constData(), rowBytes, bpp, candidate.data());
+        int cost = filter_cost(candidate.constData(), rowBytes);
+        if (cost < bestCost) {
+          bestCost = cost;
+          best = f;
+        }
+      }
+    }
+    filtered[0] = static_cast<uchar>(best);
+    filter_row(best, row, prev.constData(), rowBytes, bpp, filtered.data() + 1);
+    memcpy(prev.data(), row, static_cast<size_t>(rowBytes));
+
+    zs.next_in = filtered.data();
+    zs.avail_in = static_cast<uInt>(filtered.size());
+    deflate_into(Z_NO_FLUSH);
+  }
+  if (chunks.ok)
+    deflate_into(Z_FINISH);
+  deflateEnd(&zs);
+
+  chunks.write("IEND", nullptr, 0);
+  /* Never leave a truncated file behind */
+  if (!chunks.ok || !file.flush()) {
+    file.remove();
+    return false;
+  }
+  return true;
+}
@@ -0,0 +1,37 @@
+/*
+ * Laigter: an automatic map generator for lighting effects.
+ * Copyright (C) 2019  Pablo Ivan Fonovich
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ * Contact: azagaya.games@gmail.com
+ */
+
+#ifndef PNGWRITER_H
+#define PNGWRITER_H
+
+#include <QImage>
+#include <QString>
+
+enum class PngCompression { Store, Fast, Default, Best };
+
+/* Encodes a PNG straight from the image scanlines, one filtered row at a
+ * time, so exporting never holds more than a couple of rows besides the
+ * source buffer. */
+class PngWriter {
+public:
+  static bool write(QString fileName, const QImage &image,
+                    PngCompression compression);
+};
+
+#endif // PNGWRITER_H
@@ -0,0 +1,337 @@
+/*
+ * Laigter: an automatic map generator for lighting effects.
+ * Copyright (C) 2019  Pablo Ivan Fonovich
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ * Contact: azagaya.games@gmail.com
+ */
+
+#include "presetsettings.h"
+#include <QFile>
+#include <QHash>
+#include <QTextStream>
+
+static const char *keyNames[PresetSettings::KeyCount] = {
+    "EnhanceHeight ",       "EnhanceSoft ",
+    "BumpHeight ",          "BumpDistance",
+    "BumpSoft ",            "BumpCut ",
+    "Tile ",                "InvertX ",
+    "InvertY ",             "ParallaxType",
+    "BinaryThreshold ",     "BinaryFocus ",
+    "ParallaxSoft ",        "BinaryMinHeight ",
+    "BinaryErodeDilate ",   "HeightMapBrightness ",
+    "HeightMapContrast ",   "InvertParallax ",
+    "SpecularBlur ",        "SpecularBright ",
+    "SpecularContrast ",    "SpecularThresh ",
+    "SpecularInvert ",      "OcclusionBlur ",
+    "OcclusionBright ",     "OcclusionInvert ",
+    "OcclusionThresh ",     "OcclusionContrast ",
+    "OcclusionDistance ",   "OcclusionDistanceMode ",
+    "ParallaxQuantization ", "ConeRadius "};
+
+QString PresetSettings::key_name(int key) { return keyNames[key]; }
+
+QStringList PresetSettings::values(ProcessorSettings s) {
+  QStringList v;
+  v << QString::number(*s.normal_depth);
+  v << QString::number(*s.normal_blur_radius);
+  v << QString::number(*s.normal_bisel_depth);
+  v << QString::number(*s.normal_bisel_distance);
+  v << QString::number(*s.normal_bisel_blur_radius);
+  v << (*s.normal_bisel_soft ? "1" : "0");
+  v << (*s.tileable ? "1" : "0");
+  v << (*s.normalInvertX == -1 ? "1" : "0");
+  v << (*s.normalInvertY == -1 ? "1" : "0");
+  v << QString::number((int)*s.parallax_type);
+  v << QString::number(*s.parallax_max);
+  v << QString::number(*s.parallax_focus);
+  v << QString::number(*s.parallax_soft);
+  v << QString::number(*s.parallax_min);
+  v << QString::number(*s.parallax_erode_dilate);
+  v << QString::number(*s.parallax_brightness);
+  v << QString::number(*s.parallax_contrast * 1000);
+  v << QString::number(*s.parallax_invert);
+  v << QString::number(*s.specular_blur);
+  v << QString::number(*s.specular_bright);
+  v << QString::number(*s.specular_contrast * 1000);
+  v << QString::number(*s.specular_thresh);
+  v << (*s.specular_invert ? "1" : "0");
+  v << QString::number(*s.occlusion_blur);
+  v << QString::number(*s.occlusion_bright);
+  v << (*s.occlusion_invert ? "1" : "0");
+  v << QString::number(*s.occlusion_thresh);
+  v << QString::number(*s.occlusion_contrast * 1000);
+  v << QString::number(*s.occlusion_distance);
+  v << (*s.occlusion_distance_mode ? "1" : "0");
+  v << QString::number(*s.parallax_quantization);
+  v << QString::number(*s.cone_radius);
+  return v;
+}
+
+QByteArray PresetSettings::lights_text(QList<LightSource *> lights) {
+  QByteArray text;
+  QTextStream in(&text);
+  foreach (LightSource *light, lights) {
+    QColor diffuseColor = light->get_diffuse_color();
+    QColor specularColor = light->get_specular_color();
+    QVector3D position = light->get_light_position();
+    in << "\nLightSource\n";
+    in << "DiffuseColor \t" << diffuseColor.red() << "\t"
+       << diffuseColor.green() << "\t" << diffuseColor.blue() << "\n";
+    in << "DiffuseIntensity \t" << light->get_diffuse_intensity() << "\n";
+    in << "SpecularColor \t" << specularColor.red() << "\t"
+       << specularColor.green() << "\t" << specularColor.blue() << "\n";
+    in << "SpecularScatter \t" << light->get_specular_scatter() << "\n";
+    in << "SpecularIntensity \t" << light->get_specular_intesity() << "\n";
+    in << "Radius \t" << light->get_radius() << "\n";
+    in << "Position \t" << position.x() << "\t" << position.y() << "\t"
+       << position.z() << "\t";
+  }
+  in.flush();
+  return text;
+}
+
+QByteArray PresetSettings::serialize(ProcessorSettings s) {
+  QStringList v = values(s);
+  QByteArray text = "[Laigter Preset]";
+  for (int i = 0; i < KeyCount; i++)
+    text += "\n" + key_name(i).toUtf8() + "\t" + v[i].toUtf8();
+  return text + lights_text(*s.lightList);
+}
+
+static QHash<QByteArray, int> key_index() {
+  QHash<QByteArray, int> keys;
+  for (int i = 0; i < PresetSettings::KeyCount; i++)
+    keys[QByteArray(keyNames[i]).trimmed()] = i;
+  return keys;
+}
+
+/* Reads count numbers after the key, adding an error when one is missing or
+ * not a number */
+static bool read_numbers(QList<QByteArray> &fields, int count, double *out,
+                         int line, QStringList *errors) {
+  for (int i = 0; i < count; i++) {
+    bool ok = i + 1 < fields.count();
+    if (ok)
+      out[i] = fields[i + 1].trimmed().toDouble(&ok);
+    if (!ok) {
+      errors->append(QString("line %1: invalid value for %2")
+                         .arg(line)
+                         .arg(QString(fields[0].trimmed())));
+      return false;
+    }
+  }
+  return true;
+}
+
+PresetSettings PresetSettings::parse(QByteArray data, QStringList *errors) {
+  static const QHash<QByteArray, int> keys = key_index();
+
+  PresetSettings preset;
+  preset.source = data;
+  QList<QByteArray> lines = data.split('\n');
+  for (int i = 0; i < lines.count(); i++) {
+    int line = i + 1;
+    QList<QByteArray> fields = lines[i].split('\t');
+    QByteArray key = fields[0].trimmed();
+    double v[3];
+    if (key.isEmpty() || (i == 0 && key == "[Laigter Preset]"))
+      continue;
+    if (keys.contains(key)) {
+      /* Contrasts are saved multiplied by 1000 and may have decimals */
+      if (read_numbers(fields, 1, v, line, errors))
+        preset.values.append(
+            qMakePair(static_cast<Key>(keys[key]), qRound(v[0])));
+      continue;
+    }
+    if (key == "LightSource") {
+      preset.lights.append(Light());
+      continue;
+    }
+    bool lightKey = key == "DiffuseColor" || key == "DiffuseIntensity" ||
+                    key == "SpecularColor" || key == "SpecularScatter" ||
+                    key == "SpecularIntensity" || key == "Radius" ||
+                    key == "Position";
+    if (!lightKey) {
+      errors->append(
+          QString("line %1: unknown key %2").arg(line).arg(QString(key)));
+      continue;
+    }
+    if (preset.lights.isEmpty()) {
+      errors->append(QString("line %1: %2 outside of a LightSource")
+                         .arg(line)
+                         .arg(QString(key)));
+      continue;
+    }
+    Light &light = preset.lights.last();
+    bool triple =
+        key == "DiffuseColor" || key == "SpecularColor" || key == "Position";
+    if (!read_numbers(fields, triple ? 3 : 1, v, line, errors))
+      continue;
+    QColor color(qRound(v[0]), qRound(v[1]), qRound(v[2]));
+    if (key == "DiffuseColor")
+      light.diffuseColor = color;
+    else if (key == "DiffuseIntensity")
+      light.diffuseIntensity = v[0];
+    else if (key == "SpecularColor")
+      light.specularColor = color;
+    else if (key == "SpecularScatter")
+      light.specularScatter = v[0];
+    else if (key == "SpecularIntensity")
+      light.specularIntensity = v[0];
+    else if (key == "Radius")
+      light.radius = v[0];
+    else
+      light.position = QVector3D(v[0], v[1], v[2]);
+  }
+  return preset;
+}
+
+PresetSettings PresetSettings::load(QString fileName, QStringList *errors) {
+  QFile file(fileName);
+  if (!file.open(QIODevice::ReadOnly)) {
+    errors->append("cannot read preset " + fileName);
+    return PresetSettings();
+  }
+  return parse(file.readAll(), errors);
+}
+
+bool PresetSettings::is_empty() const {
+  return values.isEmpty() && lights.isEmpty();
+}
+
+QByteArray PresetSettings::data() const { return source; }
+
+void PresetSettings::apply(ImageProcessor &p) const {
+  p.hold_updates();
+  for (int i = 0; i < values.count(); i++) {
+    int v = values[i].second;
+    switch (values[i].first) {
+    case EnhanceHeight:
+      p.set_normal_depth(v);
+      break;
+    case EnhanceSoft:
+      p.set_normal_blur_radius(v);
+      break;
+    case BumpHeight:
+      p.set_normal_bisel_depth(v);
+      break;
+    case BumpDistance:
+      p.set_normal_bisel_distance(v);
+      break;
+    case BumpSoft:
+      p.set_normal_bisel_blur_radius(v);
+      break;
+    case BumpCut:
+      p.set_normal_bisel_soft(v);
+      break;
+    case Tile:
+      p.set_tileable(v);
+      break;
+    case InvertX:
+      p.set_normal_invert_x(v);
+      break;
+    case InvertY:
+      p.set_normal_invert_y(v);
+      break;
+    case ParallaxType:
+      p.set_parallax_type(static_cast<::ParallaxType>(v));
+      break;
+    case BinaryThreshold:
+      p.set_parallax_thresh(v);
+      break;
+    case BinaryFocus:
+      p.set_parallax_focus(v);
+      break;
+    case ParallaxSoft:
+      p.set_parallax_soft(v);
+      break;
+    case BinaryMinHeight:
+      p.set_parallax_min(v);
+      break;
+    case BinaryErodeDilate:
+      p.set_parallax_erode_dilate(v);
+      break;
+    case HeightMapBrightness:
+      p.set_parallax_brightness(v);
+      break;
+    case HeightMapContrast:
+      p.set_parallax_contrast(v);
+      break;
+    case InvertParallax:
+      p.set_parallax_invert(v);
+      break;
+    case SpecularBlur:
+      p.set_specular_blur(v);
+      break;
+    case SpecularBright:
+      p.set_specular_bright(v);
+      break;
+    case SpecularContrast:
+      p.set_specular_contrast(v);
+      break;
+    case SpecularThresh:
+      p.set_specular_thresh(v);
+      break;
+    case SpecularInvert:
+      p.set_specular_invert(v);
+      break;
+    case OcclusionBlur:
+      p.set_occlusion_blur(v);
+      break;
+    case OcclusionBright:
+      p.set_occlusion_bright(v);
+      break;
+    case OcclusionInvert:
+      p.set_occlusion_invert(v);
+      break;
+    case OcclusionThresh:
+      p.set_occlusion_thresh(v);
+      break;
+    case OcclusionContrast:
+      p.set_occlusion_contrast(v);
+      break;
+    case OcclusionDistance:
+      p.set_occlusion_distance(v);
+      break;
+    case OcclusionDistanceMode:
+      p.set_occlusion_distance_mode(v);
+      break;
+    case ParallaxQuantization:
+      p.set_parallax_quantization(v);
+      break;
+    case ConeRadius:
+      p.set_cone_radius(v);
+      break;
+    case KeyCount:
+      break;
+    }
+  }
+  if (!lights.isEmpty()) {
+    QList<LightSource *> *lightList = p.get_light_list_ptr();
+    lightList->clear();
+    foreach (const Light &l, lights) {
+      LightSource *light = new LightSource;
+      light->set_diffuse_color(l.diffuseColor);
+      light->set_diffuse_intensity(l.diffuseIntensity);
+      light->set_specular_color(l.specularColor);
+      light->set_specular_scatter(l.specularScatter);
+      light->set_specular_intensity(l.specularIntensity);
+      light->set_radius(l.radius);
+      light->set_light_position(l.position);
+      lightList->append(light);
+    }
+  }
+  p.release_updates();
+}
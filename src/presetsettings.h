@@ -0,0 +1,107 @@
+/*
+ * Laigter: an automatic map generator for lighting effects.
+ * Copyright (C) 2019  Pablo Ivan Fonovich
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ * Contact: azagaya.games@gmail.com
+ */
+
+#ifndef PRESETSETTINGS_H
+#define PRESETSETTINGS_H
+
+#include <QByteArray>
+#include <QColor>
+#include <QPair>
+#include <QStringList>
+#include <QVector3D>
+#include <QVector>
+
+#include "src/imageprocessor.h"
+#include "src/lightsource.h"
+
+/* A preset file parsed once up front. apply() only calls the processor
+ * setters, without I/O or key lookups, so one instance can be shared by
+ * every processor of a batch. Instances are not modified after parse(). */
+class PresetSettings {
+public:
+  enum Key {
+    EnhanceHeight,
+    EnhanceSoft,
+    BumpHeight,
+    BumpDistance,
+    BumpSoft,
+    BumpCut,
+    Tile,
+    InvertX,
+    InvertY,
+    ParallaxType,
+    BinaryThreshold,
+    BinaryFocus,
+    ParallaxSoft,
+    BinaryMinHeight,
+    BinaryErodeDilate,
+    HeightMapBrightness,
+    HeightMapContrast,
+    InvertParallax,
+    SpecularBlur,
+    SpecularBright,
+    SpecularContrast,
+    SpecularThresh,
+    SpecularInvert,
+    OcclusionBlur,
+    OcclusionBright,
+    OcclusionInvert,
+    OcclusionThresh,
+    OcclusionContrast,
+    OcclusionDistance,
+    OcclusionDistanceMode,
+    ParallaxQuantization,
+    ConeRadius,
+    KeyCount
+  };
+
+  /* Name as written in preset files, trailing space included */
+  static QString key_name(int key);
+  /* Value of every key for the given settings, indexed by Key */
+  static QStringList values(ProcessorSettings s);
+  /* LightSource blocks for a preset file */
+  static QByteArray lights_text(QList<LightSource *> lights);
+  /* Complete preset with every key and the settings' lights */
+  static QByteArray serialize(ProcessorSettings s);
+
+  /* Unknown keys and malformed values are added to errors */
+  static PresetSettings parse(QByteArray data, QStringList *errors);
+  static PresetSettings load(QString fileName, QStringList *errors);
+
+  bool is_empty() const;
+  QByteArray data() const;
+  void apply(ImageProcessor &p) const;
+
+private:
+  struct Light {
+    QColor diffuseColor;
+    float diffuseIntensity = 0;
+    QColor specularColor;
+    float specularScatter = 0;
+    float specularIntensity = 0;
+    float radius = 0;
+    QVector3D position;
+  };
+
+  QByteArray source;
+  QVector<QPair<Key, int>> values;
+  QVector<Light> lights;
+};
+
+#endif // PRESETSETTINGS_H
@@ -0,0 +1,218 @@
+/*
+ * Laigter: an automatic map generator for lighting effects.
+ * Copyright (C) 2019  Pablo Ivan Fonovich
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ * Contact: azagaya.games@gmail.com
+ */
+
+#include "previewrenderer.h"
+#include "src/cpurenderer.h"
+#include "src/shaderloader.h"
+#include <QOffscreenSurface>
+#include <QOpenGLContext>
+#include <QOpenGLFramebufferObject>
+#include <QOpenGLTexture>
+#include <QScopedPointer>
+#include <QThread>
+
+PreviewRenderer::PreviewRenderer(QObject *parent) : QObject(parent) {
+  surface = nullptr;
+  context = nullptr;
+  default_light(&defaultLight);
+  qRegisterMetaType<ImageProcessor *>("ImageProcessor*");
+}
+
+PreviewRenderer::~PreviewRenderer() {
+  if (context) {
+    context->makeCurrent(surface);
+    VBO.destroy();
+    VAO.destroy();
+    lights.destroy();
+    program.removeAllShaders();
+    context->doneCurrent();
+  }
+  delete context;
+  delete surface;
+}
+
+/* Same light OpenGlWidget starts with */
+void PreviewRenderer::default_light(LightSource *light) {
+  QColor c;
+  c.setRgbF(0.0, 1, 0.7);
+  light->set_light_position(QVector3D(0.7, 0.7, 0.3));
+  light->set_diffuse_color(c);
+  light->set_specular_color(c);
+  light->set_specular_scatter(32);
+  light->set_diffuse_intensity(0.6);
+  light->set_specular_intensity(0.6);
+}
+
+void PreviewRenderer::set_settings(PreviewSettings s) { settings = s; }
+
+PreviewSettings PreviewRenderer::get_settings() { return settings; }
+
+void PreviewRenderer::use_cpu(bool cpu) { this->cpu = cpu; }
+
+bool PreviewRenderer::get_cpu() { return cpu; }
+
+bool PreviewRenderer::init(QString *error) {
+  surface = new QOffscreenSurface();
+  surface->setFormat(QSurfaceFormat::defaultFormat());
+  surface->create();
+  context = new QOpenGLContext();
+  context->setFormat(QSurfaceFormat::defaultFormat());
+  if (!surface->isValid() || !context->create() ||
+      !context->makeCurrent(surface)) {
+    *error = "cannot create an offscreen OpenGL context";
+    return false;
+  }
+  initializeOpenGLFunctions();
+  glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+  glEnable(GL_BLEND);
+
+  if (!ShaderLoader::build(&program, ":/shaders/vshader.glsl",
+                           ":/shaders/fshader.glsl")) {
+    *error = program.log();
+    return false;
+  }
+  lights.init();
+  lights.attach(&program);
+
+  float vertices[] = {
+      -1.0f, -1.0f, 0.0f, 0.0f, 1.0f, // bot left
+      1.0f,  -1.0f, 0.0f, 1.0f, 1.0f, // bot right
+      -1.0f, 1.0f,  0.0f, 0.0f, 0.0f, // top left
+      1.0f,  1.0f,  0.0f, 1.0f, 0.0f  // top right
+  };
+  VAO.create();
+  VAO.bind();
+  VBO.create();
+  VBO.bind();
+  VBO.allocate(vertices, sizeof(vertices));
+  int vertexLocation = program.attributeLocation("aPos");
+  glVertexAttribPointer(static_cast<GLuint>(vertexLocation), 3, GL_FLOAT,
+                        GL_FALSE, 5 * sizeof(float), nullptr);
+  glEnableVertexAttribArray(static_cast<GLuint>(vertexLocation));
+  int texCoordLocation = program.attributeLocation("aTexCoord");
+  glVertexAttribPointer(static_cast<GLuint>(texCoordLocation), 2, GL_FLOAT,
+                        GL_FALSE, 5 * sizeof(float),
+                        (void *)(3 * sizeof(float)));
+  glEnableVertexAttribArray(static_cast<GLuint>(texCoordLocation));
+  VAO.release();
+  VBO.release();
+  context->doneCurrent();
+  return true;
+}
+
+QImage PreviewRenderer::render(ImageProcessor *processor) {
+  if (cpu) {
+    QList<LightSource *> lights = *processor->get_light_list_ptr();
+    if (lights.isEmpty())
+      lights.append(&defaultLight);
+    return CpuRenderer::render(processor, lights, settings);
+  }
+  if (QThread::currentThread() != thread()) {
+    QImage image;
+    QMetaObject::invokeMethod(this, "render", Qt::BlockingQueuedConnection,
+                              Q_RETURN_ARG(QImage, image),
+                              Q_ARG(ImageProcessor *, processor));
+    return image;
+  }
+  if (!context || !context->makeCurrent(surface))
+    return QImage();
+
+  QImage *tex = processor->get_texture();
+  int width = tex->width(), height = tex->height();
+  QScopedPointer<QOpenGLTexture> texture(new QOpenGLTexture(*tex));
+  QScopedPointer<QOpenGLTexture> normal(
+      new QOpenGLTexture(*processor->get_normal()));
+  QScopedPointer<QOpenGLTexture> parallax(
+      new QOpenGLTexture(*processor->get_parallax()));
+  QScopedPointer<QOpenGLTexture> specular(
+      new QOpenGLTexture(*processor->get_specular()));
+  QScopedPointer<QOpenGLTexture> occlusion(
+      new QOpenGLTexture(*processor->get_occlusion()));
+  /* Without a cone map yet, a texel of zero cone stays on the surface */
+  QImage coneImage = *processor->get_cone();
+  if (coneImage.isNull()) {
+    coneImage = QImage(1, 1, QImage::Format_Grayscale8);
+    coneImage.fill(0);
+  }
+  QScopedPointer<QOpenGLTexture> cone(new QOpenGLTexture(coneImage));
+
+  QImage result;
+  {
+    QOpenGLFramebufferObject frameBuffer(width, height);
+    frameBuffer.bind();
+    glViewport(0, 0, width, height);
+    glClearColor(0, 0, 0, 0);
+    glClear(GL_COLOR_BUFFER_BIT);
+
+    program.bind();
+    VAO.bind();
+    QOpenGLTexture::Filter min = settings.pixelated
+                                     ? QOpenGLTexture::NearestMipMapNearest
+                                     : QOpenGLTexture::LinearMipMapLinear;
+    QOpenGLTexture::Filter mag =
+        settings.pixelated ? QOpenGLTexture::Nearest : QOpenGLTexture::Linear;
+    QList<QOpenGLTexture *> textures = {texture.data(), normal.data(),
+                                        parallax.data(), specular.data(),
+                                        occlusion.data(), cone.data()};
+    for (int i = 0; i < textures.count(); i++) {
+      textures[i]->setMinMagFilters(min, mag);
+      textures[i]->setWrapMode(QOpenGLTexture::ClampToBorder);
+      textures[i]->bind(static_cast<uint>(i));
+    }
+    program.setUniformValue("TEX", 0);
+    program.setUniformValue("normalMap", 1);
+    program.setUniformValue("parallaxMap", 2);
+    program.setUniformValue("specularMap", 3);
+    program.setUniformValue("occlusionMap", 4);
+    program.setUniformValue("coneMap", 5);
+
+    program.setUniformValue("light", true);
+    program.setUniformValue("transform", QMatrix4x4());
+    program.setUniformValue("pixelsX", width);
+    program.setUniformValue("pixelsY", height);
+    program.setUniformValue("pixelated", settings.pixelated);
+    program.setUniformValue("selected", false);
+    program.setUniformValue("ratio", QVector2D(1, 1));
+    program.setUniformValue("viewPos", QVector3D(0, 0, 1));
+    program.setUniformValue("parallax", processor->get_is_parallax());
+    program.setUniformValue("height_scale", settings.parallaxHeight);
+    program.setUniformValue("parallaxLayers", settings.parallaxLayers);
+    program.setUniformValue("coneStep", settings.coneStep);
+
+    QList<LightSource *> sceneLights = *processor->get_light_list_ptr();
+    if (sceneLights.isEmpty())
+      sceneLights.append(&defaultLight);
+    lights.apply(&program, sceneLights, settings.ambientColor,
+                 settings.ambientIntensity, QSize(width, height));
+
+    glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+    VAO.release();
+    program.release();
+    frameBuffer.release();
+    result = frameBuffer.toImage();
+  }
+  texture->destroy();
+  normal->destroy();
+  parallax->destroy();
+  specular->destroy();
+  occlusion->destroy();
+  cone->destroy();
+  context->doneCurrent();
+  return result;
+}
@@ -0,0 +1,83 @@
+/*
+ * Laigter: an automatic map generator for lighting effects.
+ * Copyright (C) 2019  Pablo Ivan Fonovich
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ * Contact: azagaya.games@gmail.com
+ */
+
+#ifndef PREVIEWRENDERER_H
+#define PREVIEWRENDERER_H
+
+#include <QColor>
+#include <QImage>
+#include <QList>
+#include <QObject>
+#include <QOpenGLBuffer>
+#include <QOpenGLFunctions>
+#include <QOpenGLShaderProgram>
+#include <QOpenGLVertexArrayObject>
+
+#include "src/imageprocessor.h"
+#include "src/lightbuffer.h"
+#include "src/lightsource.h"
+
+class QOffscreenSurface;
+class QOpenGLContext;
+
+struct PreviewSettings {
+  QColor ambientColor = QColor("white");
+  float ambientIntensity = 0.8f;
+  float parallaxHeight = 0.03f;
+  int parallaxLayers = 32;
+  bool coneStep = false;
+  bool pixelated = false;
+};
+
+/* Renders the lit (_v) preview of a processor without a window, with the
+ * same shaders as OpenGlWidget on an offscreen surface. The processor's own
+ * lights are used, or the default scene light when it has none.
+ *
+ * The GL context lives in the thread that created the renderer; calls from
+ * other threads are forwarded to it and block until the image is ready.
+ * With use_cpu() the image comes from CpuRenderer instead, in the calling
+ * thread and without a context. */
+class PreviewRenderer : public QObject, protected QOpenGLFunctions {
+  Q_OBJECT
+public:
+  explicit PreviewRenderer(QObject *parent = nullptr);
+  ~PreviewRenderer();
+
+  bool init(QString *error);
+  void set_settings(PreviewSettings s);
+  PreviewSettings get_settings();
+  void use_cpu(bool cpu);
+  bool get_cpu();
+  static void default_light(LightSource *light);
+
+  Q_INVOKABLE QImage render(ImageProcessor *processor);
+
+private:
+  QOffscreenSurface *surface;
+  QOpenGLContext *context;
+  QOpenGLShaderProgram program;
+  QOpenGLVertexArrayObject VAO;
+  QOpenGLBuffer VBO;
+  LightBuffer lights;
+  PreviewSettings settings;
+  LightSource defaultLight;
+  bool cpu = false;
+};
+
+#endif // PREVIEWRENDERER_H
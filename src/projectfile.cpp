@@ -0,0 +1,281 @@
+/*
+ * Laigter: an automatic map generator for lighting effects.
+ * Copyright (C) 2019  Pablo Ivan Fonovich
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ * Contact: azagaya.games@gmail.com
+ */
+
+#include "projectfile.h"
+#include <QBuffer>
+#include <QCoreApplication>
+#include <QCryptographicHash>
+#include <QDataStream>
+#include <QFile>
+#include <QSaveFile>
+#include <QtEndian>
+#include <climits>
+#include <cstring>
+
+#include "src/imageloader.h"
+#include "src/presetsettings.h"
+
+static const char magic[4] = {'L', 'G', 'T', 'P'};
+static const quint32 version = 1;
+static const int prefixSize = 16;
+
+struct CachedMap {
+  qint32 width = 0, height = 0, channels = 0;
+  quint64 offset = 0, size = 0;
+};
+
+struct ProjectEntry {
+  QString fileName, heightmapPath, specularPath;
+  QByteArray settings;
+  QVector3D position;
+  bool tileX = false, tileY = false;
+  QByteArray inputHash, settingsHash;
+  QList<CachedMap> maps;
+};
+
+static QDataStream &operator<<(QDataStream &out, const CachedMap &m) {
+  return out << m.width << m.height << m.channels << m.offset << m.size;
+}
+
+static QDataStream &operator>>(QDataStream &in, CachedMap &m) {
+  return in >> m.width >> m.height >> m.channels >> m.offset >> m.size;
+}
+
+static QDataStream &operator<<(QDataStream &out, const ProjectEntry &e) {
+  return out << e.fileName << e.heightmapPath << e.specularPath << e.settings
+             << e.position << e.tileX << e.tileY << e.inputHash
+             << e.settingsHash << e.maps;
+}
+
+static QDataStream &operator>>(QDataStream &in, ProjectEntry &e) {
+  return in >> e.fileName >> e.heightmapPath >> e.specularPath >>
+         e.settings >> e.position >> e.tileX >> e.tileY >> e.inputHash >>
+         e.settingsHash >> e.maps;
+}
+
+/* Hash of the diffuse, height and specular files as they are on disk */
+static QByteArray input_hash(const ProjectEntry &e) {
+  QCryptographicHash hash(QCryptographicHash::Sha1);
+  foreach (QString path,
+           QStringList() << e.fileName << e.heightmapPath << e.specularPath) {
+    QFile file(path);
+    if (path.isEmpty())
+      continue;
+    if (!file.open(QIODevice::ReadOnly))
+      return QByteArray();
+    hash.addData(&file);
+  }
+  return hash.result();
+}
+
+static QByteArray settings_hash(const ProjectEntry &e) {
+  QCryptographicHash hash(QCryptographicHash::Sha1);
+  hash.addData(QCoreApplication::applicationVersion().toUtf8());
+  hash.addData(e.settings);
+  hash.addData(e.heightmapPath.toUtf8());
+  hash.addData(e.specularPath.toUtf8());
+  return hash.result();
+}
+
+static CachedMap add_map(QByteArray &blobs, const QImage &image) {
+  CachedMap m;
+  m.width = image.width();
+  m.height = image.height();
+  m.channels = image.format() == QImage::Format_RGB888 ? 3 : 1;
+  int rowBytes = m.width * m.channels;
+  QByteArray raw;
+  raw.reserve(rowBytes * m.height);
+  for (int y = 0; y < m.height; y++)
+    raw.append(reinterpret_cast<const char *>(image.constScanLine(y)),
+               rowBytes);
+  QByteArray packed = qCompress(raw);
+  m.offset = static_cast<quint64>(blobs.size());
+  m.size = static_cast<quint64>(packed.size());
+  blobs.append(packed);
+  return m;
+}
+
+static QImage read_map(const uchar *blobs, quint64 blobsSize,
+                       const CachedMap &m) {
+  if (m.width <= 0 || m.height <= 0 || (m.channels != 1 && m.channels != 3) ||
+      m.offset + m.size > blobsSize || m.size > INT_MAX)
+    return QImage();
+  QByteArray raw = qUncompress(blobs + m.offset, static_cast<int>(m.size));
+  int rowBytes = m.width * m.channels;
+  if (raw.size() != rowBytes * m.height)
+    return QImage();
+  QImage img(m.width, m.height,
+             m.channels == 3 ? QImage::Format_RGB888
+                             : QImage::Format_Grayscale8);
+  for (int y = 0; y < m.height; y++)
+    memcpy(img.scanLine(y), raw.constData() + y * rowBytes,
+           static_cast<size_t>(rowBytes));
+  return img;
+}
+
+bool ProjectFile::save(QString fileName, QList<ImageProcessor *> processors,
+                       bool cacheMaps, QString *error) {
+  QList<ProjectEntry> entries;
+  QByteArray blobs;
+  foreach (ImageProcessor *p, processors) {
+    ProjectEntry e;
+    e.fileName = p->get_name();
+    e.heightmapPath = p->get_heightmap_path();
+    e.specularPath = p->get_specular_path();
+    e.settings = PresetSettings::serialize(p->get_settings());
+    e.position = *p->get_position();
+    e.tileX = p->get_tile_x();
+    e.tileY = p->get_tile_y();
+    QList<QImage> maps = {*p->get_normal(), *p->get_parallax(),
+                          *p->get_specular(), *p->get_occlusion()};
+    bool complete = true;
+    foreach (QImage map, maps)
+      complete &= !map.isNull();
+    /* Sprite sheets assemble their maps from cells, restore_maps cannot
+     * bring those back */
+    if (cacheMaps && complete && p->get_cells().isEmpty()) {
+      e.inputHash = input_hash(e);
+      e.settingsHash = settings_hash(e);
+      foreach (QImage map, maps)
+        e.maps.append(add_map(blobs, map));
+    }
+    entries.append(e);
+  }
+
+  QByteArray index;
+  QDataStream stream(&index, QIODevice::WriteOnly);
+  stream.setVersion(QDataStream::Qt_5_0);
+  stream << entries;
+
+  QByteArray prefix(prefixSize, 0);
+  uchar *d = reinterpret_cast<uchar *>(prefix.data());
+  memcpy(d, magic, 4);
+  qToBigEndian(version, d + 4);
+  qToBigEndian(static_cast<quint64>(index.size()), d + 8);
+
+  QSaveFile file(fileName);
+  if (!file.open(QIODevice::WriteOnly) || file.write(prefix) != prefixSize ||
+      file.write(index) != index.size() ||
+      file.write(blobs) != blobs.size() || !file.commit()) {
+    *error = file.errorString();
+    return false;
+  }
+  return true;
+}
+
+QList<ImageProcessor *> ProjectFile::load(QString fileName,
+                                          QStringList *errors,
+                                          int *restored) {
+  QList<ImageProcessor *> processors;
+  if (restored)
+    *restored = 0;
+  QFile file(fileName);
+  if (!file.open(QIODevice::ReadOnly)) {
+    errors->append(fileName + ": " + file.errorString());
+    return processors;
+  }
+  QByteArray prefix = file.read(prefixSize);
+  const uchar *d = reinterpret_cast<const uchar *>(prefix.constData());
+  if (prefix.size() != prefixSize || memcmp(d, magic, 4) ||
+      qFromBigEndian<quint32>(d + 4) != version) {
+    errors->append(fileName + ": not a project file of this version");
+    return processors;
+  }
+  quint64 indexSize = qFromBigEndian<quint64>(d + 8);
+  quint64 blobsStart = prefixSize + indexSize;
+  if (blobsStart > static_cast<quint64>(file.size())) {
+    errors->append(fileName + ": truncated project file");
+    return processors;
+  }
+  QByteArray index = file.read(static_cast<qint64>(indexSize));
+  QList<ProjectEntry> entries;
+  QDataStream stream(index);
+  stream.setVersion(QDataStream::Qt_5_0);
+  stream >> entries;
+  if (stream.status() != QDataStream::Ok) {
+    errors->append(fileName + ": corrupt project index");
+    return processors;
+  }
+
+  quint64 blobsSize = static_cast<quint64>(file.size()) - blobsStart;
+  const uchar *blobs = nullptr;
+  if (blobsSize > 0)
+    blobs = file.map(static_cast<qint64>(blobsStart),
+                     static_cast<qint64>(blobsSize));
+
+  foreach (ProjectEntry e, entries) {
+    bool success;
+    ImageLoader il;
+    QImage image = il.loadImage(e.fileName, &success);
+    if (!success || image.isNull()) {
+      errors->append(e.fileName + ": cannot load image");
+      continue;
+    }
+    QStringList presetErrors;
+    PresetSettings settings = PresetSettings::parse(e.settings, &presetErrors);
+    foreach (QString error, presetErrors)
+      errors->append(e.fileName + ": " + error);
+
+    image = image.convertToFormat(QImage::Format_RGBA8888_Premultiplied);
+    ImageProcessor *p = new ImageProcessor();
+    p->hold_updates();
+    p->loadImage(e.fileName, image);
+    if (!e.heightmapPath.isEmpty()) {
+      QImage height = il.loadImage(e.heightmapPath, &success);
+      if (success)
+        p->loadHeightMap(e.heightmapPath,
+                         height.convertToFormat(
+                             QImage::Format_RGBA8888_Premultiplied));
+      else
+        errors->append(e.heightmapPath + ": cannot load height map");
+    }
+    if (!e.specularPath.isEmpty()) {
+      QImage spec = il.loadImage(e.specularPath, &success);
+      if (success)
+        p->loadSpecularMap(e.specularPath,
+                           spec.convertToFormat(
+                               QImage::Format_RGBA8888_Premultiplied));
+      else
+        errors->append(e.specularPath + ": cannot load specular map");
+    }
+    settings.apply(*p);
+    p->set_position(e.position);
+    p->set_tile_x(e.tileX);
+    p->set_tile_y(e.tileY);
+
+    if (blobs && e.maps.count() == 4 && e.settingsHash == settings_hash(e) &&
+        e.inputHash == input_hash(e)) {
+      QList<QImage> maps;
+      foreach (CachedMap m, e.maps) {
+        QImage map = read_map(blobs, blobsSize, m);
+        if (map.size() != image.size())
+          break;
+        maps.append(map);
+      }
+      if (maps.count() == 4) {
+        p->restore_maps(maps[0], maps[1], maps[2], maps[3]);
+        if (restored)
+          (*restored)++;
+      }
+    }
+    p->release_updates();
+    processors.append(p);
+  }
+  return processors;
+}
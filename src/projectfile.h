@@ -0,0 +1,48 @@
+/*
+ * Laigter: an automatic map generator for lighting effects.
+ * Copyright (C) 2019  Pablo Ivan Fonovich
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ * Contact: azagaya.games@gmail.com
+ */
+
+#ifndef PROJECTFILE_H
+#define PROJECTFILE_H
+
+#include <QList>
+#include <QString>
+#include <QStringList>
+
+#include "src/imageprocessor.h"
+
+/* Project files keep the opened images with their settings, lights and
+ * custom height and specular maps, and optionally the generated maps so a
+ * project reopens without recalculating them.
+ *
+ * Layout: "LGTP", version (u32), index size (u64), the index written with
+ * QDataStream, then the cached maps as zlib compressed planes with tightly
+ * packed rows. Cached maps are reused only while the hash of the input
+ * files and the hash of the settings match; the project file is memory
+ * mapped while they are read. */
+class ProjectFile {
+public:
+  static bool save(QString fileName, QList<ImageProcessor *> processors,
+                   bool cacheMaps, QString *error);
+  /* Processors that cannot be restored are left out and reported in
+   * errors. restored counts the processors whose maps came from the cache. */
+  static QList<ImageProcessor *> load(QString fileName, QStringList *errors,
+                                      int *restored = nullptr);
+};
+
+#endif // PROJECTFILE_H
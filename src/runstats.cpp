@@ -0,0 +1,107 @@
+/*
+ * Laigter: an automatic map generator for lighting effects.
+ * Copyright (C) 2019  Pablo Ivan Fonovich
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ * Contact: azagaya.games@gmail.com
+ */
+
+#include "runstats.h"
+#include <QJsonArray>
+#include <QMap>
+#include <QVector>
+#include <QtMath>
+#include <algorithm>
+#if defined(Q_OS_WIN)
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+qint64 RunStats::peak_rss_kb() {
+#if defined(Q_OS_WIN)
+  PROCESS_MEMORY_COUNTERS counters;
+  if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+    return static_cast<qint64>(counters.PeakWorkingSetSize / 1024);
+  return -1;
+#else
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0)
+    return -1;
+#if defined(Q_OS_MACOS)
+  return usage.ru_maxrss / 1024; /* bytes on macOS */
+#else
+  return usage.ru_maxrss;
+#endif
+#endif
+}
+
+static double ms(qint64 nsecs) { return nsecs / 1e6; }
+
+/* Nearest rank percentile of sorted values */
+static qint64 percentile(const QVector<qint64> &sorted, double p) {
+  int rank = qCeil(p / 100.0 * sorted.count());
+  return sorted[qBound(0, rank - 1, sorted.count() - 1)];
+}
+
+QJsonObject RunStats::report(const QList<BatchResult> &results,
+                             qint64 wallNsecs, int threads) {
+  QJsonArray files;
+  QMap<QString, QVector<qint64>> perStage;
+  foreach (const BatchResult &r, results) {
+    QJsonObject file;
+    file["file"] = r.fileName;
+    file["ok"] = r.ok;
+    file["skipped"] = r.skipped;
+    if (!r.message.isEmpty())
+      file["error"] = r.message;
+    QJsonObject stages;
+    qint64 total = 0;
+    foreach (QString stage, r.stages.keys()) {
+      stages[stage] = ms(r.stages[stage]);
+      perStage[stage].append(r.stages[stage]);
+      total += r.stages[stage];
+    }
+    file["stages_ms"] = stages;
+    file["total_ms"] = ms(total);
+    files.append(file);
+  }
+
+  QJsonObject stages;
+  foreach (QString stage, perStage.keys()) {
+    QVector<qint64> values = perStage[stage];
+    std::sort(values.begin(), values.end());
+    qint64 sum = 0;
+    foreach (qint64 v, values)
+      sum += v;
+    QJsonObject s;
+    s["count"] = values.count();
+    s["total_ms"] = ms(sum);
+    s["mean_ms"] = ms(sum / values.count());
+    s["p50_ms"] = ms(percentile(values, 50));
+    s["p90_ms"] = ms(percentile(values, 90));
+    s["p99_ms"] = ms(percentile(values, 99));
+    s["max_ms"] = ms(values.last());
+    stages[stage] = s;
+  }
+
+  QJsonObject report;
+  report["files"] = files;
+  report["stages"] = stages;
+  report["wall_ms"] = ms(wallNsecs);
+  report["threads"] = threads;
+  report["peak_rss_kb"] = static_cast<double>(peak_rss_kb());
+  return report;
+}
@@ -0,0 +1,37 @@
+/*
+ * Laigter: an automatic map generator for lighting effects.
+ * Copyright (C) 2019  Pablo Ivan Fonovich
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ * Contact: azagaya.games@gmail.com
+ */
+
+#ifndef RUNSTATS_H
+#define RUNSTATS_H
+
+#include <QJsonObject>
+#include <QList>
+
+#include "src/batchprocessor.h"
+
+/* Machine readable report of a command line run (--stats): per file and
+ * per stage wall times, percentiles over the batch and peak RSS. */
+class RunStats {
+public:
+  static qint64 peak_rss_kb();
+  static QJsonObject report(const QList<BatchResult> &results,
+                            qint64 wallNsecs, int threads);
+};
+
+#endif // RUNSTATS_H
@@ -0,0 +1,95 @@
+/*
+ * Laigter: an automatic map generator for lighting effects.
+ * Copyright (C) 2019  Pablo Ivan Fonovich
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ * Contact: azagaya.games@gmail.com
+ */
+
+#include "shaderloader.h"
+#include "src/lightbuffer.h"
+#include <QFile>
+#include <QFileInfo>
+#include <QOpenGLContext>
+
+/* GLSL 3.30 spelling of the 1.10 shaders */
+static const char *modernVertex = "#version 330 core\n"
+                                  "#define attribute in\n"
+                                  "#define varying out\n";
+static const char *modernFragment =
+    "#version 330 core\n"
+    "#define LIGHT_BLOCK\n"
+    "#define varying in\n"
+    "#define texture2D texture\n"
+    "layout(location = 0) out vec4 fragColor;\n";
+static const char *legacyFragment = "#define fragColor gl_FragColor\n";
+
+/* Whether the current context takes the GLSL 3.30 shaders */
+bool ShaderLoader::modern() {
+  QOpenGLContext *context = QOpenGLContext::currentContext();
+  return context && !context->isOpenGLES() &&
+         context->format().version() >= qMakePair(3, 3);
+}
+
+/* Replaces every #include "file" line of code with that file, read from
+ * dir. Lines naming a missing file are left for the compiler to report. */
+static QByteArray expand_includes(QByteArray code, QString dir) {
+  QByteArray expanded;
+  foreach (QByteArray line, code.split('\n')) {
+    QByteArray directive = line.trimmed();
+    if (directive.startsWith("#include")) {
+      QByteArray name = directive.mid(8).trimmed();
+      QFile include(dir + "/" + name.mid(1, name.size() - 2));
+      if (name.startsWith('"') && name.endsWith('"') &&
+          include.open(QIODevice::ReadOnly)) {
+        expanded += include.readAll() + "\n";
+        continue;
+      }
+    }
+    expanded += line + "\n";
+  }
+  return expanded;
+}
+
+QByteArray ShaderLoader::source(QString fileName,
+                                QOpenGLShader::ShaderType type,
+                                QByteArray defines) {
+  QFile file(fileName);
+  if (!file.open(QIODevice::ReadOnly))
+    return QByteArray();
+  QByteArray prologue;
+  if (modern())
+    prologue = (type == QOpenGLShader::Vertex ? modernVertex : modernFragment) +
+               QByteArray("#define MAX_LIGHTS ") +
+               QByteArray::number(LightBuffer::capacity()) + "\n";
+  else if (type == QOpenGLShader::Fragment)
+    prologue = legacyFragment;
+  return prologue + defines +
+         expand_includes(file.readAll(), QFileInfo(fileName).path());
+}
+
+/* defines go after the prologue of both shaders, one #define per line */
+bool ShaderLoader::build(QOpenGLShaderProgram *program, QString vertexFile,
+                         QString fragmentFile, QByteArray defines) {
+  if (!program->addShaderFromSourceCode(
+          QOpenGLShader::Vertex,
+          source(vertexFile, QOpenGLShader::Vertex, defines)) ||
+      !program->addShaderFromSourceCode(
+          QOpenGLShader::Fragment,
+          source(fragmentFile, QOpenGLShader::Fragment, defines)))
+    return false;
+  program->bindAttributeLocation("aPos", 0);
+  program->bindAttributeLocation("aTexCoord", 1);
+  return program->link();
+}
@@ -0,0 +1,46 @@
+/*
+ * Laigter: an automatic map generator for lighting effects.
+ * Copyright (C) 2019  Pablo Ivan Fonovich
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ * Contact: azagaya.games@gmail.com
+ */
+
+#ifndef SHADERLOADER_H
+#define SHADERLOADER_H
+
+#include <QOpenGLShaderProgram>
+#include <QString>
+
+/* Builds the preview programs from shaders/. They are written in GLSL 1.10
+ * and compiled as such on older contexts. On OpenGL 3.3 and newer, core
+ * profiles included, a prologue compiles them as GLSL 3.30 instead: it maps
+ * attribute, varying, texture2D and the fragment output (at location 0),
+ * and defines LIGHT_BLOCK and, in both stages, MAX_LIGHTS so the lights
+ * come from LightBuffer's uniform block. aPos and aTexCoord are bound to
+ * locations 0 and 1 in every program so they can share vertex arrays.
+ * #include "file" lines are replaced with that file from the same
+ * directory, which is how the sprite shaders share shaders/sprite.glsl. */
+class ShaderLoader {
+public:
+  static bool modern();
+  static bool build(QOpenGLShaderProgram *program, QString vertexFile,
+                    QString fragmentFile, QByteArray defines = QByteArray());
+
+private:
+  static QByteArray source(QString fileName, QOpenGLShader::ShaderType type,
+                           QByteArray defines);
+};
+
+#endif // SHADERLOADER_H
@@ -0,0 +1,88 @@
+/*
+ * Laigter: an automatic map generator for lighting effects.
+ * Copyright (C) 2019  Pablo Ivan Fonovich
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ * Contact: azagaya.games@gmail.com
+ */
+
+
+#include "shadervariants.h"
+#include "src/shaderloader.h"
+#include <QDebug>
+
+ShaderVariants::ShaderVariants(QString vertexFile, QString fragmentFile,
+                               QStringList samplers, LightBuffer *lights)
+    : vertexFile(vertexFile), fragmentFile(fragmentFile), samplers(samplers),
+      lights(lights) {}
+
+ShaderVariants::~ShaderVariants() { clear(); }
+
+/* The program for defines, or nullptr when it does not build. Failures are
+ * remembered so they are not compiled again every frame. */
+QOpenGLShaderProgram *ShaderVariants::get(QByteArray defines) {
+  if (programs.contains(defines))
+    return programs[defines];
+
+  QOpenGLShaderProgram *program = new QOpenGLShaderProgram;
+  if (!ShaderLoader::build(program, vertexFile, fragmentFile, defines)) {
+    qWarning() << "Cannot build shader variant" << defines << program->log();
+    delete program;
+    program = nullptr;
+  } else {
+    lights->attach(program);
+    program->bind();
+    for (int i = 0; i < samplers.count(); i++)
+      program->setUniformValue(samplers[i].toUtf8().constData(), i);
+    program->release();
+  }
+  programs[defines] = program;
+  return program;
+}
+
+void ShaderVariants::clear() {
+  qDeleteAll(programs);
+  programs.clear();
+}
+
+/* Map samplers of the sprite shaders, in texture unit order */
+QStringList ShaderVariants::sprite_samplers() {
+  return QStringList() << "TEX"
+                       << "normalMap"
+                       << "parallaxMap"
+                       << "specularMap"
+                       << "occlusionMap"
+                       << "coneMap";
+}
+
+/* Defines of the sprite shaders specialised for the given features, with
+ * the light count rounded up to its LightBuffer::bucket() so only a few
+ * variants are ever built. With gBuffer they write the surface for the
+ * deferred light pass instead of lighting it, and need GLSL 3.30. */
+QByteArray ShaderVariants::sprite_defines(bool light, int lights,
+                                          bool parallax, bool coneStep,
+                                          bool pixelated, bool gBuffer) {
+  QByteArray defines = "#define VARIANT\n";
+  if (gBuffer)
+    defines += "#define GBUFFER\n";
+  defines += "#define LIGHTING " + QByteArray(light ? "true" : "false");
+  defines += "\n#define LIGHT_COUNT ";
+  defines += QByteArray::number(light && !gBuffer ? LightBuffer::bucket(lights)
+                                                  : 0);
+  defines += "\n#define PARALLAX " + QByteArray(parallax ? "true" : "false");
+  defines += "\n#define CONE_STEP " +
+             QByteArray(parallax && coneStep ? "true" : "false");
+  defines += "\n#define PIXELATED " + QByteArray(pixelated ? "true" : "false");
+  return defines + "\n";
+}
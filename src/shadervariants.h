@@ -0,0 +1,58 @@
+/*
+ * Laigter: an automatic map generator for lighting effects.
+ * Copyright (C) 2019  Pablo Ivan Fonovich
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ * Contact: azagaya.games@gmail.com
+ */
+
+
+#ifndef SHADERVARIANTS_H
+#define SHADERVARIANTS_H
+
+#include <QByteArray>
+#include <QHash>
+#include <QOpenGLShaderProgram>
+#include <QString>
+#include <QStringList>
+
+#include "src/lightbuffer.h"
+
+/* Programs built from one pair of shader files with different #defines,
+ * each compiled the first time it is asked for. Samplers are set to the
+ * unit of their index in samplers, and the Lights block is attached to
+ * lights. The sprite shaders read LIGHTING, PARALLAX, CONE_STEP and
+ * PIXELATED as constants and LIGHT_COUNT as the light loop bound when
+ * VARIANT is defined, see sprite_defines(), so the compiler can drop the
+ * branches and unroll the loop. Needs the context to be current. */
+class ShaderVariants {
+public:
+  ShaderVariants(QString vertexFile, QString fragmentFile,
+                 QStringList samplers, LightBuffer *lights);
+  ~ShaderVariants();
+  QOpenGLShaderProgram *get(QByteArray defines);
+  void clear();
+  static QStringList sprite_samplers();
+  static QByteArray sprite_defines(bool light, int lights, bool parallax,
+                                   bool coneStep, bool pixelated,
+                                   bool gBuffer = false);
+
+private:
+  QString vertexFile, fragmentFile;
+  QStringList samplers;
+  LightBuffer *lights;
+  QHash<QByteArray, QOpenGLShaderProgram *> programs;
+};
+
+#endif // SHADERVARIANTS_H
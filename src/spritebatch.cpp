@@ -0,0 +1,298 @@
+/*
+ * Laigter: an automatic map generator for lighting effects.
+ * Copyright (C) 2019  Pablo Ivan Fonovich
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ * Contact: azagaya.games@gmail.com
+ */
+
+#include "spritebatch.h"
+#include "src/shaderloader.h"
+#include "src/shadervariants.h"
+#include <QDebug>
+#include <QVector>
+
+/* Per-instance attributes (aOffset, aScale, aLayer, aUvScale, aPixels and
+ * aFlags) in buffer order, from the location given in bvshader.glsl, and
+ * their component counts */
+static const GLuint firstInstanceLocation = 2;
+static const int instanceAttributes = 6;
+static const int instanceSizes[] = {3, 2, 1, 2, 2, 2};
+static const int instanceFloats = 12;
+/* Largest sprite kept in the arrays. Every layer of the six arrays is as big
+ * as the largest sprite, so bigger ones take the per-sprite path instead of
+ * growing them all. */
+static const int maxLayerSize = 512;
+
+SpriteBatch::SpriteBatch(QObject *parent)
+    : QObject(parent), instances(QOpenGLBuffer::VertexBuffer) {
+  ready = false;
+  variants = nullptr;
+  capacity = 0;
+  mipMapsStale = false;
+  for (int i = 0; i < ProcessedImageCount; i++)
+    maps[i] = nullptr;
+}
+
+SpriteBatch::~SpriteBatch() { release(); }
+
+/* Deletes the GL objects, needs the context to be current. The owner calls
+ * it before the context goes away; the batch can be initialised again. */
+void SpriteBatch::release() {
+  for (int i = 0; i < ProcessedImageCount; i++) {
+    delete maps[i];
+    maps[i] = nullptr;
+  }
+  delete variants;
+  variants = nullptr;
+  if (vao.isCreated())
+    vao.destroy();
+  if (instances.isCreated())
+    instances.destroy();
+  m_program.removeAllShaders();
+  arraySize = QSize();
+  capacity = 0;
+  layers.clear();
+  freeLayers.clear();
+  ready = false;
+}
+
+/* Builds the program and vertex layout. The quad buffer is the one the
+ * widget draws single sprites with, and the programs read their lights
+ * from lights. Needs the context to be current. */
+bool SpriteBatch::init(QOpenGLBuffer *quad, LightBuffer *lights) {
+  if (!ShaderLoader::modern())
+    return false;
+  initializeOpenGLFunctions();
+
+  if (!ShaderLoader::build(&m_program, ":/shaders/bvshader.glsl",
+                           ":/shaders/bfshader.glsl")) {
+    qWarning() << "Sprite batching disabled:" << m_program.log();
+    return false;
+  }
+
+  /* aPos and aTexCoord are at 0 and 1 in every program, see ShaderLoader */
+  vao.create();
+  vao.bind();
+  quad->bind();
+  glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 5 * sizeof(float), nullptr);
+  glEnableVertexAttribArray(0);
+  glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(float),
+                        (void *)(3 * sizeof(float)));
+  glEnableVertexAttribArray(1);
+
+  instances.create();
+  instances.setUsagePattern(QOpenGLBuffer::DynamicDraw);
+  instances.bind();
+  for (int i = 0; i < instanceAttributes; i++) {
+    glEnableVertexAttribArray(firstInstanceLocation + i);
+    glVertexAttribDivisor(firstInstanceLocation + i, 1);
+  }
+  vao.release();
+  instances.release();
+  quad->release();
+
+  QStringList samplers = ShaderVariants::sprite_samplers();
+  m_program.bind();
+  for (int i = 0; i < samplers.count(); i++)
+    m_program.setUniformValue(samplers[i].toUtf8().constData(), i);
+  m_program.release();
+  lights->attach(&m_program);
+  variants = new ShaderVariants(":/shaders/bvshader.glsl",
+                                ":/shaders/bfshader.glsl", samplers, lights);
+
+  ready = true;
+  return true;
+}
+
+bool SpriteBatch::is_ready() { return ready; }
+
+bool SpriteBatch::can_batch(ImageProcessor *p) {
+  QSize size = p->get_texture()->size();
+  return !p->get_tile_x() && !p->get_tile_y() &&
+         size.width() <= maxLayerSize && size.height() <= maxLayerSize;
+}
+
+/* The program specialised for defines (see ShaderVariants), or the one
+ * taking everything as uniforms when none are given or it does not build */
+QOpenGLShaderProgram *SpriteBatch::program(QByteArray defines) {
+  QOpenGLShaderProgram *variant =
+      defines.isEmpty() ? nullptr : variants->get(defines);
+  return variant ? variant : &m_program;
+}
+
+/* Uploads what changed in the sprites' maps and fills the instance buffer
+ * with them, in order. Later draw() calls refer to sprites by their index
+ * in this list. viewport is in logical pixels, pixelRatio converts them to
+ * device pixels. Returns false when there is nothing to draw. */
+bool SpriteBatch::prepare(QList<ImageProcessor *> sprites, QSize viewport,
+                          qreal pixelRatio, bool pixelated) {
+  QSize size = arraySize;
+  foreach (ImageProcessor *p, sprites) {
+    if (!layers.contains(p)) {
+      connect(p, SIGNAL(destroyed(QObject *)), this,
+              SLOT(processor_destroyed(QObject *)));
+      SpriteLayer layer;
+      layer.index =
+          freeLayers.isEmpty() ? layers.count() : freeLayers.takeLast();
+      layers.insert(p, layer);
+    }
+    size = size.expandedTo(p->get_texture()->size());
+  }
+  if (size.isEmpty())
+    return false;
+  int count = layers.count() + freeLayers.count();
+  if (size != arraySize || count > capacity) {
+    int newCapacity = qMax(capacity, 4);
+    while (newCapacity < count)
+      newCapacity *= 2;
+    allocate(size, newCapacity);
+  }
+
+  bool minified = false;
+  QVector<GLfloat> data;
+  data.reserve(sprites.count() * instanceFloats);
+  foreach (ImageProcessor *p, sprites) {
+    SpriteLayer &layer = layers[p];
+    upload(p, layer);
+    QImage *image = p->get_texture();
+    QVector3D position = *p->get_position();
+    float zoom = p->get_zoom();
+    /* A texel is drawn zoom logical pixels wide, mipmaps are sampled once
+     * that is less than a device pixel */
+    minified |= zoom * pixelRatio < 1;
+    data << position.x() << position.y() << position.z()
+         << zoom * image->width() / viewport.width()
+         << zoom * image->height() / viewport.height() << layer.index
+         << static_cast<float>(image->width()) / arraySize.width()
+         << static_cast<float>(image->height()) / arraySize.height()
+         << image->width() << image->height() << p->get_selected()
+         << p->get_is_parallax();
+  }
+
+  QOpenGLTexture::Filter min = pixelated
+                                   ? QOpenGLTexture::NearestMipMapNearest
+                                   : QOpenGLTexture::LinearMipMapLinear;
+  QOpenGLTexture::Filter mag =
+      pixelated ? QOpenGLTexture::Nearest : QOpenGLTexture::Linear;
+  for (int i = 0; i < ProcessedImageCount; i++) {
+    maps[i]->setMinMagFilters(min, mag);
+    if (mipMapsStale && minified)
+      maps[i]->generateMipMaps();
+  }
+  if (minified)
+    mipMapsStale = false;
+
+  instances.bind();
+  instances.allocate(data.constData(), data.size() * sizeof(GLfloat));
+  instances.release();
+  return true;
+}
+
+/* Binds the arrays to units 0 to 5, with shown on unit 0 as the texture */
+void SpriteBatch::bind_maps(ProcessedImage shown) {
+  maps[static_cast<int>(shown)]->bind(0);
+  for (int i = 1; i < ProcessedImageCount; i++)
+    maps[i]->bind(static_cast<uint>(i));
+}
+
+/* Draws count sprites starting at first, with the program bound */
+void SpriteBatch::draw(int first, int count) {
+  vao.bind();
+  instances.bind();
+  size_t offset = static_cast<size_t>(first) * instanceFloats * sizeof(GLfloat);
+  for (int i = 0; i < instanceAttributes; i++) {
+    glVertexAttribPointer(firstInstanceLocation + i, instanceSizes[i],
+                          GL_FLOAT, GL_FALSE, instanceFloats * sizeof(GLfloat),
+                          (void *)offset);
+    offset += instanceSizes[i] * sizeof(GLfloat);
+  }
+  glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, count);
+  instances.release();
+  vao.release();
+}
+
+void SpriteBatch::allocate(QSize size, int layerCount) {
+  for (int i = 0; i < ProcessedImageCount; i++) {
+    delete maps[i];
+    maps[i] = new QOpenGLTexture(QOpenGLTexture::Target2DArray);
+    maps[i]->setFormat(QOpenGLTexture::RGBA8_UNorm);
+    maps[i]->setSize(size.width(), size.height());
+    maps[i]->setLayers(layerCount);
+    maps[i]->setMipLevels(maps[i]->maximumMipLevels());
+    maps[i]->allocateStorage(QOpenGLTexture::RGBA, QOpenGLTexture::UInt8);
+    maps[i]->setWrapMode(QOpenGLTexture::ClampToBorder);
+  }
+  arraySize = size;
+  capacity = layerCount;
+  mipMapsStale = true;
+
+  /* New storage starts out undefined, every sprite is uploaded again */
+  QHash<ImageProcessor *, SpriteLayer>::iterator it;
+  for (it = layers.begin(); it != layers.end(); ++it) {
+    it->size = QSize();
+    it->revisions.clear();
+  }
+}
+
+void SpriteBatch::clear_layer(int index) {
+  QByteArray zeros(arraySize.width() * arraySize.height() * 4, 0);
+  for (int i = 0; i < ProcessedImageCount; i++) {
+    maps[i]->bind();
+    glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, index, arraySize.width(),
+                    arraySize.height(), 1, GL_RGBA, GL_UNSIGNED_BYTE,
+                    zeros.constData());
+    maps[i]->release();
+  }
+}
+
+/* Copies the maps that changed since the last upload into the sprite's
+ * layer, only the region that changed when it is known */
+void SpriteBatch::upload(ImageProcessor *p, SpriteLayer &layer) {
+  QImage *images[ProcessedImageCount] = {
+      p->get_texture(),  p->get_normal(),    p->get_parallax(),
+      p->get_specular(), p->get_occlusion(), p->get_cone()};
+  if (layer.size != images[0]->size()) {
+    /* Whatever a larger sprite left in the layer would show around it */
+    clear_layer(layer.index);
+    layer.size = images[0]->size();
+    layer.revisions.clear();
+  }
+
+  QMap<ProcessedImage, quint64> uploaded = layer.revisions;
+  foreach (ProcessedImage map, p->changed_maps(layer.revisions)) {
+    QImage *image = images[static_cast<int>(map)];
+    QRect rect = uploaded.contains(map) ? p->dirty_rect(map, uploaded[map])
+                                        : QRect();
+    if (rect.isNull())
+      rect = image->rect();
+    rect &= image->rect() & QRect(QPoint(0, 0), arraySize);
+    if (rect.isEmpty())
+      continue;
+    QImage region =
+        image->copy(rect).convertToFormat(QImage::Format_RGBA8888);
+    maps[static_cast<int>(map)]->bind();
+    glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, rect.x(), rect.y(), layer.index,
+                    rect.width(), rect.height(), 1, GL_RGBA, GL_UNSIGNED_BYTE,
+                    region.constBits());
+    maps[static_cast<int>(map)]->release();
+    mipMapsStale = true;
+  }
+}
+
+void SpriteBatch::processor_destroyed(QObject *object) {
+  ImageProcessor *p = static_cast<ImageProcessor *>(object);
+  if (layers.contains(p))
+    freeLayers.append(layers.take(p).index);
+}
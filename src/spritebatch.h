@@ -0,0 +1,88 @@
+/*
+ * Laigter: an automatic map generator for lighting effects.
+ * Copyright (C) 2019  Pablo Ivan Fonovich
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ * Contact: azagaya.games@gmail.com
+ */
+
+#ifndef SPRITEBATCH_H
+#define SPRITEBATCH_H
+
+#include <QHash>
+#include <QList>
+#include <QMap>
+#include <QObject>
+#include <QOpenGLBuffer>
+#include <QOpenGLExtraFunctions>
+#include <QOpenGLShaderProgram>
+#include <QOpenGLTexture>
+#include <QOpenGLVertexArrayObject>
+#include <QSize>
+
+#include "src/imageprocessor.h"
+#include "src/lightbuffer.h"
+
+class ShaderVariants;
+
+/* Draws many sprites with a single instanced call. Each sprite's maps are
+ * kept in one layer of six texture arrays (texture, normal, parallax,
+ * specular, occlusion, cone step) sized to the largest sprite, and its
+ * placement and flags go in a per-instance buffer. Only sprites that are
+ * not tiled can be batched, as tiling relies on the texture wrapping
+ * around, and only small ones, so the arrays stay small too. Needs OpenGL
+ * 3.3; init() returns false on older contexts. */
+class SpriteBatch : public QObject, protected QOpenGLExtraFunctions {
+  Q_OBJECT
+public:
+  SpriteBatch(QObject *parent = nullptr);
+  ~SpriteBatch();
+  bool init(QOpenGLBuffer *quad, LightBuffer *lights);
+  void release();
+  bool is_ready();
+  static bool can_batch(ImageProcessor *p);
+  bool prepare(QList<ImageProcessor *> sprites, QSize viewport,
+               qreal pixelRatio, bool pixelated);
+  void bind_maps(ProcessedImage shown);
+  void draw(int first, int count);
+  QOpenGLShaderProgram *program(QByteArray defines = QByteArray());
+
+private slots:
+  void processor_destroyed(QObject *object);
+
+private:
+  struct SpriteLayer {
+    int index = 0;
+    QSize size;
+    QMap<ProcessedImage, quint64> revisions;
+  };
+
+  void allocate(QSize size, int layers);
+  void clear_layer(int index);
+  void upload(ImageProcessor *p, SpriteLayer &layer);
+
+  bool ready;
+  QOpenGLShaderProgram m_program;
+  ShaderVariants *variants;
+  QOpenGLVertexArrayObject vao;
+  QOpenGLBuffer instances;
+  QOpenGLTexture *maps[ProcessedImageCount];
+  QSize arraySize;
+  int capacity;
+  bool mipMapsStale;
+  QHash<ImageProcessor *, SpriteLayer> layers;
+  QList<int> freeLayers;
+};
+
+#endif // SPRITEBATCH_H
@@ -0,0 +1,92 @@
+/*
+ * Laigter: an automatic map generator for lighting effects.
+ * Copyright (C) 2019  Pablo Ivan Fonovich
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ * Contact: azagaya.games@gmail.com
+ */
+
+#include "spritesheet.h"
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QStringList>
+
+QList<QRect> SpriteSheet::grid(QSize size, int columns, int rows) {
+  QList<QRect> cells;
+  if (columns <= 0 || rows <= 0)
+    return cells;
+  int w = size.width() / columns;
+  int h = size.height() / rows;
+  if (w == 0 || h == 0)
+    return cells;
+  for (int j = 0; j < rows; j++) {
+    for (int i = 0; i < columns; i++) {
+      cells.append(QRect(i * w, j * h, w, h));
+    }
+  }
+  return cells;
+}
+
+/* spec is "<columns>x<rows>", as given on the command line */
+QList<QRect> SpriteSheet::grid(QSize size, QString spec, bool *success) {
+  QStringList aux = spec.toLower().split('x');
+  int columns = 0, rows = 0;
+  bool ok1 = false, ok2 = false;
+  if (aux.count() == 2) {
+    columns = aux[0].toInt(&ok1);
+    rows = aux[1].toInt(&ok2);
+  }
+  QList<QRect> cells;
+  if (ok1 && ok2)
+    cells = grid(size, columns, rows);
+  *success = !cells.isEmpty();
+  return cells;
+}
+
+static QRect json_rect(QJsonObject o) {
+  if (o.contains("frame"))
+    o = o["frame"].toObject();
+  return QRect(o["x"].toInt(), o["y"].toInt(), o["w"].toInt(),
+               o["h"].toInt());
+}
+
+/* Accepts a plain array of {x, y, w, h} objects and the hash and array
+ * variants of the usual atlas exporters ({"frames": ...}). */
+QList<QRect> SpriteSheet::from_json(QString fileName, bool *success) {
+  QList<QRect> cells;
+  *success = false;
+  QFile file(fileName);
+  if (!file.open(QIODevice::ReadOnly))
+    return cells;
+  QJsonDocument doc = QJsonDocument::fromJson(file.readAll());
+  QJsonValue frames;
+  if (doc.isArray())
+    frames = doc.array();
+  else if (doc.isObject())
+    frames = doc.object()["frames"];
+
+  if (frames.isArray()) {
+    foreach (QJsonValue v, frames.toArray()) {
+      cells.append(json_rect(v.toObject()));
+    }
+  } else if (frames.isObject()) {
+    foreach (QJsonValue v, frames.toObject()) {
+      cells.append(json_rect(v.toObject()));
+    }
+  }
+  *success = !cells.isEmpty();
+  return cells;
+}
@@ -0,0 +1,35 @@
+/*
+ * Laigter: an automatic map generator for lighting effects.
+ * Copyright (C) 2019  Pablo Ivan Fonovich
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ * Contact: azagaya.games@gmail.com
+ */
+
+#ifndef SPRITESHEET_H
+#define SPRITESHEET_H
+
+#include <QList>
+#include <QRect>
+#include <QSize>
+#include <QString>
+
+class SpriteSheet {
+public:
+  static QList<QRect> grid(QSize size, int columns, int rows);
+  static QList<QRect> grid(QSize size, QString spec, bool *success);
+  static QList<QRect> from_json(QString fileName, bool *success);
+};
+
+#endif // SPRITESHEET_H